@@ -3,6 +3,8 @@
 
 #include "blines.h"
 
+#include <algorithm>
+
 class aabb{
 public:
     interval x, y, z;
@@ -31,32 +33,35 @@ public:
     }
 
     bool hit(const ray& r, interval ray_t) const {
-        for(int a = 0; a < 3; ++a){
-            double invd = 1 / r.direction()[a];
-            double orig = r.origin()[a];
-
-            double t0 = (axis(a).min - orig) * invd;
-            double t1 = (axis(a).max - orig) * invd;
-
-            if(invd < 0)
-                std::swap(t0, t1);
+        const vec3& d = r.direction();
+        return hit(r.origin(), vec3(1 / d.x(), 1 / d.y(), 1 / d.z()), ray_t);
+    }
 
-            if(t0 > ray_t.min) ray_t.min = t0;
-            if(t1 < ray_t.max) ray_t.max = t1;
+    // inv_dir is 1 / direction, computed once per ray by the caller
+    bool hit(const point3& orig, const vec3& inv_dir, interval ray_t) const {
+        const interval* slabs[3] = {&x, &y, &z};
+        for(int a = 0; a < 3; ++a){
+            real t0 = (slabs[a]->min - orig[a]) * inv_dir[a];
+            real t1 = (slabs[a]->max - orig[a]) * inv_dir[a];
 
-            if(ray_t.max <= ray_t.min)
-                return false;
+            ray_t.min = std::max(ray_t.min, std::min(t0, t1));
+            ray_t.max = std::min(ray_t.max, std::max(t0, t1));
         }
-        return true;
+        return ray_t.min < ray_t.max;
     }
 
     aabb pad(){
-        static double delta = 0.0001;
-        interval new_x = (x.size() >= delta) ? x : x.expand(delta);
-        interval new_y = (y.size() >= delta) ? y : y.expand(delta);
-        interval new_z = (z.size() >= delta) ? z : z.expand(delta);
+        return aabb(pad(x), pad(y), pad(z));
+    }
 
-        return aabb(new_x, new_y, new_z);
+private:
+    // far from the origin 0.0001 is below float precision and the padding would round away,
+    // so the delta grows with the coordinates; in double it never does for sane scenes
+    static interval pad(const interval& slab){
+        real magnitude = std::max(std::fabs(slab.min), std::fabs(slab.max));
+        if(!std::isfinite(magnitude)) magnitude = 0;
+        real delta = std::max<real>(0.0001, 16 * std::numeric_limits<real>::epsilon() * magnitude);
+        return (slab.size() >= delta) ? slab : slab.expand(delta);
     }
 };
 
@@ -0,0 +1,1037 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "blines.h"
+#include "bvh.h"
+#include "image_writer.h"
+#include "instance.h"
+#include "light_list.h"
+#include "material.h"
+#include "quad.h"
+#include "scene_cache.h"
+#include "scenes.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "triangle_mesh.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <type_traits>
+
+#ifdef BLINES_COUNT_ALLOCATIONS
+#include <atomic>
+#include <new>
+
+// every heap allocation of the program goes through here when counting is on
+std::atomic<long> allocation_count(0);
+
+void* operator new(std::size_t size){
+    ++allocation_count;
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
+
+// run f() and print how long it took; sink keeps the result alive
+template<typename F>
+double time_it(const std::string& name, long count, F f){
+    auto start = std::chrono::steady_clock::now();
+    double sink = f();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::clog << name << ": " << elapsed.count() << "s, "
+              << (count / elapsed.count()) / 1e6 << " M/s"
+              << " (sink " << sink << ")\n";
+    return elapsed.count();
+}
+
+void bench_rng(long count = 100000000){
+    time_it("rand()", count, [&]{
+        double sum = 0;
+        for(long i = 0; i < count; ++i) sum += rand() / (RAND_MAX + 1.0);
+        return sum;
+    });
+
+    time_it("mt19937", count, [&]{
+        std::uniform_real_distribution<double> distribution(0.0, 1.0);
+        std::mt19937 generator;
+        double sum = 0;
+        for(long i = 0; i < count; ++i) sum += distribution(generator);
+        return sum;
+    });
+
+    time_it("pcg32 (thread_local)", count, [&]{
+        double sum = 0;
+        for(long i = 0; i < count; ++i) sum += random_double();
+        return sum;
+    });
+}
+
+// the geometry of final_scene that matters for traversal: 400 boxes (2400 quads) and 1000 spheres
+hittable_list bench_final_scene_geometry(){
+    hittable_list objects;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+
+    for(int i = 0; i < 20; ++i){
+        for(int j = 0; j < 20; ++j){
+            double x0 = -1000 + i * 100.0;
+            double z0 = -1000 + j * 100.0;
+            hittable_list sides = *box(point3(x0, 0, z0), point3(x0 + 100, random_double(1, 101), z0 + 100), white);
+            for(const auto& side : sides.objects){
+                objects.add(side);
+            }
+        }
+    }
+
+    for(int j = 0; j < 1000; ++j){
+        objects.add(make_shared<sphere>(point3::random(0, 165) + vec3(-100, 270, 395), 10, white));
+    }
+
+    return objects;
+}
+
+// primary-like rays from final_scene's camera towards random points of the scene
+std::vector<ray> bench_rays(const aabb& bounds, int count){
+    std::vector<ray> rays;
+    rays.reserve(count);
+    point3 origin(478, 278, -600);
+    for(int i = 0; i < count; ++i){
+        point3 target(random_double(bounds.x.min, bounds.x.max),
+                      random_double(bounds.y.min, bounds.y.max),
+                      random_double(bounds.z.min, bounds.z.max));
+        rays.push_back(ray(origin, target - origin));
+    }
+    return rays;
+}
+
+double trace_all(const hittable& world, const std::vector<ray>& rays){
+    double sum = 0;
+    hit_record rec;
+    for(const ray& r : rays){
+        if(world.hit(r, interval(0.001, infinity), rec)) sum += rec.t;
+    }
+    return sum;
+}
+
+void bench_bvh(int ray_count = 2000000){
+    hittable_list objects = bench_final_scene_geometry();
+    std::vector<ray> rays = bench_rays(objects.bounding_box(), ray_count);
+    long prim_count = objects.objects.size();
+
+    shared_ptr<hittable> tree;
+    shared_ptr<bvh_node> median, sah;
+    time_it("pointer bvh build", prim_count, [&]{
+        tree = make_shared<pointer_bvh_node>(objects);
+        return 0.0;
+    });
+    time_it("linear bvh build (random median)", prim_count, [&]{
+        median = make_shared<bvh_node>(objects, bvh_split::random_median);
+        return 0.0;
+    });
+    time_it("linear bvh build (sah)", prim_count, [&]{
+        sah = make_shared<bvh_node>(objects, bvh_split::sah);
+        return 0.0;
+    });
+
+    std::clog << "random median: " << median->stats() << "\n"
+              << "sah: " << sah->stats() << "\n";
+
+    time_it("pointer bvh rays", ray_count, [&]{ return trace_all(*tree, rays); });
+    time_it("linear bvh rays (random median)", ray_count, [&]{ return trace_all(*median, rays); });
+    time_it("linear bvh rays (sah)", ray_count, [&]{ return trace_all(*sah, rays); });
+}
+
+// fun_balls style grid of small spheres, count of them
+hittable_list bench_ball_grid(long count){
+    hittable_list balls;
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    int side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count))));
+    for(long n = 0; n < count; ++n){
+        int a = static_cast<int>(n / side) - side / 2;
+        int b = static_cast<int>(n % side) - side / 2;
+        point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+        balls.add(make_shared<sphere>(center, 0.2, mat));
+    }
+    return balls;
+}
+
+// 10M spheres need several GB, pass a smaller max_count on small machines
+void bench_bvh_build(long max_count = 10000000){
+    for(long count = 10000; count <= max_count; count *= 10){
+        hittable_list balls = bench_ball_grid(count);
+        std::clog << count << " spheres\n";
+
+        time_it("  sah, serial", count, [&]{
+            return static_cast<double>(bvh_node(balls, bvh_split::sah, false).node_count());
+        });
+        time_it("  sah, parallel", count, [&]{
+            return static_cast<double>(bvh_node(balls, bvh_split::sah, true).node_count());
+        });
+        time_it("  lbvh, serial", count, [&]{
+            return static_cast<double>(bvh_node(balls, bvh_split::lbvh, false).node_count());
+        });
+        time_it("  lbvh, parallel", count, [&]{
+            return static_cast<double>(bvh_node(balls, bvh_split::lbvh, true).node_count());
+        });
+    }
+}
+
+// slab tests on random boxes: per ray division, precomputed reciprocal, simd_width boxes at once
+void bench_box(int box_groups = 256, int ray_count = 20000){
+    std::vector<aabb> boxes;
+    std::vector<wide_box<simd_width>> wide(box_groups);
+    for(int g = 0; g < box_groups; ++g){
+        for(int k = 0; k < simd_width; ++k){
+            point3 a = point3::random(-10, 10);
+            aabb box(a, a + vec3::random(0.1, 3));
+            boxes.push_back(box);
+            for(int axis = 0; axis < 3; ++axis){
+                wide[g].bounds[0][axis][k] = static_cast<float>(box.axis(axis).min);
+                wide[g].bounds[1][axis][k] = static_cast<float>(box.axis(axis).max);
+            }
+        }
+    }
+
+    std::vector<ray> rays;
+    for(int i = 0; i < ray_count; ++i){
+        rays.push_back(ray(point3::random(-20, 20), vec3::random(-1, 1)));
+    }
+
+    long tests = static_cast<long>(boxes.size()) * ray_count;
+    time_it("aabb::hit", tests, [&]{
+        double hits = 0;
+        for(const ray& r : rays){
+            for(const aabb& box : boxes) hits += box.hit(r, interval(0.001, infinity));
+        }
+        return hits;
+    });
+
+    time_it("aabb::hit, precomputed 1/d", tests, [&]{
+        double hits = 0;
+        for(const ray& r : rays){
+            vec3 inv_dir(1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z());
+            for(const aabb& box : boxes) hits += box.hit(r.origin(), inv_dir, interval(0.001, infinity));
+        }
+        return hits;
+    });
+
+    time_it("wide_box_hit", tests, [&]{
+        double hits = 0;
+        float tnear[simd_width];
+        for(const ray& r : rays){
+            ray_slab rs(r.origin(), r.direction());
+            for(const auto& group : wide){
+                int mask = wide_box_hit(group, rs, 0.001f, std::numeric_limits<float>::infinity(), tnear);
+                for(int k = 0; k < simd_width; ++k) hits += (mask >> k) & 1;
+            }
+        }
+        return hits;
+    });
+}
+
+// camera rays only, one at a time against packets of 4, 8 and 16
+void bench_packets(int samples_per_pixel = 16){
+    struct named_scene {
+        std::string name;
+        scene sc;
+    };
+    std::vector<named_scene> scenes = {
+        {"the_trio", the_trio()},
+        {"fun_balls", fun_balls()},
+        {"cornell_box", cornell_box("bench.ppm")},
+    };
+
+    for(named_scene& s : scenes){
+        camera& cam = s.sc.cam;
+        cam.samples_per_pixel = samples_per_pixel;
+        long rays = static_cast<long>(cam.image_width) * static_cast<int>(cam.image_width / cam.aspect_ratio) * samples_per_pixel;
+
+        for(int size : {0, 4, 8, 16}){
+            cam.packet_size = size;
+            std::string label = s.name + (size == 0 ? ", single rays" : ", packets of " + std::to_string(size));
+            time_it(label, rays, [&]{ return static_cast<double>(cam.trace_primary(s.sc.world)); });
+        }
+    }
+}
+
+// heap allocations made while rendering, only counted when built with -DBLINES_COUNT_ALLOCATIONS
+void bench_allocations(int image_width = 100, int samples_per_pixel = 16){
+#ifdef BLINES_COUNT_ALLOCATIONS
+    scene sc = cornell_box("bench.ppm");
+    sc.cam.image_width = image_width;
+    sc.cam.samples_per_pixel = samples_per_pixel;
+    sc.cam.thread_count = 1;
+
+    long before = allocation_count;
+    sc.render();
+    long allocations = allocation_count - before;
+    long paths = static_cast<long>(image_width) * image_width * samples_per_pixel;
+
+    std::clog << allocations << " allocations for " << paths << " paths ("
+              << static_cast<double>(allocations) / paths << " per path)\n";
+#else
+    std::clog << "build with -DBLINES_COUNT_ALLOCATIONS to count allocations\n";
+#endif
+}
+
+// root mean square error of the per pixel averages, nans count as black like in write_color
+double rmse(const std::vector<color>& image, int spp, const std::vector<color>& reference, int reference_spp){
+    double sum = 0;
+    for(size_t p = 0; p < image.size(); ++p){
+        for(int c = 0; c < 3; ++c){
+            double a = image[p][c] / spp;
+            double b = reference[p][c] / reference_spp;
+            if(a != a) a = 0;
+            if(b != b) b = 0;
+            sum += (a - b) * (a - b);
+        }
+    }
+    return sqrt(sum / (3 * image.size()));
+}
+
+// renders sc at spp and compares it with reference; time * rmse^2 is proportional
+// to the time needed to reach any fixed noise level, lower is better
+// returns the render time
+double report_convergence(const std::string& name, scene& sc, int spp, const std::vector<color>& reference, int reference_spp){
+    sc.cam.samples_per_pixel = spp;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<color> image = sc.cam.render_framebuffer(sc.world, sc.lights);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double error = rmse(image, spp, reference, reference_spp);
+    std::clog << name << ": " << elapsed.count() << "s, rmse " << error
+              << ", time * rmse^2 " << elapsed.count() * error * error << "\n";
+    return elapsed.count();
+}
+
+// recursive-equivalent paths against russian roulette, both compared to a long render without it
+void bench_roulette(int image_width = 100, int spp = 64, int reference_spp = 4096){
+    struct named_scene {
+        std::string name;
+        scene sc;
+    };
+    std::vector<named_scene> scenes = {
+        {"cornell_box", cornell_box("bench.ppm")},
+        {"final_scene", final_scene(image_width, spp, 40)},
+    };
+
+    for(named_scene& s : scenes){
+        camera& cam = s.sc.cam;
+        cam.image_width = image_width;
+        cam.russian_roulette = false;
+        cam.samples_per_pixel = reference_spp;
+        std::vector<color> reference = cam.render_framebuffer(s.sc.world, s.sc.lights);
+
+        report_convergence(s.name + ", max_depth only", s.sc, spp, reference, reference_spp);
+        cam.russian_roulette = true;
+        report_convergence(s.name + ", russian roulette", s.sc, spp, reference, reference_spp);
+    }
+}
+
+// per pixel means of a framebuffer whose pixels took different numbers of samples
+std::vector<color> average(const std::vector<color>& image, const std::vector<int>& counts){
+    std::vector<color> mean(image.size());
+    for(size_t p = 0; p < image.size(); ++p){
+        mean[p] = counts[p] > 0 ? image[p] / counts[p] : color(0, 0, 0);
+    }
+    return mean;
+}
+
+// uniform sampling against adaptive sampling capped at 4x the samples, compared to a long render
+void bench_adaptive(int image_width = 100, int spp = 64, int reference_spp = 4096){
+    scene sc = cornell_box("bench.ppm");
+    camera& cam = sc.cam;
+    cam.image_width = image_width;
+    cam.samples_per_pixel = reference_spp;
+    std::vector<color> reference = cam.render_framebuffer(sc.world, sc.lights);
+
+    report_convergence("uniform, " + std::to_string(spp) + " spp", sc, spp, reference, reference_spp);
+
+    for(double threshold : {0.1, 0.05, 0.03}){
+        cam.adaptive = true;
+        cam.noise_threshold = threshold;
+        cam.samples_per_pixel = 4 * spp;
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<color> image = cam.render_framebuffer(sc.world, sc.lights);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        double error = rmse(average(image, cam.pixel_sample_counts()), 1, reference, reference_spp);
+        std::clog << "adaptive, threshold " << threshold << ": " << elapsed.count() << "s, rmse " << error
+                  << ", time * rmse^2 " << elapsed.count() * error * error << "\n";
+    }
+}
+
+// the old per pixel text output against the image writers on a 600x600 image of noise
+void bench_image_io(int size = 600){
+    image img(size, size);
+    for(color& c : img.pixels){
+        c = color::random() * 2;
+    }
+
+    auto report = [](const std::string& name, const std::string& filename, double seconds){
+        std::ifstream in(filename, std::ios::binary | std::ios::ate);
+        std::clog << name << ": " << seconds * 1000 << "ms, " << in.tellg() / 1024 << " KiB\n";
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::ofstream out("bench_p3_stream.ppm");
+        out << "P3\n" << size << " " << size << "\n255\n";
+        for(const color& c : img.pixels){
+            write_color(out, c, 1);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    report("P3 through write_color", "bench_p3_stream.ppm", elapsed.count());
+
+    struct named_writer {
+        std::string name;
+        std::string filename;
+        std::unique_ptr<image_writer> writer;
+    };
+    std::vector<named_writer> writers;
+    writers.push_back({"P3 buffered", "bench_p3.ppm", std::make_unique<ppm_writer>(false)});
+    writers.push_back({"P6", "bench_p6.ppm", std::make_unique<ppm_writer>()});
+    writers.push_back({"PNG", "bench.png", std::make_unique<png_writer>()});
+    writers.push_back({"PFM", "bench.pfm", std::make_unique<pfm_writer>()});
+    writers.push_back({"HDR", "bench.hdr", std::make_unique<hdr_writer>()});
+
+    for(named_writer& w : writers){
+        start = std::chrono::steady_clock::now();
+        w.writer->write(w.filename, img);
+        elapsed = std::chrono::steady_clock::now() - start;
+        report(w.name, w.filename, elapsed.count());
+    }
+}
+
+// reads back what pfm_writer wrote, rows top to bottom; empty when there is no such file
+std::vector<color> read_pfm(const std::string& filename, int& width, int& height){
+    std::ifstream in(filename, std::ios::binary);
+    std::string magic;
+    double scale;
+    if(!(in >> magic >> width >> height >> scale) || magic != "PF"){
+        return {};
+    }
+    in.get();
+
+    std::vector<float> data(3 * width * height);
+    in.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(float));
+    if(!in){
+        return {};
+    }
+
+    std::vector<color> pixels(width * height);
+    for(int i = 0; i < height; ++i){
+        for(int j = 0; j < width; ++j){
+            const float* c = &data[3 * ((height - 1 - i) * width + j)];
+            pixels[i * width + j] = color(c[0], c[1], c[2]);
+        }
+    }
+    return pixels;
+}
+
+// build twice, with and without -DBLINES_USE_FLOAT, and run both; each run leaves its image
+// behind and compares against the other build's if it is there
+// the rmse between two seeds of the same build is the noise floor, float against double
+// should land on it when the epsilons are right
+void bench_precision(int image_width = 100, int spp = 64){
+    std::string build = std::is_same<real, float>::value ? "float" : "double";
+    std::string other = std::is_same<real, float>::value ? "double" : "float";
+
+    std::clog << build << " build: vec3 " << sizeof(vec3) << " bytes, ray " << sizeof(ray)
+              << ", aabb " << sizeof(aabb) << ", hit_record " << sizeof(hit_record)
+              << ", sphere " << sizeof(sphere) << ", quad " << sizeof(quad) << "\n";
+
+    struct named_scene {
+        std::string name;
+        scene sc;
+    };
+    std::vector<named_scene> scenes = {
+        {"cornell_box", cornell_box("bench.ppm")},
+        {"final_scene", final_scene(image_width, spp, 40)},
+    };
+
+    for(named_scene& s : scenes){
+        camera& cam = s.sc.cam;
+        cam.image_width = image_width;
+        cam.samples_per_pixel = spp;
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<color> image = cam.render_framebuffer(s.sc.world, s.sc.lights);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        cam.seed = 1;
+        std::vector<color> reseeded = cam.render_framebuffer(s.sc.world, s.sc.lights);
+        std::clog << s.name << ": " << elapsed.count() << "s, rmse to another seed "
+                  << rmse(image, spp, reseeded, spp);
+
+        int height = static_cast<int>(image.size()) / image_width;
+        ::image mean(image_width, height);
+        mean.pixels = average(image, cam.pixel_sample_counts());
+        pfm_writer().write("bench_precision_" + s.name + "_" + build + ".pfm", mean);
+
+        int other_width, other_height;
+        std::vector<color> other_image = read_pfm("bench_precision_" + s.name + "_" + other + ".pfm", other_width, other_height);
+        if(other_image.size() == image.size()){
+            std::clog << ", rmse to the " << other << " build " << rmse(image, spp, other_image, 1);
+        }
+        std::clog << "\n";
+    }
+}
+
+// bvh over one sphere object each against one sphere_set, on final_scene's 1000 sphere
+// cluster and on a fun_balls sized grid
+void bench_sphere_set(int ray_count = 2000000){
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    hittable_list cluster;
+    sphere_set cluster_set;
+    for(int j = 0; j < 1000; ++j){
+        point3 center = point3::random(0, 165) + vec3(-100, 270, 395);
+        cluster.add(make_shared<sphere>(center, 10, white));
+        cluster_set.add(center, 10, white);
+    }
+
+    hittable_list grid;
+    sphere_set grid_set;
+    for(int a = -11; a < 11; ++a){
+        for(int b = -11; b < 11; ++b){
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+            grid.add(make_shared<sphere>(center, 0.2, white));
+            grid_set.add(center, 0.2, white);
+        }
+    }
+
+    cluster_set.build();
+    grid_set.build();
+    bvh_node cluster_bvh(cluster);
+    bvh_node grid_bvh(grid);
+
+    std::vector<ray> cluster_rays = bench_rays(cluster_bvh.bounding_box(), ray_count);
+    time_it("1000 sphere cluster, bvh of spheres", ray_count, [&]{ return trace_all(cluster_bvh, cluster_rays); });
+    time_it("1000 sphere cluster, sphere_set", ray_count, [&]{ return trace_all(cluster_set, cluster_rays); });
+
+    // looking down at the grid from fun_balls' camera
+    std::vector<ray> grid_rays;
+    grid_rays.reserve(ray_count);
+    aabb bounds = grid_bvh.bounding_box();
+    for(int i = 0; i < ray_count; ++i){
+        point3 origin(13, 2, 3);
+        point3 target(random_double(bounds.x.min, bounds.x.max), 0.2, random_double(bounds.z.min, bounds.z.max));
+        grid_rays.push_back(ray(origin, target - origin));
+    }
+    time_it("484 sphere grid, bvh of spheres", ray_count, [&]{ return trace_all(grid_bvh, grid_rays); });
+    time_it("484 sphere grid, sphere_set", ray_count, [&]{ return trace_all(grid_set, grid_rays); });
+}
+
+// writes a uv sphere of 2 * rings * segments triangles with normals and uvs as an obj
+void write_sphere_obj(const std::string& filename, int rings, int segments, real radius){
+    std::FILE* file = std::fopen(filename.c_str(), "w");
+    for(int i = 0; i <= rings; ++i){
+        real theta = pi * i / rings;
+        for(int j = 0; j <= segments; ++j){
+            real phi = 2 * pi * j / segments;
+            vec3 n(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+            std::fprintf(file, "v %f %f %f\nvn %f %f %f\nvt %f %f\n", radius * n.x(), radius * n.y(), radius * n.z(),
+                         n.x(), n.y(), n.z(), static_cast<real>(j) / segments, 1 - static_cast<real>(i) / rings);
+        }
+    }
+    for(int i = 0; i < rings; ++i){
+        for(int j = 0; j < segments; ++j){
+            int a = i * (segments + 1) + j + 1, b = a + 1, c = a + segments + 1, d = c + 1;
+            std::fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, c, c, c, b, b, b);
+            std::fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", b, b, b, c, c, c, d, d, d);
+        }
+    }
+    std::fclose(file);
+}
+
+// load time, memory and ray throughput of a tessellated sphere, the analytic sphere for comparison
+// 1000 x 1000 is 2M triangles and a 150MB obj
+void bench_mesh(int rings = 1000, int segments = 1000, int ray_count = 1000000){
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    std::string filename = "bench_mesh.obj";
+    time_it("write obj", 2L * rings * segments, [&]{
+        write_sphere_obj(filename, rings, segments, 100);
+        return 0.0;
+    });
+
+    shared_ptr<triangle_mesh> mesh;
+    time_it("load obj", 2L * rings * segments, [&]{
+        mesh = load_obj(filename, white);
+        return static_cast<double>(mesh->triangle_count());
+    });
+
+    sphere ball(point3(0, 0, 0), 100, white);
+    std::vector<ray> rays;
+    rays.reserve(ray_count);
+    for(int i = 0; i < ray_count; ++i){
+        point3 origin = 300 * random_unit_vector();
+        rays.push_back(ray(origin, point3::random(-120, 120) - origin));
+    }
+    time_it("mesh rays", ray_count, [&]{ return trace_all(*mesh, rays); });
+    time_it("sphere rays", ray_count, [&]{ return trace_all(ball, rays); });
+}
+
+// drops a file from the page cache so the next map has to read it from disk, where the os allows it
+void evict_file(const std::string& filename){
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd >= 0){
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#endif
+}
+
+// seconds to build or map a world and trace the first rays through it, a mapped file only
+// reads the pages those rays touch so mapping alone would flatter it
+template<typename Start>
+double startup_time(const std::string& name, const std::vector<ray>& rays, Start start){
+    auto begin = std::chrono::steady_clock::now();
+    hittable_list world = start();
+    std::chrono::duration<double> ready = std::chrono::steady_clock::now() - begin;
+    double sink = trace_all(world, rays);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    std::clog << name << ": ready in " << 1000 * ready.count() << "ms, " << rays.size() << " rays traced after "
+              << 1000 * elapsed.count() << "ms (sink " << sink << ")\n";
+    return elapsed.count();
+}
+
+// building a world in code against mapping it from a scene cache, cold and warm
+void bench_cached_world(const std::string& name, hittable_list (*build)(), int ray_count){
+    std::string cache_file = "bench_" + name + ".cache";
+    std::remove(cache_file.c_str());
+
+    seed_random(1, 0);
+    hittable_list built = build();
+    std::vector<ray> rays = bench_rays(built.bounding_box(), ray_count);
+
+    seed_random(1, 0);
+    startup_time(name + ", built in code", rays, build);
+
+    seed_random(1, 0);
+    time_it(name + ", save cache", 1, [&]{
+        return static_cast<double>(scene_cache::save(cache_file, 1, build(), hittable_list()));
+    });
+
+    for(const char* temperature : {"cold", "warm"}){
+        if(std::string(temperature) == "cold"){
+            evict_file(cache_file);
+        }
+        startup_time(name + ", mapped " + temperature, rays, [&]{
+            return hittable_list(scene_cache::load(cache_file, 1));
+        });
+    }
+
+    auto sc = scene_cache::load(cache_file, 1);
+    std::clog << name << ": " << sc->primitive_count() << " primitives, " << sc->file_size() / 1024 << " KiB\n";
+}
+
+hittable_list bench_mesh_world(){
+    std::string filename = "bench_scene_cache.obj";
+    std::ifstream existing(filename);
+    if(!existing){
+        write_sphere_obj(filename, 300, 300, 100);
+    }
+    return hittable_list(load_obj(filename, make_shared<lambertian>(color(.73, .73, .73))));
+}
+
+// startup of final_scene and of a 180k triangle mesh built in code and mapped from a cache,
+// then a small final_scene render of both against the noise between two seeds
+void bench_scene_cache(int ray_count = 100000, int image_width = 64, int spp = 16){
+    bench_cached_world("final_scene", final_scene_world, ray_count);
+    bench_cached_world("mesh", bench_mesh_world, ray_count);
+
+    seed_random(2, 0);
+    scene built = final_scene(image_width, spp, 40);
+    seed_random(2, 0);
+    scene mapped = final_scene(image_width, spp, 40, "bench_final_scene_render.cache");
+
+    std::vector<color> reference = built.cam.render_framebuffer(built.world, built.lights);
+    std::vector<color> mapped_image = mapped.cam.render_framebuffer(mapped.world, mapped.lights);
+    built.cam.seed = 1;
+    std::vector<color> reseeded = built.cam.render_framebuffer(built.world, built.lights);
+    std::clog << "final_scene " << image_width << "px " << spp << " spp: rmse mapped to built "
+              << rmse(mapped_image, spp, reference, spp) << ", between two seeds "
+              << rmse(reseeded, spp, reference, spp) << "\n";
+    std::remove("bench_final_scene_render.cache");
+}
+
+// rays from the middle of a field of clusters out in every direction
+std::vector<ray> field_rays(int count){
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for(int i = 0; i < count; ++i){
+        rays.push_back(ray(point3(0, 0, 0), random_unit_vector()));
+    }
+    return rays;
+}
+
+// a two level bvh over instances of one cluster against the same spheres copied into one sphere_set
+void bench_instances(int count = 100000, int flat_count = 200, int ray_count = 1000000){
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    std::vector<point3> centers;
+    auto cluster = make_shared<sphere_set>();
+    for(int j = 0; j < 1000; ++j){
+        centers.push_back(point3::random(0, 165));
+        cluster->add(centers.back(), 10, white);
+    }
+    cluster->build();
+
+    // instances of the same placements and a flattened copy, both should see the same hits
+    std::vector<affine> placements;
+    for(int i = 0; i < flat_count; ++i){
+        placements.push_back(random_placement(300 * std::cbrt(static_cast<real>(flat_count))));
+    }
+
+    hittable_list flat_instances;
+    sphere_set flat;
+    for(const affine& a : placements){
+        flat_instances.add(make_shared<instance>(cluster, a));
+        real scale = std::cbrt(a.determinant());
+        for(const point3& c : centers){
+            flat.add(a.point(c), 10 * scale, white);
+        }
+    }
+    flat.build();
+    bvh_node instanced(flat_instances);
+
+    std::vector<ray> rays = field_rays(ray_count);
+    std::string copies = std::to_string(flat_count) + " clusters, ";
+    time_it(copies + "flattened into one sphere_set", ray_count, [&]{ return trace_all(flat, rays); });
+    time_it(copies + "instances", ray_count, [&]{ return trace_all(instanced, rays); });
+    std::clog << copies << "flattened " << flat.memory_bytes() / 1e6 << " MB, instanced "
+              << (cluster->memory_bytes() + instanced.memory_bytes() + flat_count * (sizeof(instance) + 2 * sizeof(void*))) / 1e6
+              << " MB\n";
+
+    // the full field, a flattened copy would be count times the cluster
+    real side = 300 * std::cbrt(static_cast<real>(count));
+    hittable_list instances;
+    shared_ptr<bvh_node> field;
+    copies = std::to_string(count) + " clusters, ";
+    time_it(copies + "placing instances", count, [&]{
+        for(int i = 0; i < count; ++i){
+            instances.add(make_shared<instance>(cluster, random_placement(side)));
+        }
+        return static_cast<double>(instances.objects.size());
+    });
+    time_it(copies + "top level bvh build", count, [&]{
+        field = make_shared<bvh_node>(instances);
+        return static_cast<double>(field->node_count());
+    });
+
+    size_t instance_bytes = count * (sizeof(instance) + 2 * sizeof(void*)) + instances.objects.capacity() * sizeof(shared_ptr<hittable>);
+    std::clog << copies << "cluster " << cluster->memory_bytes() / 1e6 << " MB, instances " << instance_bytes / 1e6
+              << " MB, top level bvh " << field->memory_bytes() / 1e6 << " MB, flattened would be about "
+              << count * (flat.memory_bytes() / static_cast<double>(flat_count)) / 1e9 << " GB\n";
+
+    time_it(copies + "instances", ray_count, [&]{ return trace_all(*field, rays); });
+}
+
+// direct light at a floor point from directions the sampler picks, what one bounce of shade() does
+template<typename Sampler>
+color direct_light(const point3& p, const Sampler& sampler, const hittable& lights, int samples){
+    color sum(0, 0, 0);
+    for(int s = 0; s < samples; ++s){
+        vec3 v = sampler.random(p);
+        real pdf = sampler.pdf_value(p, v);
+        hit_record rec;
+        ray r(p, v);
+        if(pdf <= 0 || !lights.hit(r, interval(0.001, infinity), rec)) continue;
+
+        real cosine = dot(unit_vector(v), vec3(0, 1, 0));
+        if(cosine > 0){
+            sum += rec.mat->emitted(r, rec, rec.u, rec.v, rec.p) * cosine / pdf;
+        }
+    }
+    return sum;
+}
+
+template<typename Sampler>
+void report_lights(const std::string& name, const Sampler& sampler, const hittable& lights,
+                   const std::vector<point3>& points, int samples, const std::vector<color>& reference, int reference_samples){
+    std::vector<color> estimate(points.size());
+    time_it(name, static_cast<long>(points.size()) * samples, [&]{
+        for(size_t i = 0; i < points.size(); ++i){
+            estimate[i] = direct_light(points[i], sampler, lights, samples);
+        }
+        return estimate[0].x();
+    });
+    // both samplers have to agree on the mean, or one of them is biased
+    double mean = 0;
+    for(const color& c : estimate) mean += luminance(c) / samples;
+    std::clog << "  mean " << mean / points.size() << ", rmse " << rmse(estimate, samples, reference, reference_samples) << "\n";
+}
+
+// small lights of very different power above a floor, picked uniformly by a hittable_list
+// and by power with light_list, below bvh_threshold through its alias table and above through its bvh
+void bench_lights(int point_count = 256, int samples = 64, int reference_samples = 4096){
+    for(int light_count : {8, 4096}){
+        hittable_list lights;
+        for(int i = 0; i < light_count; ++i){
+            real radiance = std::exp(random_double(0, std::log(1000.0)));
+            point3 corner(random_double(0, 1000), random_double(20, 200), random_double(0, 1000));
+            lights.add(make_shared<quad>(corner, vec3(4, 0, 0), vec3(0, 0, 4), make_shared<diffuse_light>(color(radiance, radiance, radiance))));
+        }
+        bvh_node tree(lights);
+        light_list picked(lights);
+
+        std::string lights_name = std::to_string(light_count) + " lights, ";
+
+        std::vector<point3> points;
+        for(int i = 0; i < point_count; ++i){
+            points.push_back(point3(random_double(0, 1000), 0, random_double(0, 1000)));
+        }
+        std::vector<color> reference(points.size());
+        for(size_t i = 0; i < points.size(); ++i){
+            reference[i] = direct_light(points[i], picked, tree, reference_samples);
+        }
+
+        report_lights(lights_name + "uniform hittable_list", lights, tree, points, samples, reference, reference_samples);
+        report_lights(lights_name + "light_list", picked, tree, points, samples, reference, reference_samples);
+    }
+}
+
+// the book's 50/50 mixture against next event estimation with mis, at the same samples and at the same time
+void bench_next_event(int image_width = 100, int spp = 64, int reference_spp = 2048){
+    scene sc = cornell_box("bench.ppm");
+    camera& cam = sc.cam;
+    cam.image_width = image_width;
+    cam.samples_per_pixel = reference_spp;
+    std::vector<color> reference = cam.render_framebuffer(sc.world, sc.lights);
+
+    cam.next_event = true;
+    double next_event_time = report_convergence("cornell_box, next event + mis", sc, spp, reference, reference_spp);
+    cam.next_event = false;
+    double mixture_time = report_convergence("cornell_box, 50/50 mixture", sc, spp, reference, reference_spp);
+
+    int equal_spp = std::max(1, static_cast<int>(std::lround(spp * next_event_time / mixture_time)));
+    report_convergence("cornell_box, 50/50 mixture at " + std::to_string(equal_spp) + " spp", sc, equal_spp, reference, reference_spp);
+}
+
+// rmse of each sampler as the samples grow, against a long render with another seed so the reference
+// doesn't share the samples it is compared to; 1 / sqrt(spp) convergence for random turns the gap
+// into how many samples random needs for the rmse sobol gets
+void bench_samplers(int image_width = 100, int max_spp = 256, int reference_spp = 4096){
+    struct named_sampler {
+        std::string name;
+        sampler_kind kind;
+    };
+    std::vector<named_sampler> samplers = {
+        {"random", sampler_kind::random},
+        {"cmj", sampler_kind::cmj},
+        {"sobol", sampler_kind::sobol},
+    };
+
+    for(int bounces : {2, 10}){
+        scene sc = cornell_box("bench.ppm");
+        camera& cam = sc.cam;
+        cam.image_width = image_width;
+        cam.max_depth = bounces;
+        cam.russian_roulette = false;
+        cam.seed = 1;
+        cam.samples_per_pixel = reference_spp;
+        std::vector<color> reference = cam.render_framebuffer(sc.world, sc.lights);
+        cam.seed = 0;
+
+        std::string name = "cornell_box, max_depth " + std::to_string(bounces);
+        for(int spp = 4; spp <= max_spp; spp *= 4){
+            double random_error = 0;
+            for(const named_sampler& s : samplers){
+                cam.sampler = s.kind;
+                cam.samples_per_pixel = spp;
+                auto start = std::chrono::steady_clock::now();
+                std::vector<color> image = cam.render_framebuffer(sc.world, sc.lights);
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+                double error = rmse(image, spp, reference, reference_spp);
+                std::clog << name << ", " << s.name << " at " << spp << " spp: " << elapsed.count() << "s, rmse " << error;
+                if(s.kind == sampler_kind::random){
+                    random_error = error;
+                }else{
+                    std::clog << ", random needs about " << std::lround(spp * random_error * random_error / (error * error)) << " spp";
+                }
+                std::clog << "\n";
+            }
+        }
+    }
+}
+
+// like rmse, but of what a display shows, gamma corrected and clamped
+double display_rmse(const std::vector<color>& image, int spp, const std::vector<color>& reference, int reference_spp){
+    static const interval unit(0, 1);
+    double sum = 0;
+    for(size_t p = 0; p < image.size(); ++p){
+        for(int c = 0; c < 3; ++c){
+            double a = image[p][c] / spp;
+            double b = reference[p][c] / reference_spp;
+            a = a == a ? unit.clamp(linear_to_gamma(a)) : 0;
+            b = b == b ? unit.clamp(linear_to_gamma(b)) : 0;
+            sum += (a - b) * (a - b);
+        }
+    }
+    return sqrt(sum / (3 * image.size()));
+}
+
+// renders with and without denoising against a long render with another seed, the denoised time includes
+// the filter; the caustic under the glass sphere is noise to the filter and most of what it gets wrong
+void bench_denoiser(int image_width = 100, int max_spp = 1024, int reference_spp = 4096){
+    scene sc = cornell_box("bench.ppm");
+    camera& cam = sc.cam;
+    cam.image_width = image_width;
+    cam.seed = 1;
+    cam.samples_per_pixel = reference_spp;
+    std::vector<color> reference = cam.render_framebuffer(sc.world, sc.lights);
+    cam.seed = 0;
+    cam.denoise = true;
+
+    for(int spp = 16; spp <= max_spp; spp *= 4){
+        cam.samples_per_pixel = spp;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<color> image = cam.render_framebuffer(sc.world, sc.lights);
+        std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        std::vector<color> denoised = cam.filter.run(cam.aovs());
+        std::chrono::duration<double> filter_time = std::chrono::steady_clock::now() - start;
+        for(color& c : denoised) c *= spp;
+
+        std::clog << "cornell_box, " << spp << " spp: " << render_time.count() << "s, rmse "
+                  << rmse(image, spp, reference, reference_spp) << ", display rmse "
+                  << display_rmse(image, spp, reference, reference_spp) << "\n"
+                  << "  denoised: " << (render_time + filter_time).count() << "s (filter " << filter_time.count()
+                  << "s), rmse " << rmse(denoised, spp, reference, reference_spp) << ", display rmse "
+                  << display_rmse(denoised, spp, reference, reference_spp) << "\n";
+    }
+}
+
+// an earth textured ground plane seen at a grazing angle, far away many texels fall in one pixel;
+// point sampled and mip filtered textures against a long point sampled render with another seed,
+// filtering gets most of the way at few samples and keeps a little blur the reference doesn't have
+void bench_textures(int image_width = 100, int max_spp = 64, int reference_spp = 1024){
+    auto ground = make_shared<quad>(point3(-20, 0, 10), vec3(40, 0, 0), vec3(0, 0, -80),
+                                    make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg")));
+    hittable_list world(ground);
+
+    camera cam;
+    cam.aspect_ratio = 1;
+    cam.image_width = image_width;
+    cam.max_depth = 2;
+    cam.background = color(0.7, 0.8, 1);
+    cam.vfov = 40;
+    cam.lookfrom = point3(0, 1, 8);
+    cam.lookat = point3(0, 0, -4);
+    cam.texture_filtering = false;
+    cam.seed = 1;
+    cam.samples_per_pixel = reference_spp;
+    std::vector<color> reference = cam.render_framebuffer(world, world);
+    cam.seed = 0;
+
+    for(sampler_kind kind : {sampler_kind::random, sampler_kind::sobol}){
+        cam.sampler = kind;
+        std::string name = kind == sampler_kind::random ? "random" : "sobol";
+        for(int spp = 1; spp <= max_spp; spp *= 4){
+            cam.samples_per_pixel = spp;
+            for(bool filtering : {false, true}){
+                cam.texture_filtering = filtering;
+                auto start = std::chrono::steady_clock::now();
+                std::vector<color> image = cam.render_framebuffer(world, world);
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                std::clog << "textured plane, " << name << " at " << spp << " spp, " << (filtering ? "filtered" : "point")
+                          << ": " << elapsed.count() << "s, rmse " << rmse(image, spp, reference, reference_spp) << "\n";
+            }
+        }
+    }
+}
+
+// noise evaluations per second over the marble sphere of two_perlin_spheres (scale 4, radius 2),
+// then baked volumes of growing resolution: build time, memory, lookups per second and
+// how far the texture they give is from the evaluated one on the sphere
+void bench_noise(long count = 2000000){
+    perlin noise;
+    // row after row of latitude and longitude, neighbours like the hits of a render
+    std::vector<point3> points(count);
+    long columns = static_cast<long>(sqrt(static_cast<double>(count)));
+    for(long i = 0; i < count; ++i){
+        real theta = pi * (i / columns + 0.5) / ((count + columns - 1) / columns);
+        real phi = 2 * pi * (i % columns + 0.5) / columns;
+        vec3 d(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+        points[i] = 4 * (point3(0, 2, 0) + 2 * d);
+    }
+
+    time_it("noise", count, [&]{
+        double sum = 0;
+        for(const point3& p : points) sum += noise.noise(p);
+        return sum;
+    });
+    time_it("turb, one octave after the other", count, [&]{
+        double sum = 0;
+        for(const point3& p : points) sum += noise.turb_scalar(p);
+        return sum;
+    });
+    time_it("turb, " + std::to_string(vreal_width) + " octaves at once", count, [&]{
+        double sum = 0;
+        for(const point3& p : points) sum += noise.turb(p);
+        return sum;
+    });
+
+    noise_texture evaluated(4, noise);
+    aabb bounds(point3(-2, 0, -2), point3(2, 4, 2));
+    for(int resolution = 32; resolution <= 256; resolution *= 2){
+        noise_texture baked(4, noise);
+        auto start = std::chrono::steady_clock::now();
+        baked.bake(bounds, resolution);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        double error = 0;
+        for(long i = 0; i < count; i += 16){
+            point3 p = points[i] / 4;
+            error += (baked.value(0, 0, p) - evaluated.value(0, 0, p)).length_squared() / 3;
+        }
+        std::clog << "baked at " << resolution << ": " << elapsed.count() << "s, "
+                  << baked.memory() / (1 << 20) << " MiB, texture rmse " << sqrt(error / ((count + 15) / 16)) << "\n";
+        time_it("  baked lookups", count, [&]{
+            double sum = 0;
+            for(const point3& p : points) sum += baked.value(0, 0, p / 4).x();
+            return sum;
+        });
+    }
+}
+
+// final_scene with and without its global fog, the sphere of radius 5000 around everything that every
+// ray asks where it enters and leaves; closest hits of rays from the camera, then a small render
+void bench_fog(int ray_count = 1000000, int image_width = 64, int spp = 16){
+    seed_random(2, 0);
+    std::vector<ray> rays = bench_rays(final_scene_objects(false).bounding_box(), ray_count);
+
+    for(bool fog : {false, true}){
+        seed_random(2, 0);
+        hittable_list world = final_scene_objects(fog);
+        std::string name = fog ? "final_scene, fog on" : "final_scene, fog off";
+        time_it(name + ", closest hits", ray_count, [&]{ return trace_all(world, rays); });
+
+        scene sc = final_scene(image_width, spp, 40);
+        sc.world = sc.lights = world;
+        auto start = std::chrono::steady_clock::now();
+        sc.cam.render_framebuffer(sc.world, sc.lights);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::clog << name << ", " << image_width << "px " << spp << " spp render: " << elapsed.count() << "s\n";
+    }
+}
+
+#endif
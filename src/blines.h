@@ -1,7 +1,9 @@
 #ifndef BLINES_H
 #define BLINES_H
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
@@ -10,6 +12,14 @@ using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
 
+// scalar of the geometry and shading math; the float build halves vectors, rays and hit records
+// but needs the looser epsilons picked in camera.h and aabb.h
+#ifdef BLINES_USE_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
 
@@ -17,21 +27,59 @@ inline double degrees_to_radians(double degrees){
     return degrees * pi / 180.0;
 }
 
-// [0, 1)
-inline double random_double(){
-    return rand() / (RAND_MAX + 1.0);
+// pcg32 (O'Neill), 64 bits of state and a stream selector
+class rng {
+public:
+    constexpr rng() : state(0x853c49e6748fea9bULL), inc(0xda3e39cb94b95bdbULL) {}
+    rng(uint64_t seed, uint64_t stream) {
+        reseed(seed, stream);
+    }
+
+    void reseed(uint64_t seed, uint64_t stream){
+        state = 0;
+        inc = (stream << 1) | 1;
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next(){
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+    // [0, 1)
+    double next_double(){
+        return next() * 0x1p-32;
+    }
+
+private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+// each thread draws from its own generator, no shared state
+inline thread_local rng thread_generator;
+
+inline uint64_t splitmix64(uint64_t x){
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
 }
 
-/*
-#include <random>
+// same seed and stream give the same numbers no matter which thread asks
+inline void seed_random(uint64_t seed, uint64_t stream){
+    thread_generator.reseed(splitmix64(seed ^ splitmix64(stream)), stream);
+}
 
-// slower
-inline double random_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+// [0, 1)
+inline double random_double(){
+    return thread_generator.next_double();
 }
-*/
 
 // [min, max)
 inline double random_double(double min, double max){
@@ -42,6 +90,8 @@ inline int random_int(int min, int max){
     return static_cast<int>(random_double(min, max + 1));
 }
 
+#include "sampler.h"
+
 #include "ray.h"
 #include "vec3.h"
 #include "interval.h"
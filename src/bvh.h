@@ -2,16 +2,27 @@
 #define BVH_H
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include "blines.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "simd.h"
 
-class bvh_node : public hittable {
+// the original pointer tree, one allocation per node and a virtual call per step
+// kept as a baseline for bench_bvh
+class pointer_bvh_node : public hittable {
 public:
-    bvh_node(const hittable_list& list) : bvh_node(list.objects, 0, list.objects.size()) {}
+    pointer_bvh_node(const hittable_list& list) : pointer_bvh_node(list.objects, 0, list.objects.size()) {}
 
-    bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end) {
+    pointer_bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end) {
         auto objects = src_objects;
         int axis = random_int(0, 2);
 
@@ -35,8 +46,8 @@ public:
             std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
             double mid = start + object_span / 2; // no overflow :)
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
+            left = make_shared<pointer_bvh_node>(objects, start, mid);
+            right = make_shared<pointer_bvh_node>(objects, mid, end);
         }
 
         bbox = aabb(left->bounding_box(), right->bounding_box());
@@ -79,4 +90,677 @@ private:
     }
 };
 
+// 32 bytes, two nodes per cache line
+// bounds are floats rounded outwards so they never shrink the double box
+struct linear_bvh_node {
+    float min[3];
+    float max[3];
+    uint32_t offset; // leaf: first primitive, interior: second child (first child is the next node)
+    uint16_t count;  // primitives in the leaf, 0 for interior nodes
+    uint8_t axis;
+    uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should stay 32 bytes");
+
+// up to simd_width children whose boxes are tested together
+struct wide_bvh_node {
+    wide_box<simd_width> box;
+    uint32_t child[simd_width]; // interior: wide node index, leaf: first primitive
+    uint16_t count[simd_width]; // primitives in a leaf, 0 for interior and empty slots
+};
+
+enum class bvh_split {
+    random_median, // random axis, median by box minimum (the original builder)
+    sah,           // binned surface area heuristic
+    lbvh           // split on morton code bits, fastest to build
+};
+
+struct bvh_stats {
+    double sah_cost = 0; // expected cost of a random ray through the root, traversal = intersection = 1
+    int depth = 0;
+    int interior_nodes = 0;
+    int leaves = 0;
+    int max_leaf_size = 0;
+    double mean_leaf_size = 0;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const bvh_stats& st){
+    return out << "sah cost " << st.sah_cost << ", depth " << st.depth
+               << ", " << st.interior_nodes << " interior, " << st.leaves << " leaves"
+               << " (mean " << st.mean_leaf_size << ", max " << st.max_leaf_size << " prims)";
+}
+
+// built as a binary tree in one array in depth first order, then collapsed into
+// simd_width-ary nodes that are traversed with an explicit stack
+class bvh_node : public hittable {
+public:
+    // parallel builds big subtrees as async tasks
+    // leaf_size caps the primitives per sah leaf, 1 suits primitives that are groups themselves
+    bvh_node(const hittable_list& list, bvh_split split = bvh_split::sah, bool parallel = true, int leaf_size = max_leaf_size)
+        : bvh_node(list.objects, split, parallel, leaf_size) {}
+
+    bvh_node(const std::vector<shared_ptr<hittable>>& objects, bvh_split split = bvh_split::sah, bool parallel = true,
+             int leaf_size = max_leaf_size)
+        : split(split), leaf_size(leaf_size)
+    {
+        if(objects.empty()) return;
+
+        // the build works on this array in place, objects is only read again to reorder the primitives
+        std::vector<build_prim> prims(objects.size());
+        for(size_t i = 0; i < objects.size(); ++i){
+            aabb box = objects[i]->bounding_box();
+            prims[i] = {box, centroid(box), i, 0};
+        }
+
+        if(parallel){
+            // a few more tasks than threads so uneven subtrees still balance out
+            int threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+            while((1 << parallel_depth) < 4 * threads) ++parallel_depth;
+        }
+
+        if(split == bvh_split::lbvh){
+            sort_by_morton(prims);
+        }
+
+        std::unique_ptr<build_node> root = build(prims, 0, prims.size(), 0, morton_bits - 1);
+
+        primitives.reserve(prims.size());
+        for(const build_prim& prim : prims){
+            primitives.push_back(objects[prim.index]);
+        }
+
+        nodes.reserve(built_nodes);
+        flatten(root.get());
+        bbox = root->box;
+
+        build_stats = collect_stats();
+        collapse(0);
+        std::vector<linear_bvh_node>().swap(nodes);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if(wide_nodes.empty()){
+            return false;
+        }
+
+        return traverse(wide_nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count){
+            bool hit_anything = false;
+            for(uint32_t p = first; p < first + count; ++p){
+                if(primitives[p]->hit(r, ray_t, rec)){
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+            return hit_anything;
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if(wide_nodes.empty()){
+            return false;
+        }
+
+        return traverse(wide_nodes.data(), r, ray_t, [&](uint32_t first, uint32_t count){
+            for(uint32_t p = first; p < first + count; ++p){
+                if(primitives[p]->occluded(r, ray_t)) return true;
+            }
+            return false;
+        }, true);
+    }
+
+    // closest first walk over any array of wide nodes with the root at 0, used by hit() and by
+    // the mapped scenes of scene_cache.h; leaf(first, count) tests the primitives of a leaf and
+    // shrinks ray_t.max on a hit, returning whether it hit anything
+    // with any_hit the walk ends at the first leaf that hits, for shadow rays
+    template<typename Leaf>
+    static bool traverse(const wide_bvh_node* nodes, const ray& r, interval& ray_t, Leaf&& leaf, bool any_hit = false){
+        const ray_slab rs(r.origin(), r.direction());
+        const float tmin = static_cast<float>(ray_t.min);
+
+        struct entry {
+            uint32_t node;
+            float t;
+        };
+
+        entry stack[max_depth * simd_width];
+        int top = 0;
+        stack[top++] = {0, -std::numeric_limits<float>::infinity()};
+        bool hit_anything = false;
+
+        while(top > 0){
+            entry e = stack[--top];
+            if(e.t > ray_t.max) continue;
+
+            const wide_bvh_node& node = nodes[e.node];
+            float tnear[simd_width];
+            int mask = wide_box_hit(node.box, rs, tmin, round_up(ray_t.max), tnear);
+
+            entry interior[simd_width];
+            int n = 0;
+            for(int k = 0; k < simd_width; ++k){
+                if(!(mask & (1 << k))) continue;
+                if(node.count[k] == 0 && node.child[k] == 0) continue; // empty slot, nan rays get this far
+
+                if(node.count[k] == 0){
+                    interior[n++] = {node.child[k], tnear[k]};
+                    continue;
+                }
+
+                if(leaf(node.child[k], static_cast<uint32_t>(node.count[k]))){
+                    if(any_hit) return true;
+                    hit_anything = true;
+                }
+            }
+
+            // farthest pushed first so the nearest child is popped next
+            for(int i = 1; i < n; ++i){
+                for(int j = i; j > 0 && interior[j - 1].t < interior[j].t; --j){
+                    std::swap(interior[j - 1], interior[j]);
+                }
+            }
+            for(int i = 0; i < n; ++i){
+                stack[top++] = interior[i];
+            }
+        }
+
+        return hit_anything;
+    }
+
+    // the packet walks the tree together, a child is entered when any of its active lanes hits its box
+    uint32_t hit_packet(ray_lanes& rays, uint32_t active) const override {
+        if(wide_nodes.empty()){
+            return 0;
+        }
+
+        const int n = rays.n;
+        float orig[3][32], inv_dir[3][32], err[3][32];
+        for(int k = 0; k < n; ++k){
+            ray_slab rs(point3(rays.orig[0][k], rays.orig[1][k], rays.orig[2][k]),
+                        vec3(rays.dir[0][k], rays.dir[1][k], rays.dir[2][k]));
+            for(int a = 0; a < 3; ++a){
+                orig[a][k] = rs.orig[a];
+                inv_dir[a][k] = rs.inv_dir[a];
+                err[a][k] = rs.err[a];
+            }
+        }
+        const float tmin = static_cast<float>(rays.tmin);
+
+        struct entry {
+            uint32_t node;
+            uint32_t lanes;
+            float t;
+        };
+
+        entry stack[max_depth * simd_width];
+        int top = 0;
+        stack[top++] = {0, active, 0};
+        uint32_t hits = 0;
+
+        while(top > 0){
+            entry e = stack[--top];
+            const wide_bvh_node& node = wide_nodes[e.node];
+
+            float tmax[32];
+            for(int k = 0; k < n; ++k){
+                tmax[k] = static_cast<float>(rays.tmax[k]) * 1.000001f;
+            }
+
+            entry interior[simd_width];
+            int count = 0;
+            for(int c = 0; c < simd_width; ++c){
+                if(node.count[c] == 0 && node.child[c] == 0) continue; // empty slot
+
+                // the same box for every lane, so this loop runs across the lanes in simd registers
+                // (no per lane plane selection, empty slots are skipped above instead)
+                float tnear[32];
+                uint8_t inside[32];
+                for(int k = 0; k < n; ++k){
+                    float tn = tmin, tf = tmax[k];
+                    for(int a = 0; a < 3; ++a){
+                        float ta = (node.box.bounds[0][a][c] - orig[a][k]) * inv_dir[a][k];
+                        float tb = (node.box.bounds[1][a][c] - orig[a][k]) * inv_dir[a][k];
+                        float t0 = (ta < tb ? ta : tb) - err[a][k];
+                        float t1 = ((ta < tb ? tb : ta) + err[a][k]) * 1.000001f;
+                        tn = t0 > tn ? t0 : tn;
+                        tf = t1 < tf ? t1 : tf;
+                    }
+                    tnear[k] = tn;
+                    inside[k] = tn <= tf;
+                }
+
+                uint32_t lanes = 0;
+                float closest = std::numeric_limits<float>::infinity();
+                for(int k = 0; k < n; ++k){
+                    if(inside[k] && (e.lanes & (1u << k))){
+                        lanes |= 1u << k;
+                        closest = std::min(closest, tnear[k]);
+                    }
+                }
+                if(lanes == 0) continue;
+
+                if(node.count[c] == 0){
+                    interior[count++] = {node.child[c], lanes, closest};
+                    continue;
+                }
+
+                if(lanes & (lanes - 1)){
+                    for(uint32_t p = node.child[c]; p < node.child[c] + node.count[c]; ++p){
+                        hits |= primitives[p]->hit_packet(rays, lanes);
+                    }
+                    continue;
+                }
+
+                // a single lane left, the scalar test is cheaper than a whole packet
+                int k = 0;
+                while(!(lanes & (1u << k))) ++k;
+                ray r = rays.get(k);
+                for(uint32_t p = node.child[c]; p < node.child[c] + node.count[c]; ++p){
+                    if(primitives[p]->hit(r, interval(rays.tmin, rays.tmax[k]), rays.recs[k])){
+                        rays.tmax[k] = rays.recs[k].t;
+                        hits |= lanes;
+                    }
+                }
+            }
+
+            for(int i = 1; i < count; ++i){
+                for(int j = i; j > 0 && interior[j - 1].t < interior[j].t; --j){
+                    std::swap(interior[j - 1], interior[j]);
+                }
+            }
+            for(int i = 0; i < count; ++i){
+                stack[top++] = interior[i];
+            }
+        }
+
+        return hits;
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    size_t node_count() const {
+        return wide_nodes.size();
+    }
+
+    // heap bytes of the nodes and the primitive pointers, not the primitives themselves
+    size_t memory_bytes() const {
+        return wide_nodes.capacity() * sizeof(wide_bvh_node) + primitives.capacity() * sizeof(shared_ptr<hittable>);
+    }
+
+    // of the binary tree, before it is collapsed
+    bvh_stats stats() const {
+        return build_stats;
+    }
+
+    // the tree as traversed, leaves index into primitive_array()
+    const std::vector<wide_bvh_node>& wide_node_array() const {
+        return wide_nodes;
+    }
+
+    const std::vector<shared_ptr<hittable>>& primitive_array() const {
+        return primitives;
+    }
+
+private:
+    static const int max_depth = 64;
+    static const int sah_bins = 16;
+    static const int max_leaf_size = 4;
+    static const int morton_bits = 30;
+    static const size_t parallel_grain = 4096; // smaller subtrees are not worth a task
+    // below this many primitives a split has to beat the cost of just intersecting them all
+    static constexpr double traversal_cost = 1.0;
+
+    bvh_split split;
+    size_t leaf_size;
+    int parallel_depth = 0;
+    std::atomic<int> built_nodes{0};
+
+    // binary nodes only live during the build, traversal uses the collapsed wide nodes
+    std::vector<linear_bvh_node> nodes;
+    std::vector<wide_bvh_node> wide_nodes;
+    std::vector<shared_ptr<hittable>> primitives;
+    aabb bbox;
+    bvh_stats build_stats;
+
+    struct build_prim {
+        aabb box;
+        point3 center;
+        size_t index;
+        uint32_t morton;
+    };
+
+    struct build_node {
+        aabb box;
+        std::unique_ptr<build_node> children[2];
+        int axis = 0;
+        size_t first = 0, count = 0;
+    };
+
+    static point3 centroid(const aabb& box){
+        return point3(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+    }
+
+    // bit is the highest morton bit that can still differ inside [start, end), lbvh only
+    std::unique_ptr<build_node> build(std::vector<build_prim>& prims, size_t start, size_t end, int depth, int bit){
+        auto node = std::make_unique<build_node>();
+        ++built_nodes;
+
+        for(size_t i = start; i < end; ++i){
+            node->box = aabb(node->box, prims[i].box);
+        }
+
+        size_t mid = end;
+        if(end - start == 1){
+            mid = end;
+        }else if(split == bvh_split::sah && depth < max_depth / 2){
+            mid = partition_sah(prims, start, end, node->box, node->axis);
+        }else if(split == bvh_split::lbvh){
+            mid = partition_morton(prims, start, end, bit, node->axis);
+        }else{
+            mid = partition_median(prims, start, end, node->axis);
+        }
+
+        if(mid == start || mid == end){
+            node->first = start;
+            node->count = end - start;
+            return node;
+        }
+
+        if(depth < parallel_depth && end - start > parallel_grain){
+            auto left = std::async(std::launch::async, &bvh_node::build, this, std::ref(prims), start, mid, depth + 1, bit - 1);
+            node->children[1] = build(prims, mid, end, depth + 1, bit - 1);
+            node->children[0] = left.get();
+        }else{
+            node->children[0] = build(prims, start, mid, depth + 1, bit - 1);
+            node->children[1] = build(prims, mid, end, depth + 1, bit - 1);
+        }
+        return node;
+    }
+
+    // same split as pointer_bvh_node, also the fallback once a sah tree gets too deep
+    static size_t partition_median(std::vector<build_prim>& prims, size_t start, size_t end, int& axis){
+        axis = random_int(0, 2);
+        std::sort(prims.begin() + start, prims.begin() + end, [axis](const build_prim& a, const build_prim& b){
+            return a.box.axis(axis).min < b.box.axis(axis).min;
+        });
+        return start + (end - start) / 2;
+    }
+
+    // returns end when a leaf is cheaper than any split
+    size_t partition_sah(std::vector<build_prim>& prims, size_t start, size_t end, const aabb& box, int& axis){
+        size_t count = end - start;
+
+        aabb centroid_box;
+        for(size_t i = start; i < end; ++i){
+            centroid_box = aabb(centroid_box, aabb(prims[i].center, prims[i].center));
+        }
+
+        double best_cost = infinity;
+        int best_axis = -1;
+        int best_bin = 0;
+
+        for(int a = 0; a < 3; ++a){
+            const interval& extent = centroid_box.axis(a);
+            if(extent.size() <= 0) continue;
+
+            int bin_counts[sah_bins] = {};
+            aabb bin_boxes[sah_bins];
+            for(size_t i = start; i < end; ++i){
+                int b = bin_index(prims[i].center[a], extent);
+                ++bin_counts[b];
+                bin_boxes[b] = aabb(bin_boxes[b], prims[i].box);
+            }
+
+            // sweep from the right to get the area and count of every right side
+            double right_area[sah_bins];
+            int right_count[sah_bins];
+            aabb acc;
+            int n = 0;
+            for(int b = sah_bins - 1; b > 0; --b){
+                acc = aabb(acc, bin_boxes[b]);
+                n += bin_counts[b];
+                right_area[b] = surface_area(acc);
+                right_count[b] = n;
+            }
+
+            acc = aabb();
+            n = 0;
+            for(int b = 1; b < sah_bins; ++b){
+                acc = aabb(acc, bin_boxes[b - 1]);
+                n += bin_counts[b - 1];
+                if(n == 0 || right_count[b] == 0) continue;
+
+                double cost = n * surface_area(acc) + right_count[b] * right_area[b];
+                if(cost < best_cost){
+                    best_cost = cost;
+                    best_axis = a;
+                    best_bin = b;
+                }
+            }
+        }
+
+        if(best_axis < 0){
+            // every centroid in the same spot, nothing to split on
+            return count <= leaf_size ? end : partition_median(prims, start, end, axis);
+        }
+
+        double split_cost = traversal_cost + best_cost / surface_area(box);
+        double leaf_cost = static_cast<double>(count);
+        if(count <= leaf_size && leaf_cost <= split_cost){
+            return end;
+        }
+
+        axis = best_axis;
+        const interval& extent = centroid_box.axis(axis);
+        auto middle = std::partition(prims.begin() + start, prims.begin() + end, [&](const build_prim& p){
+            return bin_index(p.center[axis], extent) < best_bin;
+        });
+        return middle - prims.begin();
+    }
+
+    // codes are sorted, so every bit above `bit` is shared by the whole range
+    // and the first code with `bit` set is where the range splits
+    static size_t partition_morton(std::vector<build_prim>& prims, size_t start, size_t end, int& bit, int& axis){
+        for(; bit >= 0; --bit){
+            uint32_t mask = 1u << bit;
+            if((prims[start].morton & mask) == (prims[end - 1].morton & mask)) continue;
+
+            axis = 2 - bit % 3;
+            auto middle = std::partition_point(prims.begin() + start, prims.begin() + end, [mask](const build_prim& p){
+                return (p.morton & mask) == 0;
+            });
+            return middle - prims.begin();
+        }
+
+        // identical codes
+        return start + (end - start) / 2;
+    }
+
+    // spreads the low 10 bits of x out to every third bit
+    static uint32_t expand_bits(uint32_t x){
+        x = (x | (x << 16)) & 0x030000FF;
+        x = (x | (x << 8)) & 0x0300F00F;
+        x = (x | (x << 4)) & 0x030C30C3;
+        x = (x | (x << 2)) & 0x09249249;
+        return x;
+    }
+
+    static void sort_by_morton(std::vector<build_prim>& prims){
+        aabb centroid_box;
+        for(const build_prim& p : prims){
+            centroid_box = aabb(centroid_box, aabb(p.center, p.center));
+        }
+
+        for(build_prim& p : prims){
+            uint32_t q[3];
+            for(int a = 0; a < 3; ++a){
+                const interval& extent = centroid_box.axis(a);
+                double t = extent.size() > 0 ? (p.center[a] - extent.min) / extent.size() : 0;
+                q[a] = std::min(1023u, static_cast<uint32_t>(t * 1024));
+            }
+            p.morton = (expand_bits(q[0]) << 2) | (expand_bits(q[1]) << 1) | expand_bits(q[2]);
+        }
+
+        // lsd radix sort, 3 passes of 10 bits
+        std::vector<build_prim> scratch(prims.size());
+        for(int pass = 0; pass < 3; ++pass){
+            int shift = pass * 10;
+            size_t counts[1024] = {};
+            for(const build_prim& p : prims){
+                ++counts[(p.morton >> shift) & 1023];
+            }
+
+            size_t sum = 0;
+            for(size_t& c : counts){
+                size_t n = c;
+                c = sum;
+                sum += n;
+            }
+
+            for(const build_prim& p : prims){
+                scratch[counts[(p.morton >> shift) & 1023]++] = p;
+            }
+            prims.swap(scratch);
+        }
+    }
+
+    static int bin_index(double c, const interval& extent){
+        int b = static_cast<int>(sah_bins * (c - extent.min) / extent.size());
+        return b < sah_bins ? b : sah_bins - 1;
+    }
+
+    static double surface_area(const aabb& box){
+        double dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+        if(dx < 0 || dy < 0 || dz < 0) return 0;
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    static double surface_area(const linear_bvh_node& node){
+        double dx = node.max[0] - node.min[0];
+        double dy = node.max[1] - node.min[1];
+        double dz = node.max[2] - node.min[2];
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    // pulls grandchildren up into a node until it has simd_width children,
+    // always opening the interior child with the largest surface area
+    uint32_t collapse(uint32_t index){
+        uint32_t wide_index = static_cast<uint32_t>(wide_nodes.size());
+        wide_nodes.emplace_back();
+
+        uint32_t kids[simd_width];
+        int n = 0;
+        if(nodes[index].count > 0){
+            kids[n++] = index;
+        }else{
+            kids[n++] = index + 1;
+            kids[n++] = nodes[index].offset;
+        }
+
+        while(n < simd_width){
+            int best = -1;
+            double best_area = -1;
+            for(int k = 0; k < n; ++k){
+                if(nodes[kids[k]].count > 0) continue;
+                double area = surface_area(nodes[kids[k]]);
+                if(area > best_area){
+                    best_area = area;
+                    best = k;
+                }
+            }
+            if(best < 0) break;
+
+            uint32_t opened = kids[best];
+            kids[best] = opened + 1;
+            kids[n++] = nodes[opened].offset;
+        }
+
+        wide_bvh_node wide;
+        wide.box.clear();
+        for(int k = 0; k < simd_width; ++k){
+            wide.child[k] = 0;
+            wide.count[k] = 0;
+        }
+
+        for(int k = 0; k < n; ++k){
+            const linear_bvh_node& kid = nodes[kids[k]];
+            for(int a = 0; a < 3; ++a){
+                wide.box.bounds[0][a][k] = kid.min[a];
+                wide.box.bounds[1][a][k] = kid.max[a];
+            }
+            if(kid.count > 0){
+                wide.child[k] = kid.offset;
+                wide.count[k] = kid.count;
+            }else{
+                wide.child[k] = collapse(kids[k]);
+            }
+        }
+
+        wide_nodes[wide_index] = wide;
+        return wide_index;
+    }
+
+    bvh_stats collect_stats() const {
+        bvh_stats st;
+        collect_stats(0, 1, surface_area(nodes[0]), st);
+        st.mean_leaf_size = static_cast<double>(primitives.size()) / st.leaves;
+        return st;
+    }
+
+    void collect_stats(uint32_t index, int depth, double root_area, bvh_stats& st) const {
+        const linear_bvh_node& node = nodes[index];
+        double area_ratio = surface_area(node) / root_area;
+        st.depth = std::max(st.depth, depth);
+
+        if(node.count > 0){
+            st.leaves += 1;
+            st.max_leaf_size = std::max(st.max_leaf_size, static_cast<int>(node.count));
+            st.sah_cost += area_ratio * node.count;
+            return;
+        }
+
+        st.interior_nodes += 1;
+        st.sah_cost += area_ratio * traversal_cost;
+        collect_stats(index + 1, depth + 1, root_area, st);
+        collect_stats(node.offset, depth + 1, root_area, st);
+    }
+
+    uint32_t flatten(const build_node* node){
+        uint32_t index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+
+        linear_bvh_node flat;
+        for(int a = 0; a < 3; ++a){
+            flat.min[a] = round_down(node->box.axis(a).min);
+            flat.max[a] = round_up(node->box.axis(a).max);
+        }
+        flat.axis = static_cast<uint8_t>(node->axis);
+        flat.pad = 0;
+
+        if(node->count > 0){
+            flat.offset = static_cast<uint32_t>(node->first);
+            flat.count = static_cast<uint16_t>(node->count);
+        }else{
+            flat.count = 0;
+            flatten(node->children[0].get());
+            flat.offset = flatten(node->children[1].get());
+        }
+
+        nodes[index] = flat;
+        return index;
+    }
+
+    static float round_down(double x){
+        float f = static_cast<float>(x);
+        return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float round_up(double x){
+        float f = static_cast<float>(x);
+        return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+};
+
 #endif
\ No newline at end of file
@@ -4,13 +4,24 @@
 #include "blines.h"
 
 #include "color.h"
+#include "denoiser.h"
 #include "hittable.h"
+#include "image_writer.h"
+#include "light_list.h"
 #include "material.h"
 #include "pdf.h"
 
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 class camera {
 public:
@@ -28,33 +39,162 @@ public:
     double defocus_angle = 0;
     double focus_dist = 10;
 
+    int thread_count = 0; // 0 uses every hardware thread, 1 renders scanlines on the calling thread
+    int tile_size = 16;
+    // camera rays of a pixel traced together, 4, 8 or 16, 0 traces them one by one
+    // not used with defocus blur, those rays spread too much to share a traversal
+    // only the camera rays, the bounces and shadow rays after them go one path at a time
+    // off by default, bench_packets only shows it winning on simple scenes like the_trio
+    int packet_size = 0;
+    uint64_t seed = 0; // every pixel gets its own stream, so the image only depends on this
+    // where the pixel, lens, time and bounce decisions get their numbers, see sampler.h
+    // sobol and cmj spread the samples of a pixel evenly, random is plain monte carlo
+    sampler_kind sampler = sampler_kind::sobol;
+
+    // image textures seen straight from the camera are averaged over the pixel's footprint (from the ray
+    // differentials to the neighbouring pixels), false samples them at a point like any other hit
+    // the footprint shrinks as 1/sqrt(samples_per_pixel), the samples already average over the pixel
+    // off by default, it only wins at a few samples per pixel, from 16 up its blur costs more than
+    // the aliasing it saves (bench_textures)
+    bool texture_filtering = false;
+
+    // max_depth stays a hard cap on path length
+    bool russian_roulette = true;
+    int roulette_start = 3; // bounces before roulette can end a path
+
+    // next event estimation: every diffuse bounce also sends a shadow ray at a light, and that and
+    // the material's own sample are weighted by the power heuristic (see sample_light), false goes
+    // back to the book's one ray per bounce from a 50/50 mix of the light and material pdfs
+    bool next_event = true;
+    // share of the light choices that goes to lights that don't emit, 0 leaves them out, see light_list.h
+    // for scenes that list a shape like a glass sphere to aim bounces at
+    real unlit_light_share = 0;
+
+    // adaptive sampling takes samples in rounds of adaptive_batch and stops a pixel once
+    // the 95% confidence interval of its displayed brightness is within noise_threshold,
+    // samples_per_pixel becomes the upper limit; render() also writes a sample count heatmap
+    bool adaptive = false;
+    int adaptive_min_samples = 32;
+    int adaptive_batch = 16;
+    double noise_threshold = 0.05;
+
+    // progressive rendering takes pass_samples per pixel per pass and rewrites the image after
+    // every pass as a preview, 0 renders everything in one pass
+    int pass_samples = 0;
+    // empty for none; a checkpoint of the same image is resumed, so raising samples_per_pixel
+    // and rendering again continues an old render
+    std::string checkpoint_file;
+    double checkpoint_seconds = 60; // at least this long between checkpoints, the last pass always writes one
+
+    // write_aovs makes render() also write the first hit albedo, normal and depth and the variance
+    // of every pixel next to the image, as raw values for pfm or hdr (see aovs())
+    // denoise filters the image guided by those before the last write, see denoiser.h
+    bool write_aovs = false;
+    bool denoise = false;
+    denoiser filter;
+
+    // where render() writes the image, the extension picks the format, see make_image_writer
+    std::string filename = "images\\_image.ppm";
+
     camera(std::string _filename) : filename(_filename) {}
     camera() : camera("images\\image.ppm") {}
 
     void render(const hittable& world, const hittable& lights){
-        initialize();
+        render_passes(world, lights, true);
+
+        if(adaptive){
+            write_heatmap(suffixed_filename("_samples"));
+        }
+        if(write_aovs || denoise){
+            aov_buffers aov = aovs();
+            if(write_aovs){
+                write_buffer(suffixed_filename("_albedo"), aov.albedo);
+                write_buffer(suffixed_filename("_normal"), aov.normal);
+                write_buffer(suffixed_filename("_depth"), aov.depth);
+                write_buffer(suffixed_filename("_variance"), aov.variance);
+            }
+            if(denoise){
+                filter.thread_count = thread_count;
+                write_buffer(filename, filter.run(aov), true);
+            }
+        }
+    }
 
-        std::ofstream image_file(filename);
+    // summed radiance of every pixel, row by row, without writing the image
+    // pixel_sample_counts says how many samples went into each sum
+    std::vector<color> render_framebuffer(const hittable& world, const hittable& lights){
+        return render_passes(world, lights, false);
+    }
+
+    const std::vector<int>& pixel_sample_counts() const {
+        return sample_counts;
+    }
+
+    // of the last render, the features only when write_aovs or denoise was on during it
+    aov_buffers aovs() const {
+        aov_buffers aov;
+        aov.width = image_width;
+        aov.height = image_height;
+        aov.beauty.resize(pixels.size());
+        aov.emission.resize(pixels.size());
+        aov.albedo.resize(pixels.size());
+        aov.normal.resize(pixels.size());
+        aov.depth.resize(pixels.size());
+        aov.variance.resize(pixels.size());
+        for(size_t p = 0; p < pixels.size(); ++p){
+            const pixel_estimate& estimate = pixels[p].estimate;
+            const pixel_features& features = pixels[p].features;
+            int n = std::max(estimate.n, 1);
+            color c = estimate.sum / n;
+            for(int k = 0; k < 3; ++k){
+                if(c[k] != c[k]) c[k] = 0;
+            }
+            aov.beauty[p] = c;
+            aov.emission[p] = features.emission / n;
+            aov.albedo[p] = features.albedo / n;
+            aov.normal[p] = features.hits > 0 ? unit_vector(features.normal) : vec3(0, 0, 0);
+            aov.depth[p] = features.hits > 0 ? features.depth / features.hits : infinity;
+            aov.variance[p] = estimate.n > 1 ? estimate.m2 / (estimate.n - 1) / estimate.n : 0;
+        }
+        return aov;
+    }
 
-        image_file << "P3\n" << image_width << " " << image_height << "\n255\n";
+    // camera rays only, returns how many hit something; for benchmarks
+    long trace_primary(const hittable& world){
+        initialize();
+
+        long hits = 0;
         for(int i = 0; i < image_height; ++i){
-            std::clog << "\rScanlines remaining: " << (image_height - i) << " ";
             for(int j = 0; j < image_width; ++j){
-                color pixel_color(0, 0, 0);
-                for(int sample = 0; sample < samples_per_pixel; ++sample){
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world, lights);
+                seed_random(seed, static_cast<uint64_t>(i) * image_width + j);
+                switch(packet_size){
+                    case 4: hits += trace_primary_packets<4>(i, j, world); break;
+                    case 8: hits += trace_primary_packets<8>(i, j, world); break;
+                    case 16: hits += trace_primary_packets<16>(i, j, world); break;
+                    default:
+                        hit_record rec;
+                        for(int sample = 0; sample < samples_per_pixel; ++sample){
+                            hits += world.hit(get_ray(i, j), interval(acne_eps, infinity), rec);
+                        }
                 }
-                write_color(image_file, pixel_color, samples_per_pixel);
             }
         }
-        std::clog << "\rDone                                  \n";
-        image_file.close();
+        return hits;
     }
 
 private:
-    std::string filename = "images\\_image.ppm";
     int image_height;
+    std::vector<int> sample_counts;
+    static constexpr double acne_eps = 0.0000001;
+    // float hit points are only good to a few ulps of their coordinates, so rays leaving
+    // a surface also skip this much of their origin's magnitude (see spawn_tmin)
+    static constexpr real spawn_eps = std::is_same<real, float>::value ? 0.0001 : 0;
+    // shadow rays stop this much of the distance short of the light, which is in the world as well
+    static constexpr real shadow_eps = 0.0001;
+    // sampler dimensions, the camera ray takes the first camera_dimensions and every bounce gets
+    // bounce_dimensions of its own after that, more than scattering, a light sample and roulette draw
+    static constexpr uint32_t camera_dimensions = 3;
+    static constexpr uint32_t bounce_dimensions = 8;
     point3 center;
     point3 pixel00_loc;
     vec3 pixel_delta_right;
@@ -91,61 +231,620 @@ private:
         defocus_disk_v = v * defocus_radius;
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights){
+    // running sum of a pixel plus mean and variance of its luminance (welford)
+    struct pixel_estimate {
+        color sum = color(0, 0, 0);
+        int n = 0;
+        double mean = 0;
+        double m2 = 0;
+
+        void add(const color& sample){
+            sum += sample;
+            ++n;
+            double y = luminance(sample);
+            if(y != y) return; // nan samples are dropped when writing anyway
+            double delta = y - mean;
+            mean += delta / n;
+            m2 += delta * (y - mean);
+        }
+
+        // half width of the 95% confidence interval, measured after gamma so dark pixels
+        // are not held to the same absolute error as bright ones
+        double display_error() const {
+            if(n < 2) return infinity;
+            double error = 1.96 * sqrt(m2 / (n - 1) / n);
+            return error / (2 * sqrt(std::max(mean, 0.0001)));
+        }
+    };
+
+    // sums over the samples of a pixel of what their first hits saw, see aovs()
+    struct pixel_features {
+        color emission = color(0, 0, 0); // seen straight from the camera, the background included
+        color albedo = color(0, 0, 0);
+        vec3 normal = vec3(0, 0, 0);
+        double depth = 0;
+        int hits = 0;
+
+        void add_miss(const color& background){
+            static const interval unit(0, 1);
+            emission += background;
+            albedo += color(unit.clamp(background.x()), unit.clamp(background.y()), unit.clamp(background.z()));
+        }
+
+        void add_hit(const color& hit_emission, const color& hit_albedo, const vec3& hit_normal, double distance){
+            emission += hit_emission;
+            albedo += hit_albedo;
+            normal += hit_normal;
+            depth += distance;
+            ++hits;
+        }
+    };
+
+    // everything a pixel carries from one pass to the next, its generator included,
+    // so splitting a render into passes or resuming it does not change the image
+    struct pixel_state {
+        pixel_estimate estimate;
+        pixel_features features;
+        rng generator;
+    };
+    static_assert(std::is_trivially_copyable<pixel_state>::value, "pixel_state is saved byte for byte");
+
+    std::vector<pixel_state> pixels;
+
+    std::vector<color> render_passes(const hittable& world, const hittable& light_objects, bool previews){
+        initialize();
+        light_list lights(light_objects, unlit_light_share);
+
+        int pass_size = pass_samples > 0 ? pass_samples : samples_per_pixel;
+        int passes = (samples_per_pixel + pass_size - 1) / pass_size;
+        int pass = 0;
+        if(checkpoint_file.empty() || !load_checkpoint(pass_size, pass)){
+            pixels.assign(image_width * image_height, pixel_state());
+            for(size_t p = 0; p < pixels.size(); ++p){
+                seed_random(seed, p);
+                pixels[p].generator = thread_generator;
+            }
+        }
+
+        std::unique_ptr<thread_pool> pool;
+        if(thread_count != 1){
+            pool = std::make_unique<thread_pool>(thread_count);
+        }
+        std::vector<worker_stats> stats(pool ? pool->size() : 0);
+
+        auto start = std::chrono::steady_clock::now();
+        auto last_checkpoint = start;
+        for(; pass < passes; ++pass){
+            if(pool){
+                render_tiled(*pool, stats, pass_size, world, lights);
+            }else{
+                render_serial(pass_size, world, lights);
+            }
+            if(passes > 1){
+                std::clog << "\rPass " << (pass + 1) << " of " << passes << " done          \n";
+            }
+
+            if(previews && pass + 1 < passes){
+                write_image();
+            }
+
+            std::chrono::duration<double> since = std::chrono::steady_clock::now() - last_checkpoint;
+            if(!checkpoint_file.empty() && (pass + 1 == passes || since.count() >= checkpoint_seconds)){
+                save_checkpoint(pass_size, pass + 1);
+                last_checkpoint = std::chrono::steady_clock::now();
+            }
+        }
+        std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+        // also when a resumed checkpoint already had every pass and the loop never ran
+        if(previews){
+            write_image();
+        }
+
+        std::clog << "\rDone in " << wall.count() << "s on " << (pool ? pool->size() : 1) << " threads          \n";
+        for(size_t t = 0; t < stats.size(); ++t){
+            std::clog << "  thread " << t << ": " << stats[t].tiles << " tiles, "
+                      << stats[t].pixels << " pixels, " << stats[t].seconds << "s busy\n";
+        }
+
+        std::vector<color> framebuffer(pixels.size());
+        sample_counts.resize(pixels.size());
+        long total = 0;
+        for(size_t p = 0; p < pixels.size(); ++p){
+            framebuffer[p] = pixels[p].estimate.sum;
+            sample_counts[p] = pixels[p].estimate.n;
+            total += sample_counts[p];
+        }
+        if(adaptive){
+            std::clog << "Adaptive: " << static_cast<double>(total) / pixels.size()
+                      << " samples per pixel on average, limit " << samples_per_pixel << "\n";
+        }
+        return framebuffer;
+    }
+
+    // takes up to budget more samples, fewer once an adaptive pixel has converged
+    void render_pixel(int i, int j, int budget, const hittable& world, const light_list& lights){
+        pixel_state& px = pixels[i * image_width + j];
+        pixel_estimate& estimate = px.estimate;
+        thread_generator = px.generator;
+
+        int limit = std::min(samples_per_pixel, estimate.n + budget);
+        if(!adaptive){
+            render_samples(i, j, limit - estimate.n, world, lights, px);
+        }else{
+            while(estimate.n < limit && (estimate.n < adaptive_min_samples || estimate.display_error() > noise_threshold)){
+                int count = estimate.n < adaptive_min_samples ? adaptive_min_samples - estimate.n : adaptive_batch;
+                render_samples(i, j, std::min(count, limit - estimate.n), world, lights, px);
+            }
+        }
+
+        px.generator = thread_generator;
+        stop_sampling();
+    }
+
+    // sample number index of pixel (i, j), the numbers only depend on those and the seed
+    // so passes and resumed renders pick up where they stopped
+    void start_pixel_sample(int i, int j, int index) const {
+        start_sample(sampler, seed, static_cast<uint64_t>(i) * image_width + j, index, samples_per_pixel);
+    }
+
+    void render_samples(int i, int j, int count, const hittable& world, const light_list& lights, pixel_state& px){
+        pixel_estimate& estimate = px.estimate;
+        pixel_features* features = write_aovs || denoise ? &px.features : nullptr;
+        switch(defocus_angle > 0 ? 0 : packet_size){
+            case 4: render_pixel_packets<4>(i, j, count, world, lights, estimate, features); return;
+            case 8: render_pixel_packets<8>(i, j, count, world, lights, estimate, features); return;
+            case 16: render_pixel_packets<16>(i, j, count, world, lights, estimate, features); return;
+        }
+
+        for(int sample = 0; sample < count; ++sample){
+            start_pixel_sample(i, j, estimate.n);
+            ray_differential r = get_ray(i, j);
+            estimate.add(ray_color(r, max_depth, world, lights, features));
+        }
+    }
+
+    // the camera rays of one pixel go through the scene as packets of N,
+    // every path then continues on its own from its first hit
+    template<int N>
+    void render_pixel_packets(int i, int j, int count, const hittable& world, const light_list& lights,
+                              pixel_estimate& estimate, pixel_features* features){
+        if(max_depth <= 0){
+            for(int sample = 0; sample < count; ++sample){
+                estimate.add(color(0, 0, 0));
+                if(features) features->add_miss(color(0, 0, 0));
+            }
+            return;
+        }
+
+        // every path goes back to its own sample once the packet is traced
+        ray_packet<N> packet;
+        ray_differential camera_rays[N];
+        for(int first = 0; first < count; first += N){
+            int index = estimate.n;
+            packet.clear();
+            for(int sample = first; sample < std::min(first + N, count); ++sample){
+                start_pixel_sample(i, j, index + sample - first);
+                camera_rays[sample - first] = get_ray(i, j);
+                packet.add(camera_rays[sample - first]);
+            }
+
+            ray_lanes lanes = packet.lanes(acne_eps);
+            uint32_t hits = world.hit_packet(lanes, packet.all());
+            for(int k = 0; k < packet.n; ++k){
+                start_pixel_sample(i, j, index + k);
+                if(hits & (1u << k)){
+                    estimate.add(shade(packet.get(k), packet.recs[k], max_depth, world, lights, features,
+                                       texture_filtering ? &camera_rays[k] : nullptr));
+                }else{
+                    estimate.add(background);
+                    if(features) features->add_miss(background);
+                }
+            }
+        }
+    }
+
+    // per pixel averages, nans become black
+    void write_image() const {
+        image img(image_width, image_height);
+        for(size_t p = 0; p < pixels.size(); ++p){
+            color c = pixels[p].estimate.sum / std::max(pixels[p].estimate.n, 1);
+            for(int k = 0; k < 3; ++k){
+                if(c[k] != c[k]) c[k] = 0;
+            }
+            img.pixels[p] = c;
+        }
+        save_image(filename, img);
+    }
+
+    // filename with suffix before the extension
+    std::string suffixed_filename(const std::string& suffix) const {
+        size_t dot = filename.find_last_of('.');
+        if(dot == std::string::npos) return filename + suffix;
+        return filename.substr(0, dot) + suffix + filename.substr(dot);
+    }
+
+    template<typename T>
+    void write_buffer(const std::string& buffer_file, const std::vector<T>& buffer, bool linear = false) const {
+        image img(image_width, image_height, linear);
+        for(size_t p = 0; p < buffer.size(); ++p){
+            img.pixels[p] = pixel_value(buffer[p]);
+        }
+        save_image(buffer_file, img);
+    }
+
+    static color pixel_value(const color& c){
+        return c;
+    }
+
+    // gray, and 0 for the infinite depth of misses
+    static color pixel_value(real x){
+        if(!std::isfinite(x)) x = 0;
+        return color(x, x, x);
+    }
+
+    // black for no samples through red and yellow to white at samples_per_pixel
+    void write_heatmap(const std::string& heatmap_file) const {
+        image img(image_width, image_height, false);
+        static const interval unit(0, 1);
+        for(size_t p = 0; p < sample_counts.size(); ++p){
+            double t = static_cast<double>(sample_counts[p]) / samples_per_pixel;
+            img.pixels[p] = color(unit.clamp(3 * t), unit.clamp(3 * t - 1), unit.clamp(3 * t - 2));
+        }
+        save_image(heatmap_file, img);
+    }
+
+    template<int N>
+    long trace_primary_packets(int i, int j, const hittable& world){
+        long hits = 0;
+        ray_packet<N> packet;
+        for(int first = 0; first < samples_per_pixel; first += N){
+            packet.clear();
+            for(int sample = first; sample < std::min(first + N, samples_per_pixel); ++sample){
+                packet.add(get_ray(i, j));
+            }
+
+            ray_lanes lanes = packet.lanes(acne_eps);
+            uint32_t mask = world.hit_packet(lanes, packet.all());
+            for(int k = 0; k < packet.n; ++k){
+                hits += (mask >> k) & 1;
+            }
+        }
+        return hits;
+    }
+
+    // header of a checkpoint, the pixel states follow byte for byte
+    struct checkpoint_header {
+        char magic[8] = {'b', 'l', 'i', 'n', 'e', 's', 'c', 'k'};
+        int32_t version = 3;
+        int32_t width = 0;
+        int32_t height = 0;
+        int32_t pass_samples = 0;
+        int32_t pixel_size = sizeof(pixel_state);
+        int32_t passes_done = 0;
+        uint64_t seed = 0;
+        int32_t sampler = 0;
+        // the estimator, samples taken with other settings can't be averaged with new ones
+        int32_t max_depth = 0;
+        int32_t adaptive = 0;
+        int32_t next_event = 0;
+    };
+
+    // written to a temporary file first so a kill halfway through keeps the previous checkpoint
+    void save_checkpoint(int pass_size, int passes_done) const {
+        checkpoint_header header;
+        header.width = image_width;
+        header.height = image_height;
+        header.pass_samples = pass_size;
+        header.passes_done = passes_done;
+        header.seed = seed;
+        header.sampler = static_cast<int32_t>(sampler);
+        header.max_depth = max_depth;
+        header.adaptive = adaptive;
+        header.next_event = next_event;
+
+        std::string temp_file = checkpoint_file + ".tmp";
+        std::ofstream out(temp_file, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(pixels.data()), pixels.size() * sizeof(pixel_state));
+        out.close();
+        if(!out){
+            std::cerr << "ERROR: Could not write checkpoint '" << temp_file << "'.\n";
+            return;
+        }
+
+        // rename replaces the old checkpoint in one step, except on windows where it refuses to
+        // overwrite, only there the old one goes first and a crash in between leaves just the .tmp
+        if(std::rename(temp_file.c_str(), checkpoint_file.c_str()) != 0){
+            std::remove(checkpoint_file.c_str());
+            if(std::rename(temp_file.c_str(), checkpoint_file.c_str()) != 0){
+                std::cerr << "ERROR: Could not replace checkpoint '" << checkpoint_file << "'.\n";
+            }
+        }
+    }
+
+    // false when there is no checkpoint or it belongs to a different render
+    bool load_checkpoint(int pass_size, int& passes_done){
+        std::ifstream in(checkpoint_file, std::ios::binary);
+        if(!in){
+            return false;
+        }
+
+        checkpoint_header expected;
+        checkpoint_header header;
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if(!in || std::string(header.magic, 8) != std::string(expected.magic, 8) || header.version != expected.version
+           || header.pixel_size != expected.pixel_size || header.width != image_width || header.height != image_height
+           || header.pass_samples != pass_size || header.seed != seed || header.sampler != static_cast<int32_t>(sampler)
+           || header.max_depth != max_depth || header.adaptive != adaptive || header.next_event != next_event){
+            std::clog << "Checkpoint '" << checkpoint_file << "' is for a different render, starting over\n";
+            return false;
+        }
+
+        pixels.resize(image_width * image_height);
+        in.read(reinterpret_cast<char*>(pixels.data()), pixels.size() * sizeof(pixel_state));
+        if(!in){
+            std::clog << "Checkpoint '" << checkpoint_file << "' is cut short, starting over\n";
+            return false;
+        }
+
+        passes_done = header.passes_done;
+        std::clog << "Resuming from '" << checkpoint_file << "' after " << passes_done << " passes\n";
+        return true;
+    }
+
+    void render_serial(int budget, const hittable& world, const light_list& lights){
+        for(int i = 0; i < image_height; ++i){
+            std::clog << "\rScanlines remaining: " << (image_height - i) << " ";
+            for(int j = 0; j < image_width; ++j){
+                render_pixel(i, j, budget, world, lights);
+            }
+        }
+    }
+
+    struct worker_stats {
+        double seconds = 0;
+        int tiles = 0;
+        long pixels = 0;
+    };
+
+    void render_tiled(thread_pool& pool, std::vector<worker_stats>& stats, int budget, const hittable& world, const light_list& lights){
+        int tiles_x = (image_width + tile_size - 1) / tile_size;
+        int tiles_y = (image_height + tile_size - 1) / tile_size;
+        int tile_total = tiles_x * tiles_y;
+
+        std::atomic<int> tiles_done(0);
+        pool.parallel_for(tile_total, [&](int tile, int worker){
+            auto tile_start = std::chrono::steady_clock::now();
+
+            int i0 = (tile / tiles_x) * tile_size;
+            int j0 = (tile % tiles_x) * tile_size;
+            int i1 = std::min(i0 + tile_size, image_height);
+            int j1 = std::min(j0 + tile_size, image_width);
+
+            for(int i = i0; i < i1; ++i){
+                for(int j = j0; j < j1; ++j){
+                    render_pixel(i, j, budget, world, lights);
+                }
+            }
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - tile_start;
+            stats[worker].seconds += elapsed.count();
+            stats[worker].tiles += 1;
+            stats[worker].pixels += (i1 - i0) * (j1 - j0);
+
+            int finished = ++tiles_done;
+            if(worker == 0){
+                std::clog << "\rTiles remaining: " << (tile_total - finished) << " ";
+            }
+        });
+    }
+
+    color ray_color(const ray_differential& r, int depth, const hittable& world, const light_list& lights, pixel_features* features){
         if(depth <= 0){
+            if(features) features->add_miss(color(0, 0, 0));
             return color(0, 0, 0);
         }
 
-        static double acne_eps = 0.0000001; 
-
         hit_record rec;
         if(!world.hit(r, interval(0.0 + acne_eps, infinity), rec)){
+            if(features) features->add_miss(background);
             return background;
         }
 
-        scatter_record srec; 
-        color color_from_emmision = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+        return shade(r, rec, depth, world, lights, features, texture_filtering ? &r : nullptr);
+    }
+
+    // follows the path on from its first hit, rec is the hit that used up the first of depth segments
+    // iterative, so throughput and radiance are just loop variables
+    // features, when not null, gets what the first hit saw
+    // camera_ray, when not null, is r with its differentials, for the texture footprint of the first hit
+    color shade(ray r, hit_record rec, int depth, const hittable& world, const light_list& lights, pixel_features* features,
+                const ray_differential* camera_ray = nullptr){
+        color radiance(0, 0, 0);
+        color throughput(1, 1, 1);
+        // of the material sample that led here, 0 after the camera and specular bounces,
+        // whose emission next event estimation could not have found
+        real bounce_pdf = 0;
+        point3 bounce_origin;
+
+        for(int segment = 1; ; ++segment){
+            set_sample_dimension(camera_dimensions + bounce_dimensions * (segment - 1));
+            if(segment == 1 && camera_ray){
+                set_uv_derivatives(*camera_ray, rec);
+            }else{
+                rec.clear_uv_derivatives();
+            }
+            scatter_record srec;
+            color emitted = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+            if(bounce_pdf > 0 && emitted.length_squared() > 0){
+                emitted *= power_heuristic(bounce_pdf, lights.pdf_value(bounce_origin, r.direction()));
+            }
+            radiance += throughput * emitted;
+
+            bool scattered_on = rec.mat->scatter(r, rec, srec);
+            if(features && segment == 1){
+                // lights have no attenuation, their color is the closest thing to an albedo
+                static const interval unit(0, 1);
+                color albedo = scattered_on ? srec.attenuation
+                             : color(unit.clamp(emitted.x()), unit.clamp(emitted.y()), unit.clamp(emitted.z()));
+                features->add_hit(emitted, albedo, rec.normal, rec.t * r.direction().length());
+            }
+            if(!scattered_on){
+                break;
+            }
+
+            bounce_pdf = 0;
+            if(srec.skip_pdf){
+                throughput = throughput * srec.attenuation;
+                r = srec.skip_pdf_ray;
+            }else if(next_event){
+                if(segment < depth && !lights.empty()){
+                    radiance += throughput * sample_light(r, rec, srec, world, lights);
+                }
+
+                ray scattered = ray(rec.p, srec.get_pdf().generate(), r.time());
+                bounce_pdf = srec.get_pdf().value(scattered.direction());
+                bounce_origin = rec.p;
+                if(bounce_pdf <= 0){
+                    break;
+                }
+
+                throughput = throughput * srec.attenuation * rec.mat->scattering_pdf(r, rec, scattered) / bounce_pdf;
+                r = scattered;
+            }else{
+                hittable_pdf light_pdf(lights, rec.p);
+                mixture_pdf mixed_pdf(light_pdf, srec.get_pdf());
+                // without emitters there is nothing to aim at
+                const pdf& sampling = lights.empty() ? srec.get_pdf() : static_cast<const pdf&>(mixed_pdf);
+
+                ray scattered = ray(rec.p, sampling.generate(), r.time());
+                double pdf_val = sampling.value(scattered.direction()); // corrects for our sampling 
+
+                double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered); // corrects for material scatter probability
 
-        if(!rec.mat->scatter(r, rec, srec)){
-            return color_from_emmision;
+                throughput = throughput * srec.attenuation * scattering_pdf / pdf_val;
+                r = scattered;
+            }
+
+            if(segment >= depth){
+                break;
+            }
+
+            // dark paths are ended early, the survivors carry their weight so the estimate stays unbiased
+            if(russian_roulette && segment >= roulette_start){
+                double survive = std::min<double>(0.95, std::max(throughput.x(), std::max(throughput.y(), throughput.z())));
+                if(sample_1d() >= survive){
+                    break;
+                }
+                throughput /= survive;
+            }
+
+            if(!world.hit(r, interval(spawn_tmin(r), infinity), rec)){
+                radiance += throughput * background;
+                break;
+            }
         }
 
-        if(srec.skip_pdf){
-            return srec.attenuation * ray_color(srec.skip_pdf_ray, depth - 1, world, lights);
+        return radiance;
+    }
+
+    // light arriving at rec straight from a light picked by lights, through one shadow ray
+    // weighted against the material having sampled the same direction; the emission the material
+    // sample finds gets the other half of the weight in shade(), so every light is counted once
+    // an emitter missing from lights but in front of one that is gets less than its share
+    color sample_light(const ray& r, const hit_record& rec, const scatter_record& srec,
+                       const hittable& world, const light_list& lights) const {
+        ray shadow(rec.p, lights.random(rec.p), r.time());
+        real light_pdf = lights.pdf_value(rec.p, shadow.direction());
+        real scattering_pdf = rec.mat->scattering_pdf(r, rec, shadow);
+        if(light_pdf <= 0 || scattering_pdf <= 0){
+            return color(0, 0, 0);
         }
 
-        auto light_pdf = make_shared<hittable_pdf>(lights, rec.p);
-        mixture_pdf mixed_pdf(light_pdf, srec.pdf_ptr);
+        hit_record light_rec;
+        real tmin = spawn_tmin(shadow);
+        // an unlit light can be picked too, without a material it has nothing to give
+        if(!lights.hit(shadow, interval(tmin, infinity), light_rec) || !light_rec.mat){
+            return color(0, 0, 0);
+        }
+        color emitted = light_rec.mat->emitted(shadow, light_rec, light_rec.u, light_rec.v, light_rec.p);
+        if(emitted.length_squared() <= 0 || world.occluded(shadow, interval(tmin, light_rec.t * (1 - shadow_eps)))){
+            return color(0, 0, 0);
+        }
 
-        ray scattered = ray(rec.p, mixed_pdf.generate(), r.time());
-        double pdf_val = mixed_pdf.value(scattered.direction()); // corrects for our sampling 
+        real weight = power_heuristic(light_pdf, srec.get_pdf().value(shadow.direction()));
+        return emitted * srec.attenuation * scattering_pdf * weight / light_pdf;
+    }
 
-        double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered); // corrects for material scatter probability
+    // the neighbouring rays of r meet the tangent plane at rec.p, and where they land in u and v
+    // is the footprint of the pixel
+    static void set_uv_derivatives(const ray_differential& r, hit_record& rec){
+        rec.clear_uv_derivatives();
+        const vec3& n = rec.normal;
+        real a = dot(rec.dpdu, rec.dpdu), b = dot(rec.dpdu, rec.dpdv), c = dot(rec.dpdv, rec.dpdv);
+        real det = a * c - b * b;
+        if(!r.has_differentials || !(det > 0)) return;
+
+        real plane = dot(n, rec.p);
+        real nx = dot(n, r.rx_direction), ny = dot(n, r.ry_direction);
+        if(nx == 0 || ny == 0) return;
+
+        vec3 dpdx = r.rx_origin + ((plane - dot(n, r.rx_origin)) / nx) * r.rx_direction - rec.p;
+        vec3 dpdy = r.ry_origin + ((plane - dot(n, r.ry_origin)) / ny) * r.ry_direction - rec.p;
+        // least squares dp = du dpdu + dv dpdv
+        real ux = dot(rec.dpdu, dpdx), vx = dot(rec.dpdv, dpdx);
+        real uy = dot(rec.dpdu, dpdy), vy = dot(rec.dpdv, dpdy);
+        rec.dudx = (c * ux - b * vx) / det;
+        rec.dvdx = (a * vx - b * ux) / det;
+        rec.dudy = (c * uy - b * vy) / det;
+        rec.dvdy = (a * vy - b * uy) / det;
+    }
 
-        color sample_color = ray_color(scattered, depth - 1, world, lights);
-        color color_from_scatter = (srec.attenuation * scattering_pdf * sample_color) / pdf_val;
+    // of the strategy that took the sample with pdf a, against one that could have with pdf b
+    static real power_heuristic(real a, real b){
+        return a * a / (a * a + b * b);
+    }
 
-        return color_from_emmision + color_from_scatter;
+    // where a ray leaving a surface starts looking for its next hit
+    real spawn_tmin(const ray& r) const {
+        if constexpr(spawn_eps == 0){
+            return acne_eps;
+        }else{
+            const point3& o = r.origin();
+            real magnitude = std::max(std::fabs(o.x()), std::max(std::fabs(o.y()), std::fabs(o.z())));
+            return acne_eps + spawn_eps * magnitude / r.direction().length();
+        }
     }
 
-    ray get_ray(int i, int j) const {
+    // sampler dimension 0 is the spot in the pixel, 1 the time and 2 the spot on the lens
+    // the differentials leave from the same spot on the lens, through the same spot of the next pixels,
+    // brought closer by 1/sqrt(samples_per_pixel) since the samples already average over the pixel
+    ray_differential get_ray(int i, int j) const {
         point3 pixel_center = pixel00_loc + (i * pixel_delta_down) + (j * pixel_delta_right);
         point3 pixel_sample = pixel_center + point_sample_square();
+        double ray_time = sample_1d();
 
         point3 ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
         point3 ray_direction = pixel_sample - ray_origin;
-        double ray_time = random_double();
-        return ray(ray_origin, ray_direction, ray_time);
+        ray_differential r(ray(ray_origin, ray_direction, ray_time));
+        r.has_differentials = true;
+        r.rx_origin = r.ry_origin = ray_origin;
+        r.rx_direction = ray_direction + pixel_delta_right;
+        r.ry_direction = ray_direction + pixel_delta_down;
+        r.scale_differentials(1 / sqrt(static_cast<real>(samples_per_pixel)));
+        return r;
     }
 
     vec3 defocus_disk_sample() const {
-        point3 p = random_in_unit_disk();
+        point3 p = sample_unit_disk();
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
     vec3 point_sample_square() const {
-        double px = -0.5 + random_double();
-        double py = -0.5 + random_double();
+        sample2 s = sample_2d();
+        double px = -0.5 + s.x;
+        double py = -0.5 + s.y;
         return (px * pixel_delta_right) + (py * pixel_delta_down);
     }
 };
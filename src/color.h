@@ -11,6 +11,17 @@ inline double linear_to_gamma(double linear_component){
     return sqrt(linear_component);
 }
 
+inline double luminance(const color& c){
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// 0 to 255 value of an already gamma corrected component
+inline unsigned char to_byte(double display_component){
+    if(display_component != display_component) return 0;
+    static const interval intensity(0.000, 0.999);
+    return static_cast<unsigned char>(256 * intensity.clamp(display_component));
+}
+
 void write_color(std::ostream& out, color pixel_color, int samples_per_pixel){
     double r = pixel_color.x();
     double g = pixel_color.y();
@@ -29,10 +40,9 @@ void write_color(std::ostream& out, color pixel_color, int samples_per_pixel){
     g = linear_to_gamma(g);
     b = linear_to_gamma(b);
 
-    static const interval intensity(0.000, 0.999);
-    out << static_cast<int>(256 * intensity.clamp(r)) << ' '
-        << static_cast<int>(256 * intensity.clamp(g)) << ' '
-        << static_cast<int>(256 * intensity.clamp(b)) << '\n';
+    out << static_cast<int>(to_byte(r)) << ' '
+        << static_cast<int>(to_byte(g)) << ' '
+        << static_cast<int>(to_byte(b)) << '\n';
 }
 
 #endif
\ No newline at end of file
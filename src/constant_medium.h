@@ -10,67 +10,69 @@
 class constant_medium : public hittable {
 public:
     // the hittable needs to be a convex shape
-    constant_medium(shared_ptr<hittable> b, double d, shared_ptr<texture> a)
+    constant_medium(shared_ptr<hittable> b, real d, shared_ptr<texture> a)
         : boundary(b), neg_inv_density(-1.0/d), phase_function(make_shared<isotropic>(a)) {}
 
     // the hittable needs to be a convex shape
-    constant_medium(shared_ptr<hittable> b, double d, color c)
+    constant_medium(shared_ptr<hittable> b, real d, color c)
         : boundary(b), neg_inv_density(-1.0/d), phase_function(make_shared<isotropic>(c)) {}
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
         const bool enableDebug = false;
         const bool debugging = enableDebug && random_double() < 0.00001;
 
-        hit_record rec1, rec2;
-
-        // if ray doesnt hit object at all
-        if(!boundary->hit(r, interval::universe, rec1)){
+        // one query for where the ray is inside, instead of two full hits
+        interval inside;
+        if(!boundary->entry_exit(r, inside)){
             return false;
         }
 
-        // if ray doesnt hit boundary after entering the object
-        // for objects which arent closed?
-        if(!boundary->hit(r, interval(rec1.t + 0.0001, infinity), rec2)){
-            if(enableDebug)
-                std::clog << "\nray doesnt exit boundary\n";
+        if(debugging)
+            std::clog << "\nray_tmin=" << inside.min << ", ray_tmax=" << inside.max << "\n";
+
+        if(!scatter_inside(r, ray_t, inside, neg_inv_density, phase_function.get(), rec)){
             return false;
         }
 
-        if(debugging)
-            std::clog << "\nray_tmin=" << rec1.t << ", ray_tmax=" << rec2.t << "\n";
+        if(debugging){
+            std::clog << "rec.t = " << rec.t << "\n"
+                    << "rec.p = " << rec.p << "\n";
+        }
 
-        if(rec1.t < ray_t.min){
-            rec1.t = ray_t.min; 
+        return true;
+    }
+
+    // where in the part of inside within ray_t the ray scatters, if it does before leaving,
+    // also what the scene cache hits its media with
+    static bool scatter_inside(const ray& r, interval ray_t, interval inside, real neg_inv_density,
+                               const material* phase_function, hit_record& rec){
+        if(inside.min < ray_t.min){
+            inside.min = ray_t.min; 
         }
-        if(rec2.t > ray_t.max){
-            rec2.t = ray_t.max;
+        if(inside.max > ray_t.max){
+            inside.max = ray_t.max;
         }
 
-        if(rec1.t >= rec2.t)
+        if(inside.min >= inside.max)
             return false;
 
-        if(rec1.t < 0)
-            rec1.t = 0;
+        if(inside.min < 0)
+            inside.min = 0;
 
-        double ray_length = r.direction().length(); // "lenght"
-        double distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-        double hit_distance = neg_inv_density * log(random_double());
+        real ray_length = r.direction().length(); // "lenght"
+        real distance_inside_boundary = (inside.max - inside.min) * ray_length;
+        // drawn during traversal, maybe for a medium behind the closest hit, so not from the sampler
+        real hit_distance = neg_inv_density * log(random_double());
 
         if(hit_distance > distance_inside_boundary){
             return false;
         }
 
-        rec.t = rec1.t + hit_distance / ray_length;
+        rec.t = inside.min + hit_distance / ray_length;
         rec.p = r.at(rec.t);
-
-        if(debugging){
-            std::clog << "hit_distance = " << hit_distance << "\n"
-                    << "rec.t = " << rec.t << "\n"
-                    << "rec.p = " << rec.p << "\n";
-        }
-
         rec.normal = vec3(1, 0, 0); // arbitrary
         rec.front_face = true; // arbitrary
+        rec.dpdu = rec.dpdv = vec3(0, 0, 0);
         rec.mat = phase_function;
 
         return true;
@@ -80,9 +82,21 @@ public:
         return boundary->bounding_box();
     }
 
+    shared_ptr<hittable> get_boundary() const {
+        return boundary;
+    }
+
+    real get_neg_inv_density() const {
+        return neg_inv_density;
+    }
+
+    shared_ptr<material> get_phase_function() const {
+        return phase_function;
+    }
+
 private:
     shared_ptr<hittable> boundary;
-    double neg_inv_density;
+    real neg_inv_density;
     shared_ptr<material> phase_function;
 };
 
@@ -0,0 +1,224 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "blines.h"
+
+#include "color.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// per pixel means of a render and what the first hits of its samples saw, row by row from the top left
+struct aov_buffers {
+    int width = 0;
+    int height = 0;
+    std::vector<color> beauty;   // mean radiance
+    std::vector<color> emission; // the part of beauty emitted by the first hit, or the background for misses
+    std::vector<color> albedo;   // attenuation of the first hit, emission clamped to 1 for lights, the background for misses
+    std::vector<vec3> normal;    // facing the camera, 0 where nothing was hit
+    std::vector<real> depth;     // distance to the first hit, infinity where nothing was hit
+    std::vector<real> variance;  // of the luminance of the mean
+};
+
+// edge avoiding a-trous wavelet filter (Dammertz et al. 2010) with the variance guided luminance
+// weight of svgf (Schied et al. 2017): iterations of a 5x5 b3 spline whose taps spread out 1, 2, 4, ...
+// pixels, every tap weighted down by how much its luminance, normal and depth differ from the center's
+// the filter runs on the light the first hits scatter, divided by their albedo so textures and wall
+// colors aren't blurred; what the camera sees emitted (lights, the background) is sharp already and
+// goes back on at the end with the albedo; the variance of the mean goes through the same weights
+// squared so every iteration trusts the luminance a bit more
+// rows go to a thread pool, vreal_width pixels of a row are filtered at once
+class denoiser {
+public:
+    int iterations = 3;
+    real sigma_luminance = 2;  // in standard deviations of the center's luminance
+    real sigma_normal = 64;    // on the squared distance between unit normals
+    real sigma_depth = 0.02;   // relative depth difference per step of the filter
+    int thread_count = 0;      // like camera::thread_count
+
+    std::vector<color> run(const aov_buffers& aov) const {
+        planes p(aov.width, aov.height, border());
+        p.fill(aov);
+
+        std::unique_ptr<thread_pool> pool;
+        if(thread_count != 1){
+            pool = std::make_unique<thread_pool>(thread_count);
+        }
+        auto for_rows = [&](const std::function<void(int)>& body){
+            if(pool){
+                pool->parallel_for(aov.height, [&](int row, int){ body(row); });
+            }else{
+                for(int row = 0; row < aov.height; ++row) body(row);
+            }
+        };
+
+        planes::channels out = p.color_planes;
+        for(int it = 0; it < iterations; ++it){
+            for_rows([&](int row){ p.blur_variance(row); });
+            for_rows([&](int row){ filter_row(p, out, row, 1 << it); });
+            std::swap(p.color_planes, out);
+        }
+
+        std::vector<color> result(aov.beauty.size());
+        for(int i = 0; i < aov.height; ++i){
+            for(int j = 0; j < aov.width; ++j){
+                size_t k = p.at(i, j);
+                color a = aov.albedo[i * aov.width + j] + color(albedo_floor, albedo_floor, albedo_floor);
+                color scattered(p.color_planes[0][k], p.color_planes[1][k], p.color_planes[2][k]);
+                result[i * aov.width + j] = scattered * a + aov.emission[i * aov.width + j];
+            }
+        }
+        return result;
+    }
+
+private:
+    // the color is divided by albedo + albedo_floor, so black albedo keeps its color
+    static constexpr real albedo_floor = 0.01;
+    // misses are far away instead of infinitely, so they still filter with each other
+    static constexpr real miss_depth = 1e30;
+
+    // the widest tap reaches twice the last step, and the border is whole vectors wide
+    int border() const {
+        int reach = 2 << std::max(iterations - 1, 0);
+        return (reach + vreal_width - 1) / vreal_width * vreal_width;
+    }
+
+    // every buffer as its own padded plane, the border has infinite depth so its taps weigh nothing
+    struct planes {
+        int width, height, pad, stride;
+        // r, g, b and the variance, the ones that get filtered
+        using channels = std::vector<std::vector<real>>;
+        channels color_planes;
+        std::vector<real> variance_blur;
+        std::vector<real> nx, ny, nz, depth;
+
+        planes(int _width, int _height, int _pad) : width(_width), height(_height), pad(_pad), stride(_width + 2 * _pad) {
+            size_t size = static_cast<size_t>(stride) * (height + 2 * pad);
+            color_planes.assign(4, std::vector<real>(size, 0));
+            variance_blur.assign(size, 0);
+            nx.assign(size, 0);
+            ny.assign(size, 0);
+            nz.assign(size, 0);
+            depth.assign(size, infinity);
+        }
+
+        size_t at(int i, int j) const {
+            return static_cast<size_t>(i + pad) * stride + j + pad;
+        }
+
+        void fill(const aov_buffers& aov){
+            for(int i = 0; i < height; ++i){
+                for(int j = 0; j < width; ++j){
+                    size_t k = at(i, j);
+                    int p = i * width + j;
+                    color a = aov.albedo[p] + color(albedo_floor, albedo_floor, albedo_floor);
+                    for(int c = 0; c < 3; ++c){
+                        color_planes[c][k] = (aov.beauty[p][c] - aov.emission[p][c]) / a[c];
+                    }
+                    real y = luminance(a);
+                    color_planes[3][k] = aov.variance[p] / (y * y);
+                    nx[k] = aov.normal[p].x();
+                    ny[k] = aov.normal[p].y();
+                    nz[k] = aov.normal[p].z();
+                    depth[k] = std::isfinite(aov.depth[p]) ? aov.depth[p] : miss_depth;
+                }
+            }
+        }
+
+        // 3x3 gaussian of the variance for the luminance weights, one sample of it is too noisy
+        void blur_variance(int i){
+            static const real g[3] = {0.25, 0.5, 0.25};
+            const std::vector<real>& v = color_planes[3];
+            for(int j = 0; j < width; ++j){
+                size_t k = at(i, j);
+                real sum = 0, weight = 0;
+                for(int di = -1; di <= 1; ++di){
+                    for(int dj = -1; dj <= 1; ++dj){
+                        size_t q = k + di * stride + dj;
+                        if(depth[q] == infinity) continue;
+                        sum += g[di + 1] * g[dj + 1] * v[q];
+                        weight += g[di + 1] * g[dj + 1];
+                    }
+                }
+                variance_blur[k] = sum / weight;
+            }
+        }
+    };
+
+    // e^-x for x >= 0 as (1 - x / 256)^256, a few percent off where it matters and 0 from x = 256 on
+    static vreal exp_neg(vreal x){
+        vreal y = vr_max(vr_sub(vr_set(1), vr_mul(x, vr_set(1.0 / 256))), vr_set(0));
+        for(int k = 0; k < 8; ++k) y = vr_mul(y, y);
+        return y;
+    }
+
+    static vreal vr_abs(vreal x){
+        return vr_max(x, vr_sub(vr_set(0), x));
+    }
+
+    static vreal vr_luminance(vreal r, vreal g, vreal b){
+        return vr_add(vr_add(vr_mul(vr_set(0.2126), r), vr_mul(vr_set(0.7152), g)), vr_mul(vr_set(0.0722), b));
+    }
+
+    void filter_row(const planes& p, planes::channels& out, int i, int step) const {
+        static const real h[5] = {1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16};
+        const std::vector<real>& r = p.color_planes[0];
+        const std::vector<real>& g = p.color_planes[1];
+        const std::vector<real>& b = p.color_planes[2];
+        const std::vector<real>& v = p.color_planes[3];
+        const vreal zero = vr_set(0);
+
+        for(int j = 0; j < p.width; j += vreal_width){
+            size_t k = p.at(i, j);
+            vreal pr = vr_load(&r[k]), pg = vr_load(&g[k]), pb = vr_load(&b[k]);
+            vreal pnx = vr_load(&p.nx[k]), pny = vr_load(&p.ny[k]), pnz = vr_load(&p.nz[k]);
+            vreal pd = vr_load(&p.depth[k]);
+            vreal pl = vr_luminance(pr, pg, pb);
+            // 1 / the scale of each difference, so the taps only multiply
+            vreal inv_l = vr_div(vr_set(1), vr_add(vr_mul(vr_set(sigma_luminance), vr_sqrt(vr_max(vr_load(&p.variance_blur[k]), zero))), vr_set(1e-10)));
+            vreal inv_d = vr_div(vr_set(1), vr_add(vr_mul(vr_set(sigma_depth * step), pd), vr_set(1e-10)));
+            vreal sn = vr_set(sigma_normal);
+
+            vreal sr = zero, sg = zero, sb = zero, sv = zero, sw = zero;
+            for(int di = -2; di <= 2; ++di){
+                for(int dj = -2; dj <= 2; ++dj){
+                    size_t q = k + static_cast<ptrdiff_t>(di * step) * p.stride + dj * step;
+                    vreal qr = vr_load(&r[q]), qg = vr_load(&g[q]), qb = vr_load(&b[q]);
+                    vreal dnx = vr_sub(vr_load(&p.nx[q]), pnx);
+                    vreal dny = vr_sub(vr_load(&p.ny[q]), pny);
+                    vreal dnz = vr_sub(vr_load(&p.nz[q]), pnz);
+
+                    vreal x = vr_mul(vr_abs(vr_sub(vr_luminance(qr, qg, qb), pl)), inv_l);
+                    x = vr_add(x, vr_mul(sn, vr_add(vr_add(vr_mul(dnx, dnx), vr_mul(dny, dny)), vr_mul(dnz, dnz))));
+                    x = vr_add(x, vr_mul(vr_abs(vr_sub(vr_load(&p.depth[q]), pd)), inv_d));
+                    vreal w = vr_mul(vr_set(h[di + 2] * h[dj + 2]), exp_neg(x));
+
+                    sr = vr_add(sr, vr_mul(w, qr));
+                    sg = vr_add(sg, vr_mul(w, qg));
+                    sb = vr_add(sb, vr_mul(w, qb));
+                    sv = vr_add(sv, vr_mul(vr_mul(w, w), vr_load(&v[q])));
+                    sw = vr_add(sw, w);
+                }
+            }
+
+            // the center always weighs h[2]^2, lanes past the row end are garbage and not written
+            real lanes[4][vreal_width];
+            vreal inv_w = vr_div(vr_set(1), sw);
+            vr_store(lanes[0], vr_mul(sr, inv_w));
+            vr_store(lanes[1], vr_mul(sg, inv_w));
+            vr_store(lanes[2], vr_mul(sb, inv_w));
+            vr_store(lanes[3], vr_mul(sv, vr_mul(inv_w, inv_w)));
+            int n = std::min(vreal_width, p.width - j);
+            for(int c = 0; c < 4; ++c){
+                std::copy(lanes[c], lanes[c] + n, &out[c][k]);
+            }
+        }
+    }
+};
+
+#endif
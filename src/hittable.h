@@ -4,16 +4,23 @@
 #include "blines.h"
 #include "aabb.h"
 
+#include <cstdint>
+
 class material;
 
 class hit_record{
 public:
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;
-    double t;
-    double u, v;
+    const material* mat; // owned by the object that was hit, no refcounting per hit
+    real t;
+    real u, v;
     bool front_face;
+    // how p moves with u and v, set by every shape with a uv mapping, 0 where there is none
+    vec3 dpdu, dpdv;
+    // how u and v change from one pixel to the next, the texture footprint of the hit;
+    // the camera sets them for camera rays (see camera::set_uv_derivatives), 0 means a point sample
+    real dudx = 0, dvdx = 0, dudy = 0, dvdy = 0;
 
     // outward normal has to have unit lenght
     void set_face_normal(const ray& r, const vec3& outward_normal){
@@ -21,6 +28,63 @@ public:
         normal = front_face ? outward_normal : -outward_normal;
     }
 
+    void clear_uv_derivatives(){
+        dudx = dvdx = dudy = dvdy = 0;
+    }
+};
+
+// n <= 32 rays in structure of arrays form, usually a view into a ray_packet
+class ray_lanes {
+public:
+    int n;
+    const real* orig[3];
+    const real* dir[3];
+    const real* time;
+    real tmin;
+    real* tmax; // closest hit so far per lane, shrinks as primitives are hit
+    hit_record* recs;
+
+    ray get(int k) const {
+        return ray(point3(orig[0][k], orig[1][k], orig[2][k]), vec3(dir[0][k], dir[1][k], dir[2][k]), time[k]);
+    }
+};
+
+template<int N>
+class ray_packet {
+    static_assert(N >= 1 && N <= 32, "lanes are tracked in 32 bit masks");
+public:
+    alignas(32) real orig[3][N];
+    alignas(32) real dir[3][N];
+    real time[N];
+    real tmax[N];
+    hit_record recs[N];
+    int n = 0;
+
+    void clear(){
+        n = 0;
+    }
+
+    void add(const ray& r, real max = infinity){
+        for(int a = 0; a < 3; ++a){
+            orig[a][n] = r.origin()[a];
+            dir[a][n] = r.direction()[a];
+        }
+        time[n] = r.time();
+        tmax[n] = max;
+        ++n;
+    }
+
+    ray get(int k) const {
+        return ray(point3(orig[0][k], orig[1][k], orig[2][k]), vec3(dir[0][k], dir[1][k], dir[2][k]), time[k]);
+    }
+
+    uint32_t all() const {
+        return n == 32 ? ~0u : (1u << n) - 1;
+    }
+
+    ray_lanes lanes(real tmin){
+        return ray_lanes{n, {orig[0], orig[1], orig[2]}, {dir[0], dir[1], dir[2]}, time, tmin, tmax, recs};
+    }
 };
 
 class hittable {
@@ -32,7 +96,38 @@ public:
 
     virtual aabb bounding_box() const = 0;
 
-    virtual double pdf_value(const point3& o, const vec3& v) const {
+    // lanes missing from active are left alone, returns the lanes that found a closer hit
+    // shapes that can test several rays at once override this, the rest go one ray at a time
+    virtual uint32_t hit_packet(ray_lanes& rays, uint32_t active) const {
+        uint32_t hits = 0;
+        for(int k = 0; k < rays.n; ++k){
+            if(!(active & (1u << k))) continue;
+            if(hit(rays.get(k), interval(rays.tmin, rays.tmax[k]), rays.recs[k])){
+                rays.tmax[k] = rays.recs[k].t;
+                hits |= 1u << k;
+            }
+        }
+        return hits;
+    }
+
+    // whether anything is in the way within ray_t, the first hit found is enough
+    virtual bool occluded(const ray& r, interval ray_t) const {
+        hit_record rec;
+        return hit(r, ray_t, rec);
+    }
+
+    // where the whole line of r enters and leaves a convex shape, at any t; a flat shape is crossed
+    // once and gives entry == exit; this finds both with two hits, shapes that know better override it
+    virtual bool entry_exit(const ray& r, interval& inside) const {
+        hit_record rec1, rec2;
+        if(!hit(r, interval::universe, rec1) || !hit(r, interval(rec1.t + 0.0001, infinity), rec2)){
+            return false;
+        }
+        inside = interval(rec1.t, rec2.t);
+        return true;
+    }
+
+    virtual real pdf_value(const point3& o, const vec3& v) const {
         return 0.0;
     }
 
@@ -40,6 +135,11 @@ public:
         return vec3(1, 0, 0);
     }
 
+    // emitted power, radiance times area times pi, 0 for anything light sampling should not pick
+    virtual real power() const {
+        return 0;
+    }
+
 };
 
 class translate : public hittable {
@@ -62,9 +162,60 @@ public:
         return true;
     }
 
+    uint32_t hit_packet(ray_lanes& rays, uint32_t active) const override {
+        real orig[3][32];
+        for(int a = 0; a < 3; ++a){
+            for(int k = 0; k < rays.n; ++k){
+                orig[a][k] = rays.orig[a][k] - offset[a];
+            }
+        }
+
+        ray_lanes offset_rays = rays;
+        for(int a = 0; a < 3; ++a){
+            offset_rays.orig[a] = orig[a];
+        }
+
+        uint32_t hits = object->hit_packet(offset_rays, active);
+        for(int k = 0; k < rays.n; ++k){
+            if(hits & (1u << k)){
+                rays.recs[k].p += offset;
+            }
+        }
+        return hits;
+    }
+
     aabb bounding_box() const override {
         return bbox;
     }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(ray(r.origin() - offset, r.direction(), r.time()), ray_t);
+    }
+
+    bool entry_exit(const ray& r, interval& inside) const override {
+        return object->entry_exit(ray(r.origin() - offset, r.direction(), r.time()), inside);
+    }
+
+    real pdf_value(const point3& o, const vec3& v) const override {
+        return object->pdf_value(o - offset, v);
+    }
+
+    vec3 random(const point3& o) const override {
+        return object->random(o - offset);
+    }
+
+    real power() const override {
+        return object->power();
+    }
+
+    shared_ptr<hittable> get_object() const {
+        return object;
+    }
+
+    const vec3& get_offset() const {
+        return offset;
+    }
+
 private:
     shared_ptr<hittable> object;
     vec3 offset;
@@ -73,8 +224,8 @@ private:
 
 class rotate_y : public hittable {
 public:
-    rotate_y(shared_ptr<hittable> obj, double angle) : object(obj) {
-        double radians = degrees_to_radians(angle);
+    rotate_y(shared_ptr<hittable> obj, real angle) : object(obj) {
+        real radians = degrees_to_radians(angle);
         sin_theta = sin(radians);
         cos_theta = cos(radians);
         bbox = object->bounding_box();
@@ -86,12 +237,12 @@ public:
             for(int j = 0; j < 2; ++j){
                 for(int k = 0; k < 2; ++k){
                     // go through all the boxes points
-                    double x = i * bbox.x.max + (1 - i) * bbox.x.min;
-                    double y = j * bbox.y.max + (1 - j) * bbox.y.min;
-                    double z = k * bbox.z.max + (1 - k) * bbox.y.min;
+                    real x = i * bbox.x.max + (1 - i) * bbox.x.min;
+                    real y = j * bbox.y.max + (1 - j) * bbox.y.min;
+                    real z = k * bbox.z.max + (1 - k) * bbox.y.min;
 
-                    double newx = cos_theta * x + sin_theta * z;
-                    double newz = -sin_theta * x + cos_theta * z;
+                    real newx = cos_theta * x + sin_theta * z;
+                    real newz = -sin_theta * x + cos_theta * z;
 
                     vec3 tester(newx, y, newz);
 
@@ -107,19 +258,7 @@ public:
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        // put ray into object space
-        point3 origin = r.origin();
-        vec3 direction = r.direction();
-
-        origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
-        origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
-
-        direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
-        direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-
-        ray rotated_r(origin, direction, r.time());
-
-        if(!object->hit(rotated_r, ray_t, rec)){
+        if(!object->hit(to_object(r), ray_t, rec)){
             return false;
         }
 
@@ -135,17 +274,98 @@ public:
 
         rec.p = p;
         rec.normal = normal;
+        rec.dpdu = to_world(rec.dpdu);
+        rec.dpdv = to_world(rec.dpdv);
 
         return true;
     }
 
+    uint32_t hit_packet(ray_lanes& rays, uint32_t active) const override {
+        real orig[3][32], dir[3][32];
+        for(int k = 0; k < rays.n; ++k){
+            orig[0][k] = cos_theta * rays.orig[0][k] - sin_theta * rays.orig[2][k];
+            orig[1][k] = rays.orig[1][k];
+            orig[2][k] = sin_theta * rays.orig[0][k] + cos_theta * rays.orig[2][k];
+
+            dir[0][k] = cos_theta * rays.dir[0][k] - sin_theta * rays.dir[2][k];
+            dir[1][k] = rays.dir[1][k];
+            dir[2][k] = sin_theta * rays.dir[0][k] + cos_theta * rays.dir[2][k];
+        }
+
+        ray_lanes rotated_rays = rays;
+        for(int a = 0; a < 3; ++a){
+            rotated_rays.orig[a] = orig[a];
+            rotated_rays.dir[a] = dir[a];
+        }
+
+        uint32_t hits = object->hit_packet(rotated_rays, active);
+        for(int k = 0; k < rays.n; ++k){
+            if(!(hits & (1u << k))) continue;
+
+            hit_record& rec = rays.recs[k];
+            point3 p = rec.p;
+            vec3 normal = rec.normal;
+            rec.p[0] = cos_theta * p[0] + sin_theta * p[2];
+            rec.p[2] = -sin_theta * p[0] + cos_theta * p[2];
+            rec.normal[0] = cos_theta * normal[0] + sin_theta * normal[2];
+            rec.normal[2] = -sin_theta * normal[0] + cos_theta * normal[2];
+            rec.dpdu = to_world(rec.dpdu);
+            rec.dpdv = to_world(rec.dpdv);
+        }
+        return hits;
+    }
+
     aabb bounding_box() const override {
         return bbox;
     }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(to_object(r), ray_t);
+    }
+
+    bool entry_exit(const ray& r, interval& inside) const override {
+        return object->entry_exit(to_object(r), inside);
+    }
+
+    real pdf_value(const point3& o, const vec3& v) const override {
+        return object->pdf_value(to_object(o), to_object(v));
+    }
+
+    vec3 random(const point3& o) const override {
+        return to_world(object->random(to_object(o)));
+    }
+
+    real power() const override {
+        return object->power();
+    }
+
+    shared_ptr<hittable> get_object() const {
+        return object;
+    }
+
+    // object to world as a row major matrix
+    void get_rotation(real m[3][3]) const {
+        m[0][0] = cos_theta;  m[0][1] = 0; m[0][2] = sin_theta;
+        m[1][0] = 0;          m[1][1] = 1; m[1][2] = 0;
+        m[2][0] = -sin_theta; m[2][1] = 0; m[2][2] = cos_theta;
+    }
+
 private:
     shared_ptr<hittable> object;
-    double sin_theta;
-    double cos_theta;
+    real sin_theta;
+    real cos_theta;
     aabb bbox;
+
+    vec3 to_object(const vec3& v) const {
+        return vec3(cos_theta * v[0] - sin_theta * v[2], v[1], sin_theta * v[0] + cos_theta * v[2]);
+    }
+
+    vec3 to_world(const vec3& v) const {
+        return vec3(cos_theta * v[0] + sin_theta * v[2], v[1], -sin_theta * v[0] + cos_theta * v[2]);
+    }
+
+    ray to_object(const ray& r) const {
+        return ray(to_object(r.origin()), to_object(r.direction()), r.time());
+    }
 };
 #endif
\ No newline at end of file
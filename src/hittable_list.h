@@ -1,9 +1,10 @@
 #ifndef HITTABLE_LIST_H
-#define HITTABLE_LIST
+#define HITTABLE_LIST_H
 
 #include "hittable.h"
 #include "aabb.h"
 
+#include <algorithm>
 #include <vector>
 #include <memory>
 
@@ -31,7 +32,7 @@ public:
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
         hit_record temp_rec;
         bool hit_anything = false;
-        double closest_so_far = ray_t.max;
+        real closest_so_far = ray_t.max;
 
         for(const shared_ptr<hittable>& object : objects){
             if(object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)){
@@ -44,13 +45,41 @@ public:
         return hit_anything;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        for(const shared_ptr<hittable>& object : objects){
+            if(object->occluded(r, ray_t)) return true;
+        }
+        return false;
+    }
+
+    // the objects together are the convex shape, like the sides of a box: it spans from the first
+    // entry to the last exit of any of them
+    bool entry_exit(const ray& r, interval& inside) const override {
+        inside = interval::empty;
+        for(const shared_ptr<hittable>& object : objects){
+            interval part;
+            if(object->entry_exit(r, part)){
+                inside = interval(inside, part);
+            }
+        }
+        return inside.min <= inside.max;
+    }
+
+    uint32_t hit_packet(ray_lanes& rays, uint32_t active) const override {
+        uint32_t hits = 0;
+        for(const shared_ptr<hittable>& object : objects){
+            hits |= object->hit_packet(rays, active);
+        }
+        return hits;
+    }
+
     aabb bounding_box() const override {
         return bbox;
     }
 
-    double pdf_value(const point3& o, const vec3& v) const override {
-        double weight = 1.0 / objects.size();
-        double sum = 0.0;
+    real pdf_value(const point3& o, const vec3& v) const override {
+        real weight = 1.0 / objects.size();
+        real sum = 0.0;
 
         for(const auto& object : objects) {
             sum += weight * object->pdf_value(o, v);
@@ -61,7 +90,7 @@ public:
 
     vec3 random(const vec3& o) const override {
         int int_size = static_cast<int>(objects.size());
-        return objects[random_int(0, int_size - 1)]->random(o);
+        return objects[std::min(static_cast<int>(sample_1d() * int_size), int_size - 1)]->random(o);
     }
 
 private:
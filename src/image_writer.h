@@ -0,0 +1,243 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "color.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// a finished picture, row by row from the top left
+// linear pixels are radiance and get gamma corrected for the 8 bit formats,
+// the others (like heatmaps) are already display values
+struct image {
+    int width = 0;
+    int height = 0;
+    std::vector<color> pixels;
+    bool linear = true;
+
+    image(int _width, int _height, bool _linear = true)
+      : width(_width), height(_height), pixels(_width * _height), linear(_linear) {}
+};
+
+// every writer encodes the whole image into memory and hands the file a single write
+class image_writer {
+public:
+    virtual ~image_writer() = default;
+
+    // false when the file could not be written
+    virtual bool write(const std::string& filename, const image& img) const = 0;
+
+protected:
+    static bool write_file(const std::string& filename, const std::string& data){
+        std::ofstream out(filename, std::ios::binary);
+        out.write(data.data(), data.size());
+        return static_cast<bool>(out);
+    }
+
+    // rgb bytes of row i, appended to out
+    static void append_row8(std::string& out, const image& img, int i){
+        for(int j = 0; j < img.width; ++j){
+            const color& c = img.pixels[i * img.width + j];
+            for(int k = 0; k < 3; ++k){
+                out += static_cast<char>(to_byte(img.linear ? linear_to_gamma(c[k]) : c[k]));
+            }
+        }
+    }
+
+    static void append_be32(std::string& out, uint32_t x){
+        out += static_cast<char>(x >> 24);
+        out += static_cast<char>(x >> 16);
+        out += static_cast<char>(x >> 8);
+        out += static_cast<char>(x);
+    }
+};
+
+// binary P6, or the old text P3
+class ppm_writer : public image_writer {
+public:
+    ppm_writer(bool _binary = true) : binary(_binary) {}
+
+    bool write(const std::string& filename, const image& img) const override {
+        std::string rgb;
+        rgb.reserve(3 * img.pixels.size());
+        for(int i = 0; i < img.height; ++i){
+            append_row8(rgb, img, i);
+        }
+
+        std::string data = (binary ? "P6\n" : "P3\n") + std::to_string(img.width) + " "
+                         + std::to_string(img.height) + "\n255\n";
+        if(binary){
+            data += rgb;
+        }else{
+            data.reserve(data.size() + 4 * rgb.size());
+            for(size_t k = 0; k < rgb.size(); ++k){
+                data += std::to_string(static_cast<unsigned char>(rgb[k]));
+                data += (k % 3 == 2) ? '\n' : ' ';
+            }
+        }
+        return write_file(filename, data);
+    }
+
+private:
+    bool binary;
+};
+
+// portable float map: unclamped linear rgb as 32 bit floats, rows stored bottom to top
+class pfm_writer : public image_writer {
+public:
+    bool write(const std::string& filename, const image& img) const override {
+        const uint16_t probe = 1;
+        bool little_endian = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+
+        std::string data = "PF\n" + std::to_string(img.width) + " " + std::to_string(img.height)
+                         + (little_endian ? "\n-1.0\n" : "\n1.0\n");
+        size_t header = data.size();
+        data.resize(header + 3 * sizeof(float) * img.pixels.size());
+
+        // the string's bytes aren't floats, so each one is copied in
+        char* out = &data[header];
+        for(int i = img.height - 1; i >= 0; --i){
+            for(int j = 0; j < img.width; ++j){
+                const color& c = img.pixels[i * img.width + j];
+                for(int k = 0; k < 3; ++k){
+                    float value = static_cast<float>(c[k]);
+                    std::memcpy(out, &value, sizeof(float));
+                    out += sizeof(float);
+                }
+            }
+        }
+        return write_file(filename, data);
+    }
+};
+
+// radiance .hdr: unclamped linear rgb sharing an 8 bit exponent, flat scanlines without rle
+class hdr_writer : public image_writer {
+public:
+    bool write(const std::string& filename, const image& img) const override {
+        std::string data = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + std::to_string(img.height)
+                         + " +X " + std::to_string(img.width) + "\n";
+        data.reserve(data.size() + 4 * img.pixels.size());
+        for(const color& c : img.pixels){
+            double m = std::max(c.x(), std::max(c.y(), c.z()));
+            if(!(m > 1e-32)){ // also catches nan
+                data.append(4, '\0');
+                continue;
+            }
+            int e;
+            double scale = frexp(m, &e) * 256 / m;
+            for(int k = 0; k < 3; ++k){
+                data += static_cast<char>(static_cast<unsigned char>(std::max<double>(0, c[k]) * scale));
+            }
+            data += static_cast<char>(e + 128);
+        }
+        return write_file(filename, data);
+    }
+};
+
+// 8 bit rgb png; the deflate stream uses stored blocks, so it is quick to write but not compressed
+class png_writer : public image_writer {
+public:
+    bool write(const std::string& filename, const image& img) const override {
+        std::string raw;
+        raw.reserve((3 * img.width + 1) * img.height);
+        for(int i = 0; i < img.height; ++i){
+            raw += '\0'; // filter type none
+            append_row8(raw, img, i);
+        }
+
+        std::string zlib = "\x78\x01";
+        const size_t max_block = 65535;
+        size_t pos = 0;
+        do{
+            size_t len = std::min(max_block, raw.size() - pos);
+            zlib += static_cast<char>(pos + len == raw.size());
+            zlib += static_cast<char>(len & 0xff);
+            zlib += static_cast<char>(len >> 8);
+            zlib += static_cast<char>(~len & 0xff);
+            zlib += static_cast<char>((~len >> 8) & 0xff);
+            zlib.append(raw, pos, len);
+            pos += len;
+        }while(pos < raw.size());
+        append_be32(zlib, adler32(raw));
+
+        std::string ihdr;
+        append_be32(ihdr, img.width);
+        append_be32(ihdr, img.height);
+        ihdr += std::string("\x08\x02\x00\x00\x00", 5); // 8 bit rgb, deflate, no interlace
+
+        std::string data = "\x89PNG\r\n\x1a\n";
+        append_chunk(data, "IHDR", ihdr);
+        append_chunk(data, "IDAT", zlib);
+        append_chunk(data, "IEND", "");
+        return write_file(filename, data);
+    }
+
+private:
+    static void append_chunk(std::string& out, const char* type, const std::string& body){
+        append_be32(out, static_cast<uint32_t>(body.size()));
+        std::string typed = std::string(type, 4) + body;
+        out += typed;
+        append_be32(out, crc32(typed));
+    }
+
+    static uint32_t crc32(const std::string& bytes){
+        static const std::vector<uint32_t> table = []{
+            std::vector<uint32_t> t(256);
+            for(uint32_t n = 0; n < 256; ++n){
+                uint32_t c = n;
+                for(int k = 0; k < 8; ++k){
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                }
+                t[n] = c;
+            }
+            return t;
+        }();
+
+        uint32_t c = 0xffffffffu;
+        for(unsigned char b : bytes){
+            c = table[(c ^ b) & 0xff] ^ (c >> 8);
+        }
+        return c ^ 0xffffffffu;
+    }
+
+    static uint32_t adler32(const std::string& bytes){
+        uint32_t a = 1, b = 0;
+        size_t pos = 0;
+        while(pos < bytes.size()){
+            // 5552 bytes is the most that can be summed before b overflows
+            size_t end = std::min(pos + 5552, bytes.size());
+            for(; pos < end; ++pos){
+                a += static_cast<unsigned char>(bytes[pos]);
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        return (b << 16) | a;
+    }
+};
+
+// the format follows the extension: .pfm, .hdr, .png, anything else is a binary ppm
+inline std::unique_ptr<image_writer> make_image_writer(const std::string& filename){
+    size_t dot = filename.find_last_of('.');
+    std::string ext = dot == std::string::npos ? "" : filename.substr(dot + 1);
+    if(ext == "pfm") return std::make_unique<pfm_writer>();
+    if(ext == "hdr") return std::make_unique<hdr_writer>();
+    if(ext == "png") return std::make_unique<png_writer>();
+    return std::make_unique<ppm_writer>();
+}
+
+inline bool save_image(const std::string& filename, const image& img){
+    if(!make_image_writer(filename)->write(filename, img)){
+        std::cerr << "ERROR: Could not write image file '" << filename << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+#endif
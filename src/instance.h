@@ -0,0 +1,209 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "blines.h"
+
+#include "aabb.h"
+#include "hittable.h"
+
+// x -> L x + t, the 3x3 L in the first three columns and t in the last
+// a * b applies b first
+class affine {
+public:
+    real m[3][4];
+
+    affine() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+    static affine translation(const vec3& offset){
+        affine a;
+        for(int i = 0; i < 3; ++i) a.m[i][3] = offset[i];
+        return a;
+    }
+
+    // counterclockwise looking down the axis, like rotate_y for (0, 1, 0)
+    static affine rotation(const vec3& axis, real degrees){
+        vec3 k = unit_vector(axis);
+        real radians = degrees_to_radians(degrees);
+        real c = cos(radians), s = sin(radians), t = 1 - c;
+
+        affine a;
+        a.m[0][0] = t * k[0] * k[0] + c;        a.m[0][1] = t * k[0] * k[1] - s * k[2]; a.m[0][2] = t * k[0] * k[2] + s * k[1];
+        a.m[1][0] = t * k[0] * k[1] + s * k[2]; a.m[1][1] = t * k[1] * k[1] + c;        a.m[1][2] = t * k[1] * k[2] - s * k[0];
+        a.m[2][0] = t * k[0] * k[2] - s * k[1]; a.m[2][1] = t * k[1] * k[2] + s * k[0]; a.m[2][2] = t * k[2] * k[2] + c;
+        return a;
+    }
+
+    static affine scaling(const vec3& factors){
+        affine a;
+        for(int i = 0; i < 3; ++i) a.m[i][i] = factors[i];
+        return a;
+    }
+
+    affine operator*(const affine& b) const {
+        affine a;
+        for(int i = 0; i < 3; ++i){
+            for(int j = 0; j < 4; ++j){
+                a.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j] + (j == 3 ? m[i][3] : 0);
+            }
+        }
+        return a;
+    }
+
+    point3 point(const point3& p) const {
+        return vector(p) + vec3(m[0][3], m[1][3], m[2][3]);
+    }
+
+    vec3 vector(const vec3& v) const {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+    // with the transpose of L, a normal maps through the transpose of the inverse
+    vec3 transposed(const vec3& v) const {
+        return vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+                    m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+                    m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+    }
+
+    real determinant() const {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+             - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+             + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    // L has to be invertible
+    affine inverse() const {
+        real inv_det = 1 / determinant();
+        affine a;
+        a.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+        a.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        a.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        a.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv_det;
+        a.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        a.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        a.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+        a.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        a.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+        vec3 t = a.vector(vec3(m[0][3], m[1][3], m[2][3]));
+        for(int i = 0; i < 3; ++i) a.m[i][3] = -t[i];
+        return a;
+    }
+
+    // box around the transformed corners
+    aabb box(const aabb& b) const {
+        aabb out;
+        for(int i = 0; i < 8; ++i){
+            point3 corner((i & 1) ? b.x.max : b.x.min, (i & 2) ? b.y.max : b.y.min, (i & 4) ? b.z.max : b.z.min);
+            point3 p = point(corner);
+            out = aabb(out, aabb(p, p));
+        }
+        return out;
+    }
+};
+
+// an object placed in the world by an affine transform, the object is shared and not copied,
+// so a bvh_node over instances is the top level of a two level bvh whose bottom level is
+// the shared object's own bvh (a bvh_node, sphere_set or triangle_mesh)
+// rays go into object space unnormalized so hit distances stay the same in both spaces
+// an instance of a light is sampled like the light, with its directions and power carried over
+class instance : public hittable {
+public:
+    instance(shared_ptr<hittable> _object, const affine& _to_world)
+        : object(_object), to_world(_to_world), to_object(_to_world.inverse())
+    {
+        bbox = to_world.box(object->bounding_box());
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        ray object_r(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+        if(!object->hit(object_r, ray_t, rec)){
+            return false;
+        }
+
+        // the transform keeps the sign of dot(direction, normal), so front_face holds
+        rec.p = r.at(rec.t);
+        rec.normal = unit_vector(to_object.transposed(rec.normal));
+        rec.dpdu = to_world.vector(rec.dpdu);
+        rec.dpdv = to_world.vector(rec.dpdv);
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time()), ray_t);
+    }
+
+    // the transform is affine, so t is the same along both rays
+    bool entry_exit(const ray& r, interval& inside) const override {
+        return object->entry_exit(ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time()), inside);
+    }
+
+    uint32_t hit_packet(ray_lanes& rays, uint32_t active) const override {
+        real orig[3][32], dir[3][32];
+        for(int k = 0; k < rays.n; ++k){
+            point3 o = to_object.point(point3(rays.orig[0][k], rays.orig[1][k], rays.orig[2][k]));
+            vec3 d = to_object.vector(vec3(rays.dir[0][k], rays.dir[1][k], rays.dir[2][k]));
+            for(int a = 0; a < 3; ++a){
+                orig[a][k] = o[a];
+                dir[a][k] = d[a];
+            }
+        }
+
+        ray_lanes object_rays = rays;
+        for(int a = 0; a < 3; ++a){
+            object_rays.orig[a] = orig[a];
+            object_rays.dir[a] = dir[a];
+        }
+
+        uint32_t hits = object->hit_packet(object_rays, active);
+        for(int k = 0; k < rays.n; ++k){
+            if(!(hits & (1u << k))) continue;
+
+            hit_record& rec = rays.recs[k];
+            rec.p = rays.get(k).at(rec.t);
+            rec.normal = unit_vector(to_object.transposed(rec.normal));
+            rec.dpdu = to_world.vector(rec.dpdu);
+            rec.dpdv = to_world.vector(rec.dpdv);
+        }
+        return hits;
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    // the object's pdf of the direction in object space, times how much the transform spreads
+    // the directions around it: |det L^-1| / |L^-1 v|^3 for a unit v
+    real pdf_value(const point3& o, const vec3& v) const override {
+        vec3 d = to_object.vector(unit_vector(v));
+        real length = d.length();
+        return object->pdf_value(to_object.point(o), d) * std::fabs(to_object.determinant()) / (length * length * length);
+    }
+
+    vec3 random(const point3& o) const override {
+        return to_world.vector(object->random(to_object.point(o)));
+    }
+
+    // the area of the surface grows by |det L|^(2/3), exact for rotations and uniform scales and
+    // an average otherwise, which only moves how often the light is picked
+    real power() const override {
+        return object->power() * std::pow(std::fabs(to_world.determinant()), static_cast<real>(2) / 3);
+    }
+
+    const shared_ptr<hittable>& get_object() const {
+        return object;
+    }
+
+    const affine& get_to_world() const {
+        return to_world;
+    }
+
+private:
+    shared_ptr<hittable> object;
+    affine to_world;
+    affine to_object;
+    aabb bbox;
+};
+
+#endif
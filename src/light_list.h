@@ -0,0 +1,311 @@
+#ifndef LIGHT_LIST_H
+#define LIGHT_LIST_H
+
+#include "blines.h"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+// the emitters of a lights list, sampled in proportion to their power
+// up to bvh_threshold lights one is picked from an alias table in O(1) and pdf_value asks each of them,
+// above that a bvh over the lights does both in O(log lights): every node splits the choice between
+// its children by power over squared distance to the shading point, and pdf_value only walks the
+// nodes the direction passes through, multiplying the same choices on the way down
+// hit() finds the light behind a sampled direction, the world is what gets traced for everything else
+// with an unlit_share above 0 the leaves that don't emit (like the book's glass sphere) are kept too
+// and together get that share of the choices, split evenly, the emitters share the rest by power
+class light_list : public hittable {
+public:
+    static const size_t bvh_threshold = 16;
+
+    light_list() {}
+
+    // the leaves of lights (through hittable_lists and bvh_nodes) whose power() isn't 0,
+    // so the world itself works as a lights list; anything else in there is only sampled with an unlit_share
+    light_list(const hittable& lights, real _unlit_share = 0) : unlit_share(std::min<real>(std::max<real>(_unlit_share, 0), 0.99)) {
+        collect(lights);
+        build();
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    bool empty() const {
+        return entries.empty();
+    }
+
+    // the leaves a light_list of lights would sample, as a plain list
+    static hittable_list emitters(const hittable& lights){
+        hittable_list found;
+        for(const light_entry& light : light_list(lights).entries){
+            found.add(light.object);
+        }
+        return found;
+    }
+
+    // the closest light, for the emission behind a direction random() picked
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        bool hit_anything = false;
+        if(entries.size() <= bvh_threshold){
+            for(const light_entry& light : entries){
+                if(light.object->hit(r, ray_t, rec)){
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+            return hit_anything;
+        }
+
+        const vec3& d = r.direction();
+        vec3 inv_dir(1 / d.x(), 1 / d.y(), 1 / d.z());
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while(top > 0){
+            const light_node& node = nodes[stack[--top]];
+            if(!node.box.hit(r.origin(), inv_dir, ray_t)) continue;
+
+            if(node.light >= 0){
+                if(entries[node.light].object->hit(r, ray_t, rec)){
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+                continue;
+            }
+            stack[top++] = node.right;
+            stack[top++] = static_cast<int>(&node - nodes.data()) + 1;
+        }
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    real pdf_value(const point3& o, const vec3& v) const override {
+        if(entries.size() <= bvh_threshold){
+            real sum = 0;
+            for(const light_entry& light : entries){
+                sum += light.probability * light.object->pdf_value(o, v);
+            }
+            return sum;
+        }
+
+        // the lights v can reach, each weighted by the choices that lead to it
+        vec3 inv_dir(1 / v.x(), 1 / v.y(), 1 / v.z());
+        int stack[64];
+        real chance[64];
+        int top = 0;
+        stack[top] = 0;
+        chance[top++] = 1;
+
+        real sum = 0;
+        while(top > 0){
+            --top;
+            int n = stack[top];
+            real p = chance[top];
+            const light_node& node = nodes[n];
+            if(!node.box.hit(o, inv_dir, interval(0.0001, infinity))) continue;
+
+            if(node.light >= 0){
+                sum += p * entries[node.light].object->pdf_value(o, v);
+                continue;
+            }
+
+            real left = left_probability(n, o);
+            stack[top] = n + 1;
+            chance[top++] = p * left;
+            stack[top] = node.right;
+            chance[top++] = p * (1 - left);
+        }
+        return sum;
+    }
+
+    // one 1d sample picks the light, stretched back over [0, 1) after every choice
+    // so the sampler's stratification survives down to the leaf
+    vec3 random(const point3& o) const override {
+        double u = sample_1d();
+        if(entries.size() <= bvh_threshold){
+            u *= entries.size();
+            int i = std::min(static_cast<int>(u), static_cast<int>(entries.size()) - 1);
+            if(u - i >= entries[i].keep) i = entries[i].alias;
+            return entries[i].object->random(o);
+        }
+
+        int n = 0;
+        while(nodes[n].light < 0){
+            double left = left_probability(n, o);
+            if(u < left){
+                u /= left;
+                n = n + 1;
+            }else{
+                u = std::min((u - left) / (1 - left), 1 - 0x1p-53);
+                n = nodes[n].right;
+            }
+        }
+        return entries[nodes[n].light].object->random(o);
+    }
+
+private:
+    struct light_entry {
+        shared_ptr<hittable> object;
+        real power;
+        real probability; // of the alias table, power over total power
+        real keep;        // chance of keeping this slot of the alias table instead of going to alias
+        int alias;
+    };
+
+    // the left child of an interior node follows it, leaves have a light
+    struct light_node {
+        aabb box;
+        real power;
+        int right;
+        int light;
+    };
+
+    std::vector<light_entry> entries;
+    std::vector<light_node> nodes;
+    aabb bbox;
+    real unlit_share = 0;
+
+    void collect(const hittable& object){
+        if(auto list = dynamic_cast<const hittable_list*>(&object)){
+            for(const shared_ptr<hittable>& child : list->objects){
+                collect_child(child);
+            }
+        }else if(auto tree = dynamic_cast<const bvh_node*>(&object)){
+            for(const shared_ptr<hittable>& child : tree->primitive_array()){
+                collect_child(child);
+            }
+        }
+    }
+
+    void collect_child(const shared_ptr<hittable>& child){
+        if(dynamic_cast<const hittable_list*>(child.get()) || dynamic_cast<const bvh_node*>(child.get())){
+            collect(*child);
+            return;
+        }
+        real power = child->power();
+        if(power > 0 || unlit_share > 0){
+            entries.push_back({child, std::max<real>(power, 0), 0, 1, 0});
+            bbox = aabb(bbox, child->bounding_box());
+        }
+    }
+
+    void build(){
+        if(entries.empty()) return;
+
+        real total = 0;
+        int unlit = 0;
+        for(const light_entry& light : entries){
+            total += light.power;
+            if(light.power <= 0) ++unlit;
+        }
+        // the unlit leaves get a power that adds up to their share, which the light bvh then splits by too
+        if(unlit > 0){
+            real each = total > 0 ? total * unlit_share / ((1 - unlit_share) * unlit) : 1;
+            for(light_entry& light : entries){
+                if(light.power <= 0) light.power = each;
+            }
+            total += each * unlit;
+        }
+        for(light_entry& light : entries) light.probability = light.power / total;
+
+        if(entries.size() <= bvh_threshold){
+            build_alias_table();
+            return;
+        }
+
+        std::vector<int> order(entries.size());
+        std::iota(order.begin(), order.end(), 0);
+        nodes.reserve(2 * entries.size());
+        build_node(order, 0, static_cast<int>(order.size()));
+    }
+
+    // Vose's method, every slot keeps its own light with chance keep and goes to alias otherwise
+    void build_alias_table(){
+        int n = static_cast<int>(entries.size());
+        std::vector<real> scaled(n);
+        std::vector<int> small, large;
+        for(int i = 0; i < n; ++i){
+            scaled[i] = entries[i].probability * n;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+
+        while(!small.empty() && !large.empty()){
+            int s = small.back(), l = large.back();
+            small.pop_back();
+            entries[s].keep = scaled[s];
+            entries[s].alias = l;
+            scaled[l] -= 1 - scaled[s];
+            if(scaled[l] < 1){
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // what's left is 1 up to rounding
+        for(int i : small) entries[i].keep = 1;
+        for(int i : large) entries[i].keep = 1;
+    }
+
+    // median split along the longest axis of the light centers
+    int build_node(std::vector<int>& order, int start, int end){
+        int index = static_cast<int>(nodes.size());
+        nodes.push_back(light_node());
+
+        aabb box, centers;
+        real power = 0;
+        for(int i = start; i < end; ++i){
+            aabb b = entries[order[i]].object->bounding_box();
+            box = aabb(box, b);
+            point3 c(b.x.min + b.x.max, b.y.min + b.y.max, b.z.min + b.z.max);
+            centers = aabb(centers, aabb(c / 2, c / 2));
+            power += entries[order[i]].power;
+        }
+
+        if(end - start == 1){
+            nodes[index] = {box, power, 0, order[start]};
+            return index;
+        }
+
+        int axis = 0;
+        for(int a = 1; a < 3; ++a){
+            if(centers.axis(a).size() > centers.axis(axis).size()) axis = a;
+        }
+        int mid = start + (end - start) / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](int a, int b){
+            interval ia = entries[a].object->bounding_box().axis(axis);
+            interval ib = entries[b].object->bounding_box().axis(axis);
+            return ia.min + ia.max < ib.min + ib.max;
+        });
+
+        build_node(order, start, mid);
+        int right = build_node(order, mid, end);
+        nodes[index] = {box, power, right, -1};
+        return index;
+    }
+
+    // a node seen from o, its power over the squared distance to its center,
+    // but never closer than half its diagonal so nodes around o don't take over
+    real importance(const light_node& node, const point3& o) const {
+        point3 center((node.box.x.min + node.box.x.max) / 2, (node.box.y.min + node.box.y.max) / 2,
+                      (node.box.z.min + node.box.z.max) / 2);
+        vec3 half(node.box.x.size() / 2, node.box.y.size() / 2, node.box.z.size() / 2);
+        return node.power / std::max((center - o).length_squared(), half.length_squared());
+    }
+
+    real left_probability(int n, const point3& o) const {
+        real left = importance(nodes[n + 1], o);
+        real right = importance(nodes[nodes[n].right], o);
+        return left + right > 0 ? left / (left + right) : 0.5;
+    }
+};
+
+#endif
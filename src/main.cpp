@@ -1,460 +1,165 @@
 #include "blines.h"
 
-#include "bvh.h"
-#include "color.h"
-#include "hittable.h"
-#include "sphere.h"
-#include "camera.h"
-#include "material.h"
-#include "texture.h"
-#include "quad.h"
-#include "constant_medium.h"
+#include "scenes.h"
+#include "scene_file.h"
+#include "bench.h"
 
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
-
-void fun_balls(){
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
-
-    // auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    // world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-
-    for(int a = -11; a < 11; ++a){
-        for(int b = -11; b < 11; ++b){
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if((center - point3(4, 0.2, 0)).length() > 0.9){
-                shared_ptr<material> sphere_mat;
-
-                if(choose_mat < 0.8){
-                    //difuse 
-                    auto albedo = color::random() * color::random();
-                    sphere_mat = make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0, random_double(0, 0.5), 0);
-                    world.add(make_shared<sphere>(center, center2, 0.2, sphere_mat));
-                } else if (choose_mat < 0.95){
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_mat = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_mat));
-                }else{
-                    // glass
-                    sphere_mat = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_mat));
-                }
-            }
-        }
+#include <string>
+
+// what the command line asks for, negative numbers and empty strings leave the scene's own settings
+struct options {
+    int number = 11;
+    std::string scene_path;
+    int width = -1;
+    int spp = -1;
+    int depth = -1;
+    int threads = -1;
+    int denoise = -1;
+    int aovs = -1;
+    std::string output;
+
+    void apply(camera& cam) const {
+        if(width > 0) cam.image_width = width;
+        if(spp > 0) cam.samples_per_pixel = spp;
+        if(depth > 0) cam.max_depth = depth;
+        if(threads >= 0) cam.thread_count = threads;
+        if(denoise >= 0) cam.denoise = denoise != 0;
+        if(aovs >= 0) cam.write_aovs = aovs != 0;
+        if(!output.empty()) cam.filename = output;
     }
-
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    world = hittable_list(make_shared<bvh_node>(world));
-
-    camera cam("images\\image2.ppm");
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 200;
-    cam.max_depth = 50;
-    cam.background = color(0.7, 0.8, 1);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_dist = 10.0;
-
-    cam.render(world, world);
+};
+
+void usage(){
+    std::cerr << "usage: main.exe [number | scene file] [--width n] [--spp n] [--depth n] [--threads n] [--output file]\n"
+              << "                [--denoise 0|1] [--aovs 0|1]\n"
+              << "  a number picks a scene or benchmark built into main.cpp, 11 without one\n"
+              << "  --threads 0 uses every hardware thread, the output extension picks the format\n"
+              << "  --aovs 1 also writes the albedo, normal, depth and variance buffers next to the output\n";
 }
 
-void the_trio(){
-    hittable_list world;
-
-    shared_ptr<material> material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-    shared_ptr<material> material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
-    shared_ptr<material> material_left = make_shared<dielectric>(1.5);
-    shared_ptr<material> material_right = make_shared<metal>(color(0.8, 0.6, 0.2), 1.0);
-
-    world.add(make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));
-    world.add(make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, material_center));
-    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
-    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), -0.4, material_left));
-    world.add(make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
-    
-    world = hittable_list(make_shared<bvh_node>(world));
-
-    camera cam("images\\image.ppm");
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.7, 0.8, 1);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(-2, 2, 1);
-    cam.lookat = point3(0, 0, -1);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-    cam.focus_dist = 1;
-
-    cam.render(world, world);
-}
-
-void two_balls(){
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(1 / pi, color(.2, .3, .1), color(.9, .9, .9));
-
-    world.add(make_shared<sphere>(point3(0, -10, 0), 10, make_shared<lambertian>(checker)));
-    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
-
-    world = hittable_list(make_shared<bvh_node>(world));
-
-    camera cam("images\\image3.ppm");
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 50;
-    cam.max_depth = 10;
-    cam.background = color(0.7, 0.8, 1);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, world);
-}
-
-void earth(){
-    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
-
-    camera cam("images\\image4.ppm");
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 50;
-    cam.max_depth = 10;
-    cam.background = color(0.7, 0.8, 1);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(0, 0, 12);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(hittable_list(globe), hittable_list(globe));
-}
-
-void two_perlin_spheres(){
-    hittable_list world;
-
-    auto pertext = make_shared<noise_texture>(4);
-
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
-
-    world = hittable_list(make_shared<bvh_node>(world));
-
-    camera cam("images\\image5.ppm");
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 50;
-    cam.max_depth = 10;
-    cam.background = color(0.7, 0.8, 1);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, world);
-}
-
-void quads(){
-    hittable_list world;
-
-    auto left_red = make_shared<lambertian>(color(1, 0.2, 0.2));
-    auto back_green = make_shared<lambertian>(color(0.2, 1, 0.2));
-    auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0));
-    auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-    world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
-
-    world = hittable_list(make_shared<bvh_node>(world));
-
-    camera cam("images\\image6.ppm");
-    cam.aspect_ratio = 1;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 50;
-    cam.max_depth = 10;
-    cam.background = color(0.7, 0.8, 1);
-
-    cam.vfov = 80;
-    cam.lookfrom = point3(0, 0, 9);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, world);
-}
-
-void simple_light(){
-    hittable_list world;
-
-    auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
-
-    auto difflight = make_shared<diffuse_light>(color(4, 4, 4));
-    world.add(make_shared<sphere>(point3(0, 7, 0), 2, difflight));
-    world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
-
-    world = hittable_list(make_shared<bvh_node>(world));
-
-    camera cam("images\\image7.ppm");
-    cam.aspect_ratio = 16.0 / 9;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 400;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(26, 3, 6);
-    cam.lookat = point3(0, 2, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, world);
-}
-
-void cornell_box(std::string filename){
-    hittable_list world;
-
-    auto red = make_shared<lambertian>(color(0.65, .05, .05));
-    auto white = make_shared<lambertian>(color(0.73, .73, .73));
-    auto green = make_shared<lambertian>(color(0.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-    // Walls
-    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-    world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
-    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
-
-    // Light
-    // . Ceiling Light
-    world.add(make_shared<quad>(point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), light));
-
-    // . Glass sphere
-    auto glass = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
-
-    hittable_list lights;
-    auto m = shared_ptr<material>();
-    lights.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), m));
-    lights.add(make_shared<sphere>(point3(190, 90, 190), 90, m));
-
-
-    // Box 1
-    // shared_ptr<material> aluminum = make_shared<metal>(color(0.8, 0.85, 0.88), 0.0);
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-    world.add(box1);
-
-    /*
-    // Box 2
-    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-    world.add(box2);
-    */
-
-    world = hittable_list(make_shared<bvh_node>(world));
-
-    camera cam("images\\" + filename);
-    cam.aspect_ratio = 1;
-    cam.image_width = 600;
-    cam.samples_per_pixel = 1000;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat = point3(278, 278, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, lights);
-}
-
-void cornell_smoke(){
-    hittable_list world;
-
-    auto red = make_shared<lambertian>(color(0.65, .05, .05));
-    auto white = make_shared<lambertian>(color(0.73, .73, .73));
-    auto green = make_shared<lambertian>(color(0.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-    world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
-    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
-
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-    world.add(make_shared<constant_medium>(box1, 0.01, color(0, 0, 0)));
-
-    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-    world.add(make_shared<constant_medium>(box2, 0.01, color(1, 1, 1)));
-
-    world.add(box(point3(265, 0, 295), point3(430, 330, 460), white));
-
-    world = hittable_list(make_shared<bvh_node>(world));
-
-    camera cam("images\\image9.ppm");
-    cam.aspect_ratio = 1;
-    cam.image_width = 600;
-    cam.samples_per_pixel = 200;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat = point3(278, 278, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, world);
-}
-
-void final_scene(int image_width, int samples_per_pixel, int max_depth){
-    hittable_list boxes1;
-    auto ground = make_shared<lambertian>(color(.48, .83, .53));
-
-    int boxes_per_side = 20;
-    for(int i = 0; i < boxes_per_side; ++i){
-        for(int j = 0; j < boxes_per_side; ++j){
-            auto w = 100.0;
-            auto x0 = -1000 + i * w;
-            auto z0 = -1000 + j * w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = random_double(1, 101);
-            auto z1 = z0 + w;
-
-            boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+bool parse_options(int argc, char* argv[], options& opt){
+    for(int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        if(arg.rfind("--", 0) == 0){
+            if(i + 1 >= argc){
+                std::cerr << "ERROR: " << arg << " needs a value.\n";
+                return false;
+            }
+            std::string value = argv[++i];
+            char* end = nullptr;
+            long n = std::strtol(value.c_str(), &end, 10);
+            bool number = !value.empty() && *end == '\0';
+
+            if(arg == "--output"){
+                opt.output = value;
+                continue;
+            }
+            int* target = arg == "--width" ? &opt.width
+                        : arg == "--spp" ? &opt.spp
+                        : arg == "--depth" ? &opt.depth
+                        : arg == "--threads" ? &opt.threads
+                        : arg == "--denoise" ? &opt.denoise
+                        : arg == "--aovs" ? &opt.aovs
+                        : nullptr;
+            if(!target){
+                std::cerr << "ERROR: unknown option " << arg << ".\n";
+                return false;
+            }
+            if(!number || n < 0){
+                std::cerr << "ERROR: " << arg << " needs a whole number, not '" << value << "'.\n";
+                return false;
+            }
+            *target = static_cast<int>(n);
+            continue;
         }
-    }
-
-    hittable_list world;
-
-    world.add(make_shared<bvh_node>(boxes1));
-
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-    world.add(make_shared<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
 
-    auto center1 = point3(400, 400, 200);
-    auto center2 = center1 + vec3(30, 0, 0);
-    auto sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
-    world.add(make_shared<sphere>(center1, center2, 50, sphere_material));
-
-    world.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-    world.add(make_shared<sphere>(point3(0, 150, 145), 50, make_shared<metal>(color(.8, .8, .8), 1.0)));
-
-    auto boundary = make_shared<sphere>(point3(360, 150, 145), 70, make_shared<dielectric>(1.5));
-    world.add(boundary);
-    world.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-    
-    boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-    world.add(make_shared<constant_medium>(boundary, 0.0001, color(1, 1, 1)));
-
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-    world.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
-
-    auto pertext = make_shared<noise_texture>(0.1);
-    world.add(make_shared<sphere>(point3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
-
-    hittable_list boxes2;
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    int ns = 1000;
-    for(int j = 0; j < ns; ++j){
-        boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
+        char* end = nullptr;
+        long n = std::strtol(arg.c_str(), &end, 10);
+        if(!arg.empty() && *end == '\0'){
+            opt.number = static_cast<int>(n);
+        }else{
+            opt.scene_path = arg;
+        }
     }
-
-    world.add(make_shared<translate>(make_shared<rotate_y>(make_shared<bvh_node>(boxes2), 15), vec3(-100, 270, 395)));
-
-    camera cam("images\\image10.ppm");
-    cam.aspect_ratio = 1.0;
-    cam.image_width = image_width;
-    cam.samples_per_pixel = samples_per_pixel;
-    cam.max_depth = max_depth;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 40;
-    cam.lookfrom = point3(478, 278, -600);
-    cam.lookat = point3(278, 278, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world, world);
+    return true;
 }
 
-int main(){
-    switch(11){
-        case 1: the_trio(); break; // book 1
-        case 2: fun_balls(); break;
+int main(int argc, char* argv[]){
+    options opt;
+    if(!parse_options(argc, argv, opt)){
+        usage();
+        return 1;
+    }
 
-        case 3: two_balls(); break; // book 2
-        case 4: earth(); break;
-        case 5: two_perlin_spheres(); break;
-        case 6: quads(); break;
-        case 7: simple_light(); break;
-        case 8: cornell_box("image8.ppm"); break;
-        case 9: cornell_smoke(); break;
-        case 10: final_scene(800, 1000, 40); break;
+    if(!opt.scene_path.empty()){
+        scene sc;
+        if(!scene_file::load(opt.scene_path, sc)){
+            return 1;
+        }
+        opt.apply(sc.cam);
+        sc.render();
+        return 0;
+    }
 
-        case 11: cornell_box("image1.ppm"); break; // book3
+    auto render = [&](scene sc){
+        opt.apply(sc.cam);
+        sc.render();
+    };
+
+    switch(opt.number){
+        case 1: render(the_trio()); break; // book 1
+        case 2: render(fun_balls()); break;
+
+        case 3: render(two_balls()); break; // book 2
+        case 4: render(earth()); break;
+        case 5: render(two_perlin_spheres()); break;
+        case 6: render(quads()); break;
+        case 7: render(simple_light()); break;
+        case 8: render(cornell_box("image8.ppm")); break;
+        case 9: render(cornell_smoke()); break;
+        case 10: { // hours long, so it renders in passes and can be killed and resumed
+            scene sc = final_scene(800, 1000, 40, "images\\image10.cache");
+            sc.cam.pass_samples = 50;
+            sc.cam.checkpoint_file = "images\\image10.checkpoint";
+            render(sc);
+        } break;
+
+        case 11: render(cornell_box("image1.ppm")); break; // book3
+
+        case 12: render(cluster_field()); break;
+
+        case 100: bench_rng(); break; // benchmarks
+        case 101: bench_bvh(); break;
+        case 102: bench_bvh_build(); break;
+        case 103: bench_box(); break;
+        case 104: bench_packets(); break;
+        case 105: bench_allocations(); break;
+        case 106: bench_roulette(); break;
+        case 107: bench_adaptive(); break;
+        case 108: bench_image_io(); break;
+        case 109: bench_precision(); break;
+        case 110: bench_sphere_set(); break;
+        case 111: bench_mesh(); break;
+        case 112: bench_scene_cache(); break;
+        case 113: bench_instances(); break;
+        case 114: bench_lights(); break;
+        case 115: bench_next_event(); break;
+        case 116: bench_samplers(); break;
+        case 117: bench_denoiser(); break;
+        case 118: bench_textures(); break;
+        case 119: bench_noise(); break;
+        case 120: bench_fog(); break;
+
+        default:
+            std::cerr << "ERROR: no scene or benchmark " << opt.number << ".\n";
+            usage();
+            return 1;
     }
 
     return 0;
 }
 
-// TODO: check why perlin noise is different from example!!
\ No newline at end of file
+// TODO: check why perlin noise is different from example!!
@@ -8,25 +8,38 @@
 #include "onb.h"
 #include "pdf.h"
 
+#include <variant>
+
+// the material pdf lives inside the record, so scattering never touches the heap
 class scatter_record{
 public:
     color attenuation;
-    shared_ptr<pdf> pdf_ptr;
+    std::variant<std::monostate, cosine_pdf, sphere_pdf> scatter_pdf;
     bool skip_pdf;
     ray skip_pdf_ray;
+
+    const pdf& get_pdf() const {
+        if(auto cosine = std::get_if<cosine_pdf>(&scatter_pdf)) return *cosine;
+        return std::get<sphere_pdf>(scatter_pdf);
+    }
 };
 
 class material{
 public:
     virtual ~material() = default;
 
-    virtual color emitted(const ray& r_in, const hit_record& rec, double u, double v, const point3& p) const {
+    virtual color emitted(const ray& r_in, const hit_record& rec, real u, real v, const point3& p) const {
+        return color(0, 0, 0);
+    }
+
+    // rough average of emitted(), light sampling picks lights by it
+    virtual color emission() const {
         return color(0, 0, 0);
     }
 
     virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const = 0;
 
-    virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+    virtual real scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
         return 0;
     }
 };
@@ -39,58 +52,68 @@ public:
 
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
-        srec.attenuation = albedo->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+        srec.attenuation = albedo->filtered_value(rec);
+        srec.scatter_pdf = cosine_pdf(rec.normal);
         srec.skip_pdf = false;
         return true;
     }
 
-    double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
-        double cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
+    real scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+        real cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
         return cos_theta < 0 ? 0 : cos_theta / pi;
     }
 
+    shared_ptr<texture> get_albedo() const {
+        return albedo;
+    }
+
 private:
     shared_ptr<texture> albedo; 
 };
 
 class metal : public material {
 public:
-    metal(const color& a, double f)  : albedo(a), fuzz(f < 1 ? f : 1) {}
+    metal(const color& a, real f)  : albedo(a), fuzz(f < 1 ? f : 1) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = albedo;
-        srec.pdf_ptr = nullptr;
         srec.skip_pdf = true;
         vec3 reflected = reflect(r_in.direction(), rec.normal);
         srec.skip_pdf_ray = ray(rec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time());
         return true;
     }
 
+    const color& get_albedo() const {
+        return albedo;
+    }
+
+    real get_fuzz() const {
+        return fuzz;
+    }
+
 private:
     color albedo;
-    double fuzz;
+    real fuzz;
 };
 
 class dielectric : public material {
 public:
-    dielectric(double index_of_refraction) : ir(index_of_refraction){}
+    dielectric(real index_of_refraction) : ir(index_of_refraction){}
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = color(1.0, 1.0, 1.0);
-        srec.pdf_ptr = nullptr;
         srec.skip_pdf = true;
 
-        double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
+        real refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
         
         vec3 unit_direction = unit_vector(r_in.direction());
-        double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-        double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+        real cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+        real sin_theta = sqrt(1.0 - cos_theta * cos_theta);
 
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
         vec3 direction;
 
-        if(cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double()){
+        if(cannot_refract || reflectance(cos_theta, refraction_ratio) > sample_1d()){
             direction = reflect(unit_direction, rec.normal);
         }else{
             direction = refract(unit_direction, rec.normal, refraction_ratio);
@@ -99,12 +122,17 @@ public:
         srec.skip_pdf_ray = ray(rec.p, direction, r_in.time());
         return true;
     }
+
+    real get_ir() const {
+        return ir;
+    }
+
 private:
-    double ir;
+    real ir;
 
-    static double reflectance(double cosine, double ref_index){
+    static real reflectance(real cosine, real ref_index){
         // Schlick's approximation for reflectance.
-        double r0 = (1 - ref_index) / (1 + ref_index);
+        real r0 = (1 - ref_index) / (1 + ref_index);
         r0 *= r0;
         return r0 + (1- r0) * pow(1 - cosine, 5);
     }
@@ -119,12 +147,21 @@ public:
         return false;
     }
 
-    color emitted(const ray& r_in, const hit_record& rec, double u, double v, const point3& p) const override {
+    color emitted(const ray& r_in, const hit_record& rec, real u, real v, const point3& p) const override {
         if(!rec.front_face)
             return color(0, 0, 0);
         return emit->value(u, v, p);
     }
 
+    // the middle of the texture, exact for solid colors
+    color emission() const override {
+        return emit->value(0.5, 0.5, point3(0, 0, 0));
+    }
+
+    shared_ptr<texture> get_emit() const {
+        return emit;
+    }
+
 private:
     shared_ptr<texture> emit;
 };
@@ -135,16 +172,20 @@ public:
     isotropic(shared_ptr<texture> a) : albedo(a) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
-        srec.attenuation = albedo->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<sphere_pdf>();
+        srec.attenuation = albedo->filtered_value(rec);
+        srec.scatter_pdf = sphere_pdf();
         srec.skip_pdf = false;
         return true;
     }
 
-    double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+    real scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
         return 1 / (4 * pi);
     }
 
+    shared_ptr<texture> get_albedo() const {
+        return albedo;
+    }
+
 private:
     shared_ptr<texture> albedo;
 }; 
@@ -9,7 +9,7 @@ class pdf {
 public:
     virtual ~pdf() {}
     
-    virtual double value(const vec3& direction) const = 0;
+    virtual real value(const vec3& direction) const = 0;
     virtual vec3 generate() const = 0;
 };
 
@@ -17,12 +17,12 @@ class sphere_pdf : public pdf {
 public:
     sphere_pdf() {}
 
-    double value(const vec3& direction) const override {
+    real value(const vec3& direction) const override {
         return 1 / (4 * pi);
     }
 
     vec3 generate() const override {
-        return random_unit_vector();
+        return sample_unit_vector();
     }
 };
 
@@ -33,8 +33,8 @@ public:
         uvw.build_from_w(w);
     }
 
-    double value(const vec3& direction) const override {
-        double cosine_theta = dot(unit_vector(direction), uvw.w());
+    real value(const vec3& direction) const override {
+        real cosine_theta = dot(unit_vector(direction), uvw.w());
         return fmax(0, cosine_theta / pi);
     }
 
@@ -46,12 +46,13 @@ private:
     onb uvw;
 };
 
+// a pdf built on the stack for one bounce, holds a reference to objects
 class hittable_pdf : public pdf {
 public:
     hittable_pdf(const hittable& _objects, const point3& _origin)
         : objects(_objects), origin(_origin) {}
 
-    double value(const vec3& direction) const override {
+    real value(const vec3& direction) const override {
         return objects.pdf_value(origin, direction);
     }
 
@@ -64,19 +65,20 @@ private:
     point3 origin;
 };
 
+// borrows both pdfs, they have to outlive the mixture
 class mixture_pdf : public pdf {
 public:
-    mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1){
-        p[0] = p0;
-        p[1] = p1;
+    mixture_pdf(const pdf& p0, const pdf& p1){
+        p[0] = &p0;
+        p[1] = &p1;
     }
 
-    double value(const vec3& direction) const override {
+    real value(const vec3& direction) const override {
         return 0.5 * p[0]->value(direction) + 0.5 * p[1]->value(direction); 
     }
 
     vec3 generate() const override {
-        if(random_double() < 0.5){
+        if(sample_1d() < 0.5){
             return p[0]->generate();
         }else{
             return p[1]->generate();
@@ -84,7 +86,7 @@ public:
     }
 
 private:
-    shared_ptr<pdf> p[2];
+    const pdf* p[2];
 };
 
 #endif
\ No newline at end of file
@@ -3,30 +3,55 @@
 
 #include "blines.h"
 
+#include "aabb.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <vector>
+
 class perlin {
 public:
     perlin(){
-        ranvec = new vec3[point_count];
+        vec3* gradients = new vec3[point_count];
         for(int i = 0; i < point_count; ++i){
-            ranvec[i] = unit_vector(vec3::random(-1, 1));
+            gradients[i] = unit_vector(vec3::random(-1, 1));
         }
+        ranvec = gradients;
 
         perm_x = perlin_generate_perm();
         perm_y = perlin_generate_perm();
         perm_z = perlin_generate_perm();
     }
 
+    // a view of the tables of another perlin, so a saved texture comes back with the same noise
+    // they are not copied and have to outlive it
+    perlin(const vec3* _ranvec, const int* _perm_x, const int* _perm_y, const int* _perm_z)
+        : ranvec(_ranvec), perm_x(_perm_x), perm_y(_perm_y), perm_z(_perm_z), owned(false) {}
+
+    // copies the tables, also of a view
+    perlin(const perlin& other)
+        : ranvec(copy_table(other.ranvec)), perm_x(copy_table(other.perm_x)),
+          perm_y(copy_table(other.perm_y)), perm_z(copy_table(other.perm_z)) {}
+    // takes the tables over, a view stays a view
+    perlin(perlin&& other)
+        : ranvec(other.ranvec), perm_x(other.perm_x), perm_y(other.perm_y), perm_z(other.perm_z), owned(other.owned) {
+        other.owned = false;
+    }
+    perlin& operator=(const perlin&) = delete;
+
     ~perlin(){
+        if(!owned) return;
         delete[] ranvec;
         delete[] perm_x;
         delete[] perm_y;
         delete[] perm_z;
     }
 
-    double noise(const point3& p) const {
-        double u = p.x() - floor(p.x());
-        double v = p.y() - floor(p.y());
-        double w = p.z() - floor(p.z());
+    real noise(const point3& p) const {
+        real u = p.x() - floor(p.x());
+        real v = p.y() - floor(p.y());
+        real w = p.z() - floor(p.z());
 
         int i = static_cast<int>(floor(p.x()));
         int j = static_cast<int>(floor(p.y()));
@@ -48,10 +73,21 @@ public:
         return perlin_interp(c, u, v, w);
     }
 
-    double turb(const point3& p, int depth=7) const {
-        double accum = 0.0;
+    // the octaves side by side, vreal_width of them at once
+    real turb(const point3& p, int depth=7) const {
+        real accum = 0.0;
+        for(int first = 0; first < depth; first += vreal_width){
+            accum += octaves(p, first, std::min(vreal_width, depth - first));
+        }
+
+        return fabs(accum);
+    }
+
+    // one octave after the other, what turb was before it went wide
+    real turb_scalar(const point3& p, int depth=7) const {
+        real accum = 0.0;
         point3 temp_p = p;
-        double weight = 1.0;
+        real weight = 1.0;
 
         for(int i = 0; i < depth; ++i){
             accum += weight * noise(temp_p);
@@ -62,12 +98,102 @@ public:
         return fabs(accum);
     }
 
-private:
     static const int point_count = 256;
-    vec3* ranvec;
-    int* perm_x;
-    int* perm_y;
-    int* perm_z;
+
+    // the tables, point_count entries each, what the second constructor takes
+    const vec3* get_ranvec() const {
+        return ranvec;
+    }
+
+    const int* get_perm_x() const {
+        return perm_x;
+    }
+
+    const int* get_perm_y() const {
+        return perm_y;
+    }
+
+    const int* get_perm_z() const {
+        return perm_z;
+    }
+
+private:
+
+    const vec3* ranvec;
+    const int* perm_x;
+    const int* perm_y;
+    const int* perm_z;
+    bool owned = true;
+
+    template<typename T>
+    static const T* copy_table(const T* table){
+        T* copy = new T[point_count];
+        std::copy(table, table + point_count, copy);
+        return copy;
+    }
+
+    // octaves [first, first + count) of turb in the lanes, the lanes past count are left out of the sum
+    // three pairs of permutation lookups give the gradients of all eight corners, everything is vector code
+    real octaves(const point3& p, int first, int count) const {
+        // 2^o and 2^-o for octave o, constant so the loads don't wait on stores
+        static const struct powers {
+            real scale[32], weight[32];
+            powers(){
+                for(int o = 0; o < 32; ++o){
+                    scale[o] = static_cast<real>(1u << o);
+                    weight[o] = 1 / scale[o];
+                }
+            }
+        } pow2;
+
+        vreal s = vr_load(pow2.scale + first);
+        vreal x = vr_mul(vr_set(p.x()), s);
+        vreal y = vr_mul(vr_set(p.y()), s);
+        vreal z = vr_mul(vr_set(p.z()), s);
+        vreal fx = vr_floor(x), fy = vr_floor(y), fz = vr_floor(z);
+
+        // corner c is (c >> 2, c >> 1 & 1, c & 1) from the cell's low corner, its gradient is
+        // ranvec[perm_x[i + c >> 2] ^ perm_y[j + (c >> 1 & 1)] ^ perm_z[k + (c & 1)]]
+        const vint mask = vi_set(255), next = vi_set(1);
+        vint i = vi_from_real(fx), j = vi_from_real(fy), k = vi_from_real(fz);
+        vint px[2] = {vi_gather(perm_x, vi_and(i, mask)), vi_gather(perm_x, vi_and(vi_add(i, next), mask))};
+        vint py[2] = {vi_gather(perm_y, vi_and(j, mask)), vi_gather(perm_y, vi_and(vi_add(j, next), mask))};
+        vint pz[2] = {vi_gather(perm_z, vi_and(k, mask)), vi_gather(perm_z, vi_and(vi_add(k, next), mask))};
+
+        const vreal one = vr_set(1);
+        vreal u[2] = {vr_sub(x, fx), vr_sub(vr_sub(x, fx), one)};
+        vreal v[2] = {vr_sub(y, fy), vr_sub(vr_sub(y, fy), one)};
+        vreal w[2] = {vr_sub(z, fz), vr_sub(vr_sub(z, fz), one)};
+
+        // the components of a gradient are 3 reals apart
+        const real* grads = ranvec[0].e;
+        vreal d[8];
+        for(int c = 0; c < 8; ++c){
+            vint h = vi_xor(vi_xor(px[c >> 2], py[(c >> 1) & 1]), pz[c & 1]);
+            h = vi_add(vi_add(h, h), h);
+            d[c] = vr_add(vr_add(vr_mul(vr_gather(grads, h), u[c >> 2]), vr_mul(vr_gather(grads + 1, h), v[(c >> 1) & 1])),
+                          vr_mul(vr_gather(grads + 2, h), w[c & 1]));
+        }
+
+        vreal uu = fade(u[0]), vv = fade(v[0]), ww = fade(w[0]);
+        vreal n = lerp(lerp(lerp(d[0], d[1], ww), lerp(d[2], d[3], ww), vv),
+                       lerp(lerp(d[4], d[5], ww), lerp(d[6], d[7], ww), vv), uu);
+
+        real lanes[vreal_width];
+        vr_store(lanes, vr_mul(n, vr_load(pow2.weight + first)));
+        real sum = 0;
+        for(int l = 0; l < count; ++l) sum += lanes[l];
+        return sum;
+    }
+
+    // t * t * (3 - 2 * t)
+    static vreal fade(vreal t){
+        return vr_mul(vr_mul(t, t), vr_sub(vr_set(3), vr_add(t, t)));
+    }
+
+    static vreal lerp(vreal a, vreal b, vreal t){
+        return vr_add(a, vr_mul(t, vr_sub(b, a)));
+    }
 
     static int* perlin_generate_perm(){
         int* p = new int[point_count];
@@ -88,11 +214,11 @@ private:
         }
     }
 
-    static double perlin_interp(vec3 c[2][2][2], double u, double v, double w){
-        double uu = u * u * (3 - 2 * u);
-        double vv = v * v * (3 - 2 * v);
-        double ww = w * w * (3 - 2 * w);
-        double accum = 0.0;
+    static real perlin_interp(vec3 c[2][2][2], real u, real v, real w){
+        real uu = u * u * (3 - 2 * u);
+        real vv = v * v * (3 - 2 * v);
+        real ww = w * w * (3 - 2 * w);
+        real accum = 0.0;
 
         for(int i = 0; i < 2; ++i){
             for(int j = 0; j < 2; ++j){
@@ -110,4 +236,104 @@ private:
     }
 };
 
+// turb sampled on a grid of cubes over a box and looked up trilinearly, for textures that ask for it
+// many times over a small part of space; octaves finer than a cell come out blurred, they weigh little
+class turbulence_volume {
+public:
+    // resolution cells along the longest side of bounds, the samples are built on every hardware thread
+    turbulence_volume(const perlin& noise, const aabb& bounds, int resolution, int depth = 7) {
+        owned.resize(layout(bounds, resolution));
+        float* samples = owned.data();
+        thread_pool pool;
+        pool.parallel_for(cells[2] + 1, [&](int k, int){
+            for(int j = 0; j <= cells[1]; ++j){
+                for(int i = 0; i <= cells[0]; ++i){
+                    point3 p(low[0] + i * step, low[1] + j * step, low[2] + k * step);
+                    samples[index(i, j, k)] = static_cast<float>(noise.turb(p, depth));
+                }
+            }
+        });
+        mapped = samples;
+    }
+
+    // a view of the samples (get_samples) of a volume made with the same bounds and resolution,
+    // they are not copied and have to outlive it
+    turbulence_volume(const float* samples, const aabb& bounds, int resolution) {
+        layout(bounds, resolution);
+        mapped = samples;
+    }
+
+    turbulence_volume(const turbulence_volume&) = delete;
+    turbulence_volume& operator=(const turbulence_volume&) = delete;
+
+    bool contains(const point3& p) const {
+        for(int a = 0; a < 3; ++a){
+            real x = (p[a] - low[a]) * inv_step;
+            if(!(x >= 0 && x <= cells[a])) return false;
+        }
+        return true;
+    }
+
+    // only inside contains()
+    real value(const point3& p) const {
+        int c[3];
+        real f[3];
+        for(int a = 0; a < 3; ++a){
+            real x = (p[a] - low[a]) * inv_step;
+            c[a] = std::min(static_cast<int>(x), cells[a] - 1);
+            f[a] = x - c[a];
+        }
+
+        size_t s = index(c[0], c[1], c[2]);
+        size_t dy = cells[0] + 1;
+        size_t dz = dy * (cells[1] + 1);
+        const float* samples = mapped;
+        auto along_x = [&](size_t q){
+            return samples[q] + f[0] * (samples[q + 1] - samples[q]);
+        };
+        real y0 = along_x(s) + f[1] * (along_x(s + dy) - along_x(s));
+        real y1 = along_x(s + dz) + f[1] * (along_x(s + dz + dy) - along_x(s + dz));
+        return y0 + f[2] * (y1 - y0);
+    }
+
+    size_t memory() const {
+        return sample_count() * sizeof(float);
+    }
+
+    // the corners of the cells, x fastest
+    const float* get_samples() const {
+        return mapped;
+    }
+
+    size_t sample_count() const {
+        return static_cast<size_t>(cells[0] + 1) * (cells[1] + 1) * (cells[2] + 1);
+    }
+
+private:
+    real low[3];
+    real step, inv_step;
+    int cells[3];
+    std::vector<float> owned;
+    const float* mapped = nullptr; // owned's data or someone else's
+
+    // the grid of resolution cells along the longest side of bounds, returns how many samples it takes
+    size_t layout(const aabb& bounds, int resolution){
+        real longest = 0;
+        for(int a = 0; a < 3; ++a){
+            longest = std::max(longest, bounds.axis(a).size());
+        }
+        step = longest / std::max(resolution, 1);
+        inv_step = 1 / step;
+        for(int a = 0; a < 3; ++a){
+            low[a] = bounds.axis(a).min;
+            cells[a] = std::max(1, static_cast<int>(ceil(bounds.axis(a).size() * inv_step)));
+        }
+        return sample_count();
+    }
+
+    size_t index(int i, int j, int k) const {
+        return (static_cast<size_t>(k) * (cells[1] + 1) + j) * (cells[0] + 1) + i;
+    }
+};
+
 #endif
@@ -3,6 +3,7 @@
 
 #include "blines.h"
 #include "hittable.h"
+#include "material.h"
 
 class quad : public hittable {
 public:
@@ -28,33 +29,64 @@ public:
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        double denom = dot(normal, r.direction());
-        
-        if(fabs(denom) < 1e-8)
+        real t, alpha, beta;
+        if(!hit_plane(r, ray_t, Q, u, v, normal, D, w, t, alpha, beta) || !is_interior(alpha, beta, rec))
             return false;
 
-        double t = (D - dot(normal, r.origin())) / denom;
-        if(!ray_t.contains(t))
-            return false;
+        set_record(r, t, u, v, normal, mat.get(), rec);
+        return true;
+    }
+
+    uint32_t hit_packet(ray_lanes& rays, uint32_t active) const override {
+        real ts[32], alphas[32], betas[32];
+        bool found[32];
+
+        // plane intersection for every lane, the interior test is virtual so it stays per lane below
+        for(int k = 0; k < rays.n; ++k){
+            real ox = rays.orig[0][k], oy = rays.orig[1][k], oz = rays.orig[2][k];
+            real dx = rays.dir[0][k], dy = rays.dir[1][k], dz = rays.dir[2][k];
+
+            real denom = normal[0] * dx + normal[1] * dy + normal[2] * dz;
+            real t = (D - (normal[0] * ox + normal[1] * oy + normal[2] * oz)) / denom;
+
+            real px = ox + t * dx - Q[0];
+            real py = oy + t * dy - Q[1];
+            real pz = oz + t * dz - Q[2];
+
+            // dot(w, cross(p, v)) and dot(w, cross(u, p))
+            alphas[k] = w[0] * (py * v[2] - pz * v[1]) + w[1] * (pz * v[0] - px * v[2]) + w[2] * (px * v[1] - py * v[0]);
+            betas[k] = w[0] * (u[1] * pz - u[2] * py) + w[1] * (u[2] * px - u[0] * pz) + w[2] * (u[0] * py - u[1] * px);
+            ts[k] = t;
+            found[k] = fabs(denom) >= 1e-8 && t >= rays.tmin && t <= rays.tmax[k];
+        }
+
+        uint32_t hits = 0;
+        for(int k = 0; k < rays.n; ++k){
+            if(!found[k] || !(active & (1u << k))) continue;
 
-        point3 intersection = r.at(t);
-        vec3 planat_hit_pt_vector = intersection - Q;
-        double alpha = dot(w, cross(planat_hit_pt_vector, v));
-        double beta = dot(w, cross(u, planat_hit_pt_vector));
-        
-        if(!is_interior(alpha, beta, rec))
+            hit_record& rec = rays.recs[k];
+            if(!is_interior(alphas[k], betas[k], rec)) continue;
+
+            set_record(rays.get(k), ts[k], u, v, normal, mat.get(), rec);
+            rays.tmax[k] = ts[k];
+            hits |= 1u << k;
+        }
+        return hits;
+    }
+
+    // a plane is crossed once, the record is only for is_interior
+    bool entry_exit(const ray& r, interval& inside) const override {
+        real t, alpha, beta;
+        hit_record rec;
+        if(!hit_plane(r, interval::universe, Q, u, v, normal, D, w, t, alpha, beta) || !is_interior(alpha, beta, rec))
             return false;
 
-        rec.t = t;
-        rec.p = intersection;
-        rec.mat = mat;
-        rec.set_face_normal(r, normal);
-    
+        inside = interval(t, t);
         return true;
     }
 
-    virtual bool is_interior(double a, double b, hit_record& rec) const {
-        if((a < 0) || (a > 1) || (b < 0) || (b > 1))
+    virtual bool is_interior(real a, real b, hit_record& rec) const {
+        if(!in_unit_square(a, b))
             return false;
 
         rec.u = a;
@@ -62,32 +94,90 @@ public:
         return true;
     }
 
-    double pdf_value(const point3& origin, const vec3& v) const override {
+    real pdf_value(const point3& origin, const vec3& v) const override {
         hit_record rec;
         if(!this->hit(ray(origin, v), interval(0.001, infinity), rec)){
             return 0;
         }
 
-        double distance_squared = rec.t * rec.t * v.length_squared();
-        double cosine = fabs(dot(v, rec.normal)) / v.length();
+        real distance_squared = rec.t * rec.t * v.length_squared();
+        real cosine = fabs(dot(v, rec.normal)) / v.length();
 
         return distance_squared / (cosine * area);
     }
 
     vec3 random(const point3& origin) const override {
-        point3 p = Q + (random_double() * u ) + (random_double() * v);
+        sample2 s = sample_2d();
+        point3 p = Q + (s.x * u) + (s.y * v);
         return p - origin;
     }
 
+    // diffuse_light only shines from the front
+    real power() const override {
+        return mat ? luminance(mat->emission()) * area * pi : 0;
+    }
+
+    // the kernels below are what every quad is hit with, the scene cache's too
+    // normal, D and w are the ones the constructor works out from Q, u and v
+
+    // where r crosses the plane inside ray_t, and the crossing along u and v as alpha and beta
+    static bool hit_plane(const ray& r, interval ray_t, const point3& Q, const vec3& u, const vec3& v,
+                          const vec3& normal, real D, const vec3& w, real& t, real& alpha, real& beta){
+        real denom = dot(normal, r.direction());
+        if(fabs(denom) < 1e-8)
+            return false;
+
+        t = (D - dot(normal, r.origin())) / denom;
+        if(!ray_t.contains(t))
+            return false;
+
+        vec3 planar_hit_pt_vector = r.at(t) - Q;
+        alpha = dot(w, cross(planar_hit_pt_vector, v));
+        beta = dot(w, cross(u, planar_hit_pt_vector));
+        return true;
+    }
+
+    // the crossings is_interior takes for a plain quad
+    static bool in_unit_square(real alpha, real beta){
+        return alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1;
+    }
+
+    // everything but the uv, which is_interior sets
+    static void set_record(const ray& r, real t, const vec3& u, const vec3& v, const vec3& normal,
+                           const material* mat, hit_record& rec){
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.mat = mat;
+        rec.set_face_normal(r, normal);
+        rec.dpdu = u;
+        rec.dpdv = v;
+    }
+
+    const point3& get_Q() const {
+        return Q;
+    }
+
+    const vec3& get_u() const {
+        return u;
+    }
+
+    const vec3& get_v() const {
+        return v;
+    }
+
+    shared_ptr<material> get_material() const {
+        return mat;
+    }
+
 private:
     point3 Q;
     vec3 u, v;
     shared_ptr<material> mat;
     aabb bbox;
     vec3 normal;
-    double D;
+    real D;
     vec3 w;
-    double area;
+    real area;
 };
 
 inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<material> mat){
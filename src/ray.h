@@ -6,7 +6,7 @@
 class ray{
 public:
     ray(){}
-    ray(const point3& origin, const vec3& direction, double time = 0.0) : orig(origin), dir(direction), tm(time) {}
+    ray(const point3& origin, const vec3& direction, real time = 0.0) : orig(origin), dir(direction), tm(time) {}
 
     point3 origin() const {
         return orig;
@@ -14,18 +14,38 @@ public:
     vec3 direction() const {
         return dir;
     }
-    double time() const {
+    real time() const {
         return tm;
     }
 
-    point3 at(double t) const {
+    point3 at(real t) const {
         return orig + t * dir;
     }
 
 private:
     point3 orig;
     vec3 dir;
-    double tm;
+    real tm;
+};
+
+// a camera ray with the rays through the same spot of the next pixel right and down (Igehy 1999),
+// where they meet the first hit is the footprint of the pixel there, see camera::set_uv_derivatives
+class ray_differential : public ray {
+public:
+    ray_differential(){}
+    ray_differential(const ray& r) : ray(r) {}
+
+    bool has_differentials = false;
+    point3 rx_origin, ry_origin;
+    vec3 rx_direction, ry_direction;
+
+    // moves the neighbours s of the way from the ray, for when several samples already spread over the pixel
+    void scale_differentials(real s){
+        rx_origin = origin() + s * (rx_origin - origin());
+        ry_origin = origin() + s * (ry_origin - origin());
+        rx_direction = direction() + s * (rx_direction - direction());
+        ry_direction = direction() + s * (ry_direction - direction());
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,188 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+// included by blines.h, after the generator
+
+// where the numbers of a render come from, every pixel sample is a point in many dimensions
+// and every dimension (one 1d or one 2d draw) gets its own stream:
+//   random  independent numbers from thread_generator, plain monte carlo
+//   cmj     correlated multi-jittered (Kensler 2013), stratified in 2d and in each of x and y,
+//           needs samples_per_pixel up front
+//   sobol   the first two sobol dimensions with hash based owen scrambling (Burley 2020),
+//           the index shuffled per dimension so dimensions don't line up, progressive in the index
+// the camera starts every sample with start_sample() and puts every bounce at its own dimension
+// with set_sample_dimension(), so the same decision of different samples draws from the same stream
+// outside a render sample_1d() and sample_2d() are just random_double()
+enum class sampler_kind {
+    random,
+    cmj,
+    sobol
+};
+
+struct sample2 {
+    double x;
+    double y;
+};
+
+struct sample_stream {
+    sampler_kind kind = sampler_kind::random;
+    uint32_t seed = 0;     // of the pixel
+    uint32_t index = 0;    // of the sample in its pixel
+    uint32_t count = 1;    // samples in the pixel, for cmj
+    uint32_t dimension = 0;
+};
+
+inline thread_local sample_stream thread_samples;
+
+inline void start_sample(sampler_kind kind, uint64_t seed, uint64_t pixel, uint32_t index, uint32_t count){
+    thread_samples.kind = kind;
+    thread_samples.seed = static_cast<uint32_t>(splitmix64(seed ^ splitmix64(pixel)));
+    thread_samples.index = index;
+    thread_samples.count = count;
+    thread_samples.dimension = 0;
+}
+
+// back to plain random numbers, once the render is done
+inline void stop_sampling(){
+    thread_samples.kind = sampler_kind::random;
+}
+
+inline void set_sample_dimension(uint32_t dimension){
+    thread_samples.dimension = dimension;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v){
+    return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+inline uint32_t hash_u32(uint32_t x){
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t reverse_bits(uint32_t x){
+    x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+    x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fU) | ((x & 0x0f0f0f0fU) << 4);
+    x = ((x >> 8) & 0x00ff00ffU) | ((x & 0x00ff00ffU) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// a random permutation of the bits that only lets each bit depend on the bits below it (Laine and Karras),
+// reversed around it that is an owen scramble, each bit flipped depending on the bits above it
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed){
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cU;
+    x ^= x * 0xb82f1e52U;
+    x ^= x * 0xc7afe638U;
+    x ^= x * 0x8d22f6e6U;
+    return reverse_bits(x);
+}
+
+// the first sobol dimension is the van der corput sequence, the second comes from its direction numbers
+inline uint32_t sobol_0(uint32_t index){
+    return reverse_bits(index);
+}
+
+inline uint32_t sobol_1(uint32_t index){
+    uint32_t x = 0;
+    for(uint32_t v = 1U << 31; index; index >>= 1, v ^= v >> 1){
+        if(index & 1) x ^= v;
+    }
+    return x;
+}
+
+// [0, 1) from the top 32 bits, never rounds up to 1
+inline double to_unit(uint32_t x){
+    return x * 0x1p-32;
+}
+
+// Kensler's hashed permutation of [0, l) picked by p
+inline uint32_t cmj_permute(uint32_t i, uint32_t l, uint32_t p){
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do{
+        i ^= p; i *= 0xe170893dU; i ^= p >> 16; i ^= (i & w) >> 4;
+        i ^= p >> 8; i *= 0x0929eb3fU; i ^= p >> 23; i ^= (i & w) >> 1;
+        i *= 1 | p >> 27; i *= 0x6935fa69U; i ^= (i & w) >> 11; i *= 0x74dcb303U;
+        i ^= (i & w) >> 2; i *= 0x9e501cc3U; i ^= (i & w) >> 2; i *= 0xc860a3dfU;
+        i &= w; i ^= i >> 5;
+    }while(i >= l);
+    return (i + p) % l;
+}
+
+inline double cmj_jitter(uint32_t i, uint32_t p){
+    i ^= p; i ^= i >> 17; i ^= i >> 10; i *= 0xb36534e5U;
+    i ^= i >> 12; i ^= i >> 21; i *= 0x93fc4795U; i ^= 0xdf6e307fU;
+    i ^= i >> 17; i *= 1 | p >> 18;
+    return to_unit(i);
+}
+
+// sample s of an m by n grid, jittered in its cell and in the stripes of x and y
+inline sample2 cmj_2d(uint32_t s, uint32_t count, uint32_t p){
+    uint32_t m = std::max<uint32_t>(1, static_cast<uint32_t>(std::sqrt(static_cast<double>(count))));
+    uint32_t n = (count + m - 1) / m;
+    // past count (a resumed render that raised the sample count) the pattern starts over with another p
+    p = hash_combine(p, s / count);
+    s = cmj_permute(s % count, count, p * 0x51633e2dU);
+
+    uint32_t sx = cmj_permute(s % m, m, p * 0xa511e9b3U);
+    uint32_t sy = cmj_permute(s / m, n, p * 0x63d83595U);
+    double jx = cmj_jitter(s, p * 0xa399d265U);
+    double jy = cmj_jitter(s, p * 0x711ad6a5U);
+    return {std::min((s % m + (sy + jx) / n) / m, 1 - 0x1p-53), std::min((s / m + (sx + jy) / m) / n, 1 - 0x1p-53)};
+}
+
+inline double cmj_1d(uint32_t s, uint32_t count, uint32_t p){
+    p = hash_combine(p, s / count);
+    s = cmj_permute(s % count, count, p * 0x51633e2dU);
+    return std::min((s + cmj_jitter(s, p * 0xa399d265U)) / count, 1 - 0x1p-53);
+}
+
+// the seed of the current dimension, moving on to the next one
+inline uint32_t next_dimension_seed(){
+    sample_stream& st = thread_samples;
+    return hash_u32(hash_combine(st.seed, hash_u32(st.dimension++)));
+}
+
+// [0, 1)
+inline double sample_1d(){
+    if(thread_samples.kind == sampler_kind::random){
+        return random_double();
+    }
+
+    uint32_t seed = next_dimension_seed();
+    uint32_t index = thread_samples.index;
+    if(thread_samples.kind == sampler_kind::cmj){
+        return cmj_1d(index, thread_samples.count, seed);
+    }
+    return to_unit(owen_scramble(sobol_0(owen_scramble(index, seed)), hash_combine(seed, 0x9e3779b9U)));
+}
+
+// [0, 1) squared
+inline sample2 sample_2d(){
+    if(thread_samples.kind == sampler_kind::random){
+        double x = random_double();
+        return {x, random_double()};
+    }
+
+    uint32_t seed = next_dimension_seed();
+    uint32_t index = thread_samples.index;
+    if(thread_samples.kind == sampler_kind::cmj){
+        return cmj_2d(index, thread_samples.count, seed);
+    }
+    uint32_t shuffled = owen_scramble(index, seed);
+    return {to_unit(owen_scramble(sobol_0(shuffled), hash_combine(seed, 0x9e3779b9U))),
+            to_unit(owen_scramble(sobol_1(shuffled), hash_combine(seed, 0x7f4a7c15U)))};
+}
+
+#endif
@@ -0,0 +1,1063 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "blines.h"
+
+#include "bvh.h"
+#include "constant_medium.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "light_list.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "texture.h"
+#include "triangle_mesh.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// read only view of a whole file, pages are read in when they are first touched
+class mapped_file {
+public:
+    mapped_file(const std::string& filename){
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER file_size;
+        if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(mapping == nullptr) return;
+        view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if(view != nullptr) bytes = static_cast<size_t>(file_size.QuadPart);
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if(fd < 0) return;
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size > 0){
+            void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if(p != MAP_FAILED){
+                view = p;
+                bytes = static_cast<size_t>(st.st_size);
+            }
+        }
+        close(fd); // the mapping keeps the file alive
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file(){
+#ifdef _WIN32
+        if(view != nullptr) UnmapViewOfFile(view);
+        if(mapping != nullptr) CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if(view != nullptr) munmap(view, bytes);
+#endif
+    }
+
+    bool valid() const {
+        return view != nullptr;
+    }
+
+    const unsigned char* data() const {
+        return static_cast<const unsigned char*>(view);
+    }
+
+    size_t size() const {
+        return bytes;
+    }
+
+private:
+    void* view = nullptr;
+    size_t bytes = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+// the file is a header and sections of plain records, every section 64 byte aligned
+// geometry and the bvh are used in place, only materials and textures become objects
+struct cache_section {
+    uint64_t offset = 0;
+    uint64_t count = 0;
+};
+
+struct scene_cache_header {
+    char magic[8] = {'b', 'l', 'i', 'n', 'e', 's', 's', 'c'};
+    uint32_t version = 5; // 2: lights keep their material, 3: rotated spheres keep their frame, 4: lights keep transforms
+                          // 5: images keep their mip pyramid, baked noise its samples
+    uint32_t real_size = sizeof(real);
+    uint32_t node_size = sizeof(wide_bvh_node); // follows simd_width
+    uint32_t bvh_prims = 0; // the bvh indexes the first bvh_prims primitives, boundaries and lights follow
+    uint64_t key = 0; // the caller's version of the scene, see cached_world
+    uint64_t file_size = 0;
+    double bounds[2][3] = {};
+    cache_section nodes;     // wide_bvh_node
+    cache_section prims;     // flat_prim
+    cache_section pool;      // real, the numbers of the primitives
+    cache_section materials; // flat_material
+    cache_section textures;  // flat_texture
+    cache_section bytes;     // image mip pyramids, perlin tables and baked noise volumes
+    cache_section lights;    // flat_light
+};
+
+enum flat_prim_type : uint32_t {
+    flat_sphere,   // center, motion, radius, rotation when oriented
+    flat_quad,     // Q, u, v, normal, w, D
+    flat_triangle, // 3 corners, 3 normals, 3 uvs
+    flat_medium    // neg_inv_density, the boundary is prims [first, first + count)
+};
+
+// flags
+const uint32_t flat_moving = 1;  // spheres
+const uint32_t flat_oriented = 2; // spheres that were rotated, a row major rotation follows the radius
+const uint32_t flat_normals = 1; // triangles
+const uint32_t flat_uvs = 2;     // triangles
+
+const uint32_t flat_no_material = ~0u;
+
+struct flat_prim {
+    uint32_t type;
+    uint32_t flags;
+    uint32_t material;
+    uint32_t data; // first real of the primitive in the pool
+    uint32_t first;
+    uint32_t count;
+};
+
+enum flat_material_type : uint32_t {
+    flat_lambertian,
+    flat_metal,
+    flat_dielectric,
+    flat_diffuse_light,
+    flat_isotropic
+};
+
+struct flat_material {
+    uint32_t type;
+    uint32_t texture;
+    double albedo[3];
+    double param; // fuzz or index of refraction
+};
+
+enum flat_texture_type : uint32_t {
+    flat_solid,
+    flat_checker,
+    flat_image,
+    flat_noise
+};
+
+struct flat_texture {
+    uint32_t type;
+    uint32_t even, odd;
+    int32_t width, height; // the resolution of baked noise in width
+    uint64_t bytes; // offset into the bytes section
+    double value[3];
+    double scale; // inverse scale for checkers
+};
+
+// the lights list as a tree in preorder, a list (or bvh) is followed by its count entries
+// and every other entry is a sphere or quad with its transforms applied
+enum flat_light_kind : uint32_t {
+    flat_light_prim,
+    flat_light_list
+};
+
+struct flat_light {
+    uint32_t kind;
+    uint32_t prim;
+    uint32_t count;
+};
+
+// a scene used straight from a mapped cache file, one bvh over every primitive of the world
+class mapped_scene : public hittable {
+public:
+    // file holds a header scene_cache::load has checked
+    mapped_scene(shared_ptr<mapped_file> _file) : file(_file) {
+        const unsigned char* base = file->data();
+        const scene_cache_header& header = *reinterpret_cast<const scene_cache_header*>(base);
+        nodes = reinterpret_cast<const wide_bvh_node*>(base + header.nodes.offset);
+        node_count = header.nodes.count;
+        prims = reinterpret_cast<const flat_prim*>(base + header.prims.offset);
+        prim_count = header.prims.count;
+        pool = reinterpret_cast<const real*>(base + header.pool.offset);
+        bbox = aabb(point3(header.bounds[0][0], header.bounds[0][1], header.bounds[0][2]),
+                    point3(header.bounds[1][0], header.bounds[1][1], header.bounds[1][2]));
+
+        const unsigned char* bytes = base + header.bytes.offset;
+        const flat_texture* flat_textures = reinterpret_cast<const flat_texture*>(base + header.textures.offset);
+        for(uint64_t i = 0; i < header.textures.count; ++i){
+            textures.push_back(load_texture(flat_textures[i], bytes));
+        }
+
+        const flat_material* flat_materials = reinterpret_cast<const flat_material*>(base + header.materials.offset);
+        for(uint64_t i = 0; i < header.materials.count; ++i){
+            materials.push_back(load_material(flat_materials[i]));
+        }
+
+        const flat_light* flat_lights = reinterpret_cast<const flat_light*>(base + header.lights.offset);
+        size_t next = 0;
+        while(next < header.lights.count){
+            light_objects.add(load_light(flat_lights, next));
+        }
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if(node_count == 0){
+            return false;
+        }
+
+        return bvh_node::traverse(nodes, r, ray_t, [&](uint32_t first, uint32_t count){
+            bool hit_anything = false;
+            for(uint32_t p = first; p < first + count; ++p){
+                if(hit_prim(prims[p], r, ray_t, rec)){
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+            return hit_anything;
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if(node_count == 0){
+            return false;
+        }
+
+        hit_record rec;
+        return bvh_node::traverse(nodes, r, ray_t, [&](uint32_t first, uint32_t count){
+            for(uint32_t p = first; p < first + count; ++p){
+                if(hit_prim(prims[p], r, ray_t, rec)) return true;
+            }
+            return false;
+        }, true);
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    // rebuilt from the cache, spheres and quads sample like the originals
+    const hittable_list& lights() const {
+        return light_objects;
+    }
+
+    size_t primitive_count() const {
+        return prim_count;
+    }
+
+    size_t file_size() const {
+        return file->size();
+    }
+
+private:
+    shared_ptr<mapped_file> file;
+    const wide_bvh_node* nodes = nullptr;
+    size_t node_count = 0;
+    const flat_prim* prims = nullptr;
+    size_t prim_count = 0;
+    const real* pool = nullptr;
+    std::vector<shared_ptr<texture>> textures;
+    std::vector<shared_ptr<material>> materials;
+    hittable_list light_objects;
+    aabb bbox;
+
+    const material* material_of(const flat_prim& prim) const {
+        return prim.material == flat_no_material ? nullptr : materials[prim.material].get();
+    }
+
+    static vec3 pool_vec(const real* d){
+        return vec3(d[0], d[1], d[2]);
+    }
+
+    shared_ptr<texture> load_texture(const flat_texture& flat, const unsigned char* bytes) const {
+        switch(flat.type){
+            case flat_checker:
+                return checker_texture::from_inv_scale(flat.scale, textures[flat.even], textures[flat.odd]);
+            case flat_image:
+                return make_shared<image_texture>(reinterpret_cast<const float*>(bytes + flat.bytes), flat.width, flat.height);
+            case flat_noise: {
+                // the tables and the baked samples are used where they lie
+                const int n = perlin::point_count;
+                const unsigned char* p = bytes + flat.bytes;
+                const vec3* ranvec = reinterpret_cast<const vec3*>(p);
+                const int* perms = reinterpret_cast<const int*>(p + n * sizeof(vec3));
+                auto noise = make_shared<noise_texture>(flat.scale, perlin(ranvec, perms, perms + n, perms + 2 * n));
+                if(flat.width > 0){
+                    const double* bounds = reinterpret_cast<const double*>(p + n * sizeof(vec3) + 3 * n * sizeof(int));
+                    const float* samples = reinterpret_cast<const float*>(bounds + 6);
+                    noise->use_baked(aabb(point3(bounds[0], bounds[1], bounds[2]), point3(bounds[3], bounds[4], bounds[5])),
+                                     flat.width, samples);
+                }
+                return noise;
+            }
+            default:
+                return make_shared<solid_color>(color(flat.value[0], flat.value[1], flat.value[2]));
+        }
+    }
+
+    shared_ptr<material> load_material(const flat_material& flat) const {
+        switch(flat.type){
+            case flat_metal: return make_shared<metal>(color(flat.albedo[0], flat.albedo[1], flat.albedo[2]), flat.param);
+            case flat_dielectric: return make_shared<dielectric>(flat.param);
+            case flat_diffuse_light: return make_shared<diffuse_light>(textures[flat.texture]);
+            case flat_isotropic: return make_shared<isotropic>(textures[flat.texture]);
+            default: return make_shared<lambertian>(textures[flat.texture]);
+        }
+    }
+
+    // only sampled for directions, never shaded, the material is there for the light's power
+    shared_ptr<hittable> load_light(const flat_light* flat_lights, size_t& next) const {
+        const flat_light& light = flat_lights[next++];
+        if(light.kind == flat_light_list){
+            auto list = make_shared<hittable_list>();
+            for(uint32_t i = 0; i < light.count; ++i){
+                list->add(load_light(flat_lights, next));
+            }
+            return list;
+        }
+
+        const flat_prim& prim = prims[light.prim];
+        const real* d = pool + prim.data;
+        shared_ptr<material> mat = prim.material == flat_no_material ? nullptr : materials[prim.material];
+        if(prim.type == flat_sphere){
+            point3 center = pool_vec(d);
+            if(prim.flags & flat_moving){
+                return make_shared<sphere>(center, center + pool_vec(d + 3), d[6], mat);
+            }
+            return make_shared<sphere>(center, d[6], mat);
+        }
+        return make_shared<quad>(pool_vec(d), pool_vec(d + 3), pool_vec(d + 6), mat);
+    }
+
+    bool hit_prim(const flat_prim& prim, const ray& r, interval ray_t, hit_record& rec) const {
+        const real* d = pool + prim.data;
+        switch(prim.type){
+            case flat_sphere: return hit_sphere(prim, d, r, ray_t, rec);
+            case flat_quad: return hit_quad(prim, d, r, ray_t, rec);
+            case flat_triangle: return hit_triangle(prim, d, r, ray_t, rec);
+            case flat_medium: return hit_medium(prim, d, r, ray_t, rec);
+        }
+        return false;
+    }
+
+    static point3 sphere_center(const flat_prim& prim, const real* d, const ray& r){
+        point3 center = pool_vec(d);
+        if(prim.flags & flat_moving){
+            center = center + r.time() * pool_vec(d + 3);
+        }
+        return center;
+    }
+
+    bool hit_sphere(const flat_prim& prim, const real* d, const ray& r, interval ray_t, hit_record& rec) const {
+        point3 center = sphere_center(prim, d, r);
+        real radius = d[6], root;
+        if(!sphere::hit_root(r, ray_t, center, radius, root)){
+            return false;
+        }
+
+        vec3 outward_normal = sphere::set_hit(r, root, center, radius, material_of(prim), rec);
+        if(!(prim.flags & flat_oriented)){
+            sphere::set_surface(outward_normal, radius, rec);
+            return true;
+        }
+
+        // a rotated sphere keeps the uvs of its own frame, m turns that frame into the world
+        const real* m = d + 7;
+        const vec3& n = outward_normal;
+        sphere::set_surface(vec3(m[0] * n[0] + m[3] * n[1] + m[6] * n[2], m[1] * n[0] + m[4] * n[1] + m[7] * n[2],
+                                 m[2] * n[0] + m[5] * n[1] + m[8] * n[2]), radius, rec);
+        rec.dpdu = rotate(m, rec.dpdu);
+        rec.dpdv = rotate(m, rec.dpdv);
+        return true;
+    }
+
+    static vec3 rotate(const real* m, const vec3& v){
+        return vec3(m[0] * v[0] + m[1] * v[1] + m[2] * v[2], m[3] * v[0] + m[4] * v[1] + m[5] * v[2],
+                    m[6] * v[0] + m[7] * v[1] + m[8] * v[2]);
+    }
+
+    bool hit_quad(const flat_prim& prim, const real* d, const ray& r, interval ray_t, hit_record& rec) const {
+        vec3 u = pool_vec(d + 3), v = pool_vec(d + 6), normal = pool_vec(d + 9);
+        real t, alpha, beta;
+        if(!quad::hit_plane(r, ray_t, pool_vec(d), u, v, normal, d[15], pool_vec(d + 12), t, alpha, beta)
+           || !quad::in_unit_square(alpha, beta))
+            return false;
+
+        rec.u = alpha;
+        rec.v = beta;
+        quad::set_record(r, t, u, v, normal, material_of(prim), rec);
+        return true;
+    }
+
+    bool hit_triangle(const flat_prim& prim, const real* d, const ray& r, interval ray_t, hit_record& rec) const {
+        point3 p0 = pool_vec(d), p1 = pool_vec(d + 3), p2 = pool_vec(d + 6);
+        real t, weight[3];
+        if(!triangle_mesh::hit_triangle(triangle_mesh::sheared_ray(r), p0, p1, p2, ray_t, t, weight)){
+            return false;
+        }
+
+        vec3 corner_normals[3] = {pool_vec(d + 9), pool_vec(d + 12), pool_vec(d + 15)};
+        mesh_uv corner_uvs[3] = {{d[18], d[19]}, {d[20], d[21]}, {d[22], d[23]}};
+        triangle_mesh::set_record(r, t, weight, p0, p1, p2, (prim.flags & flat_normals) ? corner_normals : nullptr,
+                                  (prim.flags & flat_uvs) ? corner_uvs : nullptr, material_of(prim), rec);
+        return true;
+    }
+
+    // as the shapes' entry_exit, quads and triangles are crossed once at most
+    bool prim_entry_exit(const flat_prim& prim, const ray& r, interval& inside) const {
+        const real* d = pool + prim.data;
+        if(prim.type == flat_sphere){
+            return sphere::crossing(r, sphere_center(prim, d, r), d[6], inside);
+        }
+
+        hit_record rec;
+        if(!hit_prim(prim, r, interval::universe, rec)){
+            return false;
+        }
+        inside = interval(rec.t, rec.t);
+        return true;
+    }
+
+    // same as hittable_list::entry_exit over the boundary of a medium
+    bool boundary_entry_exit(const flat_prim& medium, const ray& r, interval& inside) const {
+        inside = interval::empty;
+        for(uint32_t p = medium.first; p < medium.first + medium.count; ++p){
+            interval part;
+            if(prim_entry_exit(prims[p], r, part)){
+                inside = interval(inside, part);
+            }
+        }
+        return inside.min <= inside.max;
+    }
+
+    bool hit_medium(const flat_prim& prim, const real* d, const ray& r, interval ray_t, hit_record& rec) const {
+        interval inside;
+        return boundary_entry_exit(prim, r, inside)
+            && constant_medium::scatter_inside(r, ray_t, inside, d[0], material_of(prim), rec);
+    }
+};
+
+// save() flattens a scene into a cache file: transforms are applied to the primitives, every
+// primitive of every bvh, list, sphere_set and mesh goes into one new bvh, and images are stored
+// as their float mip pyramids; load() maps the file and uses it where it lies
+// scenes with a hittable, material, texture or light it does not know are not cached
+// a file is only used with the key it was saved with, the scenes are code and the caller has to say
+// which version of the scene it wants
+class scene_cache {
+public:
+    static bool save(const std::string& filename, uint64_t key, const hittable& world, const hittable_list& lights){
+        scene_cache cache;
+        if(!cache.flatten(world, transform(), cache.prims)){
+            return false;
+        }
+        for(const shared_ptr<hittable>& light : lights.objects){
+            if(!cache.flatten_light(*light, transform())) return false;
+        }
+        if(!cache.complete){
+            return false;
+        }
+        return cache.write(filename, key);
+    }
+
+    // null when the file is missing, broken or was written with another key or by another build
+    static shared_ptr<mapped_scene> load(const std::string& filename, uint64_t key){
+        auto file = make_shared<mapped_file>(filename);
+        if(!file->valid() || file->size() < sizeof(scene_cache_header)){
+            return nullptr;
+        }
+
+        scene_cache_header expected;
+        const scene_cache_header& header = *reinterpret_cast<const scene_cache_header*>(file->data());
+        if(std::memcmp(header.magic, expected.magic, 8) != 0 || header.version != expected.version
+           || header.real_size != expected.real_size || header.node_size != expected.node_size
+           || header.key != key || header.file_size != file->size()){
+            std::clog << "Scene cache '" << filename << "' is stale, rebuilding\n";
+            return nullptr;
+        }
+        if(!sections_fit(header, file->size())){
+            std::clog << "Scene cache '" << filename << "' is broken, rebuilding\n";
+            return nullptr;
+        }
+
+        return make_shared<mapped_scene>(file);
+    }
+
+private:
+    // object to world, a linear map and an offset (translate, rotate_y and instance), never mirrored
+    struct transform {
+        real m[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+        vec3 offset;
+        bool identity = true;
+
+        vec3 vector(const vec3& v) const {
+            if(identity) return v;
+            return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                        m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                        m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+        }
+
+        point3 point(const point3& p) const {
+            return identity ? p : vector(p) + offset;
+        }
+
+        // the cofactors of m, its inverse transpose times a determinant above 0, enough for the direction of a normal
+        vec3 normal(const vec3& n) const {
+            if(identity) return n;
+            real c[3][3];
+            for(int i = 0; i < 3; ++i){
+                for(int j = 0; j < 3; ++j){
+                    int i1 = (i + 1) % 3, i2 = (i + 2) % 3, j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+                    c[i][j] = m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1];
+                }
+            }
+            return vec3(c[0][0] * n[0] + c[0][1] * n[1] + c[0][2] * n[2],
+                        c[1][0] * n[0] + c[1][1] * n[1] + c[1][2] * n[2],
+                        c[2][0] * n[0] + c[2][1] * n[1] + c[2][2] * n[2]);
+        }
+
+        // s when m is s times a rotation, 0 when it stretches some directions more than others
+        real uniform_scale() const {
+            if(identity) return 1;
+            vec3 column[3];
+            for(int j = 0; j < 3; ++j) column[j] = vec3(m[0][j], m[1][j], m[2][j]);
+            real s2 = dot(column[0], column[0]);
+            const real tolerance = 1e-5 * s2;
+            for(int i = 0; i < 3; ++i){
+                if(std::fabs(dot(column[i], column[i]) - s2) > tolerance) return 0;
+                if(std::fabs(dot(column[i], column[(i + 1) % 3])) > tolerance) return 0;
+            }
+            return sqrt(s2);
+        }
+
+        // false when m only scales evenly, or not at all
+        bool rotates() const {
+            for(int i = 0; i < 3; ++i){
+                for(int j = 0; j < 3; ++j){
+                    if(m[i][j] != (i == j ? m[0][0] : 0)) return true;
+                }
+            }
+            return false;
+        }
+
+        // this applied after an inner transform of linear map r and offset t
+        transform then(const real r[3][3], const vec3& t) const {
+            transform combined;
+            for(int i = 0; i < 3; ++i){
+                for(int j = 0; j < 3; ++j){
+                    combined.m[i][j] = m[i][0] * r[0][j] + m[i][1] * r[1][j] + m[i][2] * r[2][j];
+                }
+            }
+            combined.offset = vector(t) + offset;
+            combined.identity = false;
+            return combined;
+        }
+    };
+
+    std::vector<flat_prim> prims;     // in the world bvh
+    std::vector<flat_prim> extras;    // medium boundaries and lights, indices are fixed up on write
+    std::vector<aabb> boxes;          // of prims
+    std::vector<real> pool;
+    std::vector<flat_material> materials;
+    std::vector<flat_texture> textures;
+    std::vector<unsigned char> bytes;
+    std::vector<flat_light> lights;
+    std::unordered_map<const material*, uint32_t> material_indices;
+    std::unordered_map<const texture*, uint32_t> texture_indices;
+    bool complete = true; // false once a material or texture couldn't be stored, the file isn't written then
+
+    // only a box, stands in for a flat primitive while the bvh is built
+    class prim_box : public hittable {
+    public:
+        prim_box(const aabb& _bbox, uint32_t _index) : bbox(_bbox), index(_index) {}
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            return false;
+        }
+
+        aabb bounding_box() const override {
+            return bbox;
+        }
+
+        aabb bbox;
+        uint32_t index;
+    };
+
+    void push(const vec3& v){
+        pool.push_back(v[0]);
+        pool.push_back(v[1]);
+        pool.push_back(v[2]);
+    }
+
+    uint32_t pool_offset() const {
+        return static_cast<uint32_t>(pool.size());
+    }
+
+    void add_prim(std::vector<flat_prim>& out, const flat_prim& prim, const aabb& box){
+        out.push_back(prim);
+        if(&out == &prims){
+            boxes.push_back(box);
+        }
+    }
+
+    // a motion of 0 stays put, like a sphere made with one center
+    // false when tf doesn't keep the sphere round
+    bool add_sphere(std::vector<flat_prim>& out, const transform& tf, const point3& center, const vec3& motion,
+                    real radius, uint32_t mat){
+        real scale = tf.uniform_scale();
+        if(scale <= 0) return false;
+
+        bool moving = motion[0] != 0 || motion[1] != 0 || motion[2] != 0;
+        bool oriented = tf.rotates();
+        flat_prim prim{flat_sphere, (moving ? flat_moving : 0) | (oriented ? flat_oriented : 0), mat, pool_offset(), 0, 0};
+        point3 c = tf.point(center);
+        vec3 m = tf.vector(motion);
+        push(c);
+        push(m);
+        pool.push_back(scale * radius);
+        if(oriented){
+            for(int i = 0; i < 3; ++i){
+                for(int j = 0; j < 3; ++j) pool.push_back(tf.m[i][j] / scale);
+            }
+        }
+
+        vec3 rvec(scale * radius, scale * radius, scale * radius);
+        add_prim(out, prim, aabb(aabb(c - rvec, c + rvec), aabb(c + m - rvec, c + m + rvec)));
+        return true;
+    }
+
+    void add_quad(std::vector<flat_prim>& out, const transform& tf, const point3& q, const vec3& qu, const vec3& qv,
+                  uint32_t mat){
+        flat_prim prim{flat_quad, 0, mat, pool_offset(), 0, 0};
+        point3 Q = tf.point(q);
+        vec3 u = tf.vector(qu), v = tf.vector(qv);
+        // as in the quad constructor
+        vec3 n = cross(u, v);
+        vec3 normal = unit_vector(n);
+        push(Q);
+        push(u);
+        push(v);
+        push(normal);
+        push(n / dot(n, n));
+        pool.push_back(dot(normal, Q));
+
+        aabb box = aabb(aabb(Q, Q + u + v), aabb(Q + u, Q + v));
+        add_prim(out, prim, box.pad());
+    }
+
+    bool flatten(const hittable& object, const transform& tf, std::vector<flat_prim>& out){
+        if(auto list = dynamic_cast<const hittable_list*>(&object)){
+            for(const shared_ptr<hittable>& child : list->objects){
+                if(!flatten(*child, tf, out)) return false;
+            }
+            return true;
+        }
+
+        if(auto bvh = dynamic_cast<const bvh_node*>(&object)){
+            for(const shared_ptr<hittable>& child : bvh->primitive_array()){
+                if(!flatten(*child, tf, out)) return false;
+            }
+            return true;
+        }
+
+        transform inner;
+        if(const hittable* child = unwrap(object, tf, inner)){
+            return flatten(*child, inner, out);
+        }
+
+        if(auto s = dynamic_cast<const sphere*>(&object)){
+            if(!add_sphere(out, tf, s->get_center(), s->get_motion(), s->get_radius(), material_index(s->get_material().get()))){
+                return stretched(object);
+            }
+            return true;
+        }
+
+        if(auto q = dynamic_cast<const quad*>(&object)){
+            if(typeid(*q) != typeid(quad)) return unknown(object); // is_interior may be overridden
+            add_quad(out, tf, q->get_Q(), q->get_u(), q->get_v(), material_index(q->get_material().get()));
+            return true;
+        }
+
+        if(auto set = dynamic_cast<const sphere_set*>(&object)){
+            for(size_t i = 0; i < set->size(); ++i){
+                if(!add_sphere(out, tf, set->get_center(i), set->get_motion(i), set->get_radius(i),
+                               material_index(set->get_material(i).get()))){
+                    return stretched(object);
+                }
+            }
+            return true;
+        }
+
+        if(auto mesh = dynamic_cast<const triangle_mesh*>(&object)){
+            uint32_t mat = material_index(mesh->get_material().get());
+            for(const mesh_face& face : mesh->faces){
+                uint32_t flags = (face.n[0] >= 0 ? flat_normals : 0) | (face.t[0] >= 0 ? flat_uvs : 0);
+                flat_prim prim{flat_triangle, flags, mat, pool_offset(), 0, 0};
+                aabb box;
+                for(int c = 0; c < 3; ++c){
+                    point3 p = tf.point(mesh->positions[face.v[c]]);
+                    push(p);
+                    box = aabb(box, aabb(p, p));
+                }
+                for(int c = 0; c < 3; ++c){
+                    push(face.n[0] >= 0 ? tf.normal(mesh->normals[face.n[c]]) : vec3());
+                }
+                for(int c = 0; c < 3; ++c){
+                    pool.push_back(face.t[0] >= 0 ? mesh->uvs[face.t[c]].u : 0);
+                    pool.push_back(face.t[0] >= 0 ? mesh->uvs[face.t[c]].v : 0);
+                }
+                add_prim(out, prim, box.pad());
+            }
+            return true;
+        }
+
+        if(auto medium = dynamic_cast<const constant_medium*>(&object)){
+            // distances in the medium scale with the transform, only the same way in every direction
+            real scale = tf.uniform_scale();
+            if(scale <= 0) return stretched(object);
+            size_t first = extras.size();
+            if(!flatten(*medium->get_boundary(), tf, extras)) return false;
+
+            flat_prim prim{flat_medium, 0, material_index(medium->get_phase_function().get()), pool_offset(),
+                           static_cast<uint32_t>(first), static_cast<uint32_t>(extras.size() - first)};
+            pool.push_back(scale * medium->get_neg_inv_density());
+            add_prim(out, prim, transformed_box(medium->get_boundary()->bounding_box(), tf));
+            return true;
+        }
+
+        return unknown(object);
+    }
+
+    // the object inside a translate, rotate_y or instance and the transform it ends up under, null for anything else
+    static const hittable* unwrap(const hittable& object, const transform& tf, transform& inner){
+        if(auto t = dynamic_cast<const translate*>(&object)){
+            const real identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+            inner = tf.then(identity, t->get_offset());
+            return t->get_object().get();
+        }
+
+        if(auto rot = dynamic_cast<const rotate_y*>(&object)){
+            real r[3][3];
+            rot->get_rotation(r);
+            inner = tf.then(r, vec3());
+            return rot->get_object().get();
+        }
+
+        // a mirrored instance would turn its faces inside out, it's left to unknown()
+        if(auto inst = dynamic_cast<const instance*>(&object); inst && inst->get_to_world().determinant() > 0){
+            const affine& a = inst->get_to_world();
+            real l[3][3];
+            for(int i = 0; i < 3; ++i){
+                for(int j = 0; j < 3; ++j) l[i][j] = a.m[i][j];
+            }
+            inner = tf.then(l, vec3(a.m[0][3], a.m[1][3], a.m[2][3]));
+            return inst->get_object().get();
+        }
+        return nullptr;
+    }
+
+    static bool unknown(const hittable& object){
+        std::clog << "Scene cache can't store a " << typeid(object).name() << ", not caching\n";
+        return false;
+    }
+
+    // spheres and media only keep their shape under rotations and even scales
+    static bool stretched(const hittable& object){
+        std::clog << "Scene cache can't store a " << typeid(object).name() << " scaled unevenly, not caching\n";
+        return false;
+    }
+
+    // box around the corners of a transformed box
+    static aabb transformed_box(const aabb& box, const transform& tf){
+        if(tf.identity) return box;
+        aabb out;
+        for(int i = 0; i < 8; ++i){
+            point3 corner((i & 1) ? box.x.max : box.x.min, (i & 2) ? box.y.max : box.y.min, (i & 4) ? box.z.max : box.z.min);
+            point3 p = tf.point(corner);
+            out = aabb(out, aabb(p, p));
+        }
+        return out;
+    }
+
+    // lights keep their own copy as lists of spheres and quads with the transforms applied
+    // anything else can't be sampled from the cache and the scene isn't cached
+    bool flatten_light(const hittable& object, const transform& tf){
+        const std::vector<shared_ptr<hittable>>* children = nullptr;
+        if(auto list = dynamic_cast<const hittable_list*>(&object)){
+            children = &list->objects;
+        }else if(auto tree = dynamic_cast<const bvh_node*>(&object)){
+            children = &tree->primitive_array();
+        }
+        if(children){
+            lights.push_back({flat_light_list, 0, static_cast<uint32_t>(children->size())});
+            for(const shared_ptr<hittable>& child : *children){
+                if(!flatten_light(*child, tf)) return false;
+            }
+            return true;
+        }
+
+        transform inner;
+        if(const hittable* child = unwrap(object, tf, inner)){
+            return flatten_light(*child, inner);
+        }
+
+        size_t index = extras.size();
+        if(auto s = dynamic_cast<const sphere*>(&object)){
+            if(!add_sphere(extras, tf, s->get_center(), s->get_motion(), s->get_radius(), material_index(s->get_material().get()))){
+                return stretched(object);
+            }
+        }else if(auto q = dynamic_cast<const quad*>(&object); q && typeid(*q) == typeid(quad)){
+            add_quad(extras, tf, q->get_Q(), q->get_u(), q->get_v(), material_index(q->get_material().get()));
+        }else{
+            std::clog << "Scene cache can't store a " << typeid(object).name() << " light, not caching\n";
+            return false;
+        }
+        lights.push_back({flat_light_prim, static_cast<uint32_t>(index), 0});
+        return true;
+    }
+
+    uint32_t material_index(const material* mat){
+        if(mat == nullptr) return flat_no_material;
+        auto found = material_indices.find(mat);
+        if(found != material_indices.end()) return found->second;
+
+        flat_material flat{};
+        if(auto m = dynamic_cast<const lambertian*>(mat)){
+            flat.type = flat_lambertian;
+            flat.texture = texture_index(m->get_albedo().get());
+        }else if(auto m = dynamic_cast<const metal*>(mat)){
+            flat.type = flat_metal;
+            for(int a = 0; a < 3; ++a) flat.albedo[a] = m->get_albedo()[a];
+            flat.param = m->get_fuzz();
+        }else if(auto m = dynamic_cast<const dielectric*>(mat)){
+            flat.type = flat_dielectric;
+            flat.param = m->get_ir();
+        }else if(auto m = dynamic_cast<const diffuse_light*>(mat)){
+            flat.type = flat_diffuse_light;
+            flat.texture = texture_index(m->get_emit().get());
+        }else if(auto m = dynamic_cast<const isotropic*>(mat)){
+            flat.type = flat_isotropic;
+            flat.texture = texture_index(m->get_albedo().get());
+        }else{
+            std::clog << "Scene cache can't store a " << typeid(*mat).name() << ", not caching\n";
+            complete = false;
+            return flat_no_material;
+        }
+
+        materials.push_back(flat);
+        return material_indices[mat] = static_cast<uint32_t>(materials.size() - 1);
+    }
+
+    uint32_t texture_index(const texture* tex){
+        auto found = texture_indices.find(tex);
+        if(found != texture_indices.end()) return found->second;
+
+        flat_texture flat{};
+        if(auto t = dynamic_cast<const solid_color*>(tex)){
+            flat.type = flat_solid;
+            for(int a = 0; a < 3; ++a) flat.value[a] = t->get_color()[a];
+        }else if(auto t = dynamic_cast<const checker_texture*>(tex)){
+            flat.type = flat_checker;
+            flat.scale = t->get_inv_scale();
+            flat.even = texture_index(t->get_even().get());
+            flat.odd = texture_index(t->get_odd().get());
+        }else if(auto t = dynamic_cast<const image_texture*>(tex)){
+            flat.type = flat_image;
+            // the whole pyramid, mapped as it is when loaded
+            flat.width = t->get_width();
+            flat.height = t->get_height();
+            align_bytes(alignof(float));
+            flat.bytes = bytes.size();
+            append_bytes(t->get_texels(), t->get_texel_count());
+        }else if(auto t = dynamic_cast<const noise_texture*>(tex)){
+            flat.type = flat_noise;
+            flat.scale = t->get_scale();
+            align_bytes(alignof(vec3)); // the ints, doubles and floats after the gradients stay aligned too
+            flat.bytes = bytes.size();
+            const perlin& noise = t->get_noise();
+            append_bytes(noise.get_ranvec(), perlin::point_count);
+            append_bytes(noise.get_perm_x(), perlin::point_count);
+            append_bytes(noise.get_perm_y(), perlin::point_count);
+            append_bytes(noise.get_perm_z(), perlin::point_count);
+            // baked ones keep the bounds, resolution and samples of their volume
+            flat.width = t->get_bake_resolution();
+            if(flat.width > 0){
+                double bounds[6];
+                for(int a = 0; a < 3; ++a){
+                    bounds[a] = t->get_bake_bounds().axis(a).min;
+                    bounds[3 + a] = t->get_bake_bounds().axis(a).max;
+                }
+                append_bytes(bounds, 6);
+                append_bytes(t->get_baked_samples(), t->get_baked_sample_count());
+            }
+        }else{
+            std::clog << "Scene cache can't store a " << typeid(*tex).name() << ", not caching\n";
+            complete = false;
+            flat.type = flat_solid;
+        }
+
+        textures.push_back(flat);
+        return texture_indices[tex] = static_cast<uint32_t>(textures.size() - 1);
+    }
+
+    // the bytes section starts 64 byte aligned, so this aligns the data in the mapped file too
+    void align_bytes(size_t alignment){
+        bytes.resize((bytes.size() + alignment - 1) / alignment * alignment);
+    }
+
+    template<typename T>
+    void append_bytes(const T* data, size_t n){
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+        bytes.insert(bytes.end(), p, p + n * sizeof(T));
+    }
+
+    // true when every section of header lies inside a file of file_size bytes, on a 64 byte boundary
+    static bool sections_fit(const scene_cache_header& header, uint64_t file_size){
+        return section_fits(header.nodes, sizeof(wide_bvh_node), file_size)
+            && section_fits(header.prims, sizeof(flat_prim), file_size)
+            && section_fits(header.pool, sizeof(real), file_size)
+            && section_fits(header.materials, sizeof(flat_material), file_size)
+            && section_fits(header.textures, sizeof(flat_texture), file_size)
+            && section_fits(header.bytes, 1, file_size)
+            && section_fits(header.lights, sizeof(flat_light), file_size)
+            && header.bvh_prims <= header.prims.count;
+    }
+
+    static bool section_fits(const cache_section& section, size_t record_size, uint64_t file_size){
+        return section.offset % 64 == 0 && section.offset <= file_size
+            && section.count <= (file_size - section.offset) / record_size;
+    }
+
+    template<typename T>
+    static cache_section write_section(std::ofstream& out, uint64_t& offset, const T* data, size_t count){
+        static const char zeros[64] = {};
+        uint64_t aligned = (offset + 63) / 64 * 64;
+        out.write(zeros, aligned - offset);
+        out.write(reinterpret_cast<const char*>(data), count * sizeof(T));
+        offset = aligned + count * sizeof(T);
+        return cache_section{aligned, count};
+    }
+
+    bool write(const std::string& filename, uint64_t key){
+        // the bvh is built over stand ins for the primitives and its order becomes the order of the file
+        std::vector<flat_prim> ordered;
+        std::vector<wide_bvh_node> nodes;
+        aabb bounds;
+        if(!prims.empty()){
+            hittable_list stand_ins;
+            for(size_t i = 0; i < prims.size(); ++i){
+                stand_ins.add(make_shared<prim_box>(boxes[i], static_cast<uint32_t>(i)));
+            }
+            bvh_node bvh(stand_ins);
+            for(const shared_ptr<hittable>& p : bvh.primitive_array()){
+                ordered.push_back(prims[static_cast<const prim_box&>(*p).index]);
+            }
+            nodes = bvh.wide_node_array();
+            bounds = bvh.bounding_box();
+        }
+
+        // boundaries and lights go after the bvh primitives
+        uint32_t bvh_prims = static_cast<uint32_t>(ordered.size());
+        ordered.insert(ordered.end(), extras.begin(), extras.end());
+        for(flat_prim& prim : ordered){
+            if(prim.type == flat_medium) prim.first += bvh_prims;
+        }
+        for(flat_light& light : lights){
+            if(light.kind == flat_light_prim) light.prim += bvh_prims;
+        }
+
+        scene_cache_header header;
+        header.key = key;
+        header.bvh_prims = bvh_prims;
+        for(int a = 0; a < 3; ++a){
+            header.bounds[0][a] = bounds.axis(a).min;
+            header.bounds[1][a] = bounds.axis(a).max;
+        }
+
+        std::string temp_file = filename + ".tmp";
+        std::ofstream out(temp_file, std::ios::binary);
+        uint64_t offset = sizeof(header);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        header.nodes = write_section(out, offset, nodes.data(), nodes.size());
+        header.prims = write_section(out, offset, ordered.data(), ordered.size());
+        header.pool = write_section(out, offset, pool.data(), pool.size());
+        header.materials = write_section(out, offset, materials.data(), materials.size());
+        header.textures = write_section(out, offset, textures.data(), textures.size());
+        header.bytes = write_section(out, offset, bytes.data(), bytes.size());
+        header.lights = write_section(out, offset, lights.data(), lights.size());
+        header.file_size = offset;
+
+        // now that the sections are known
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.close();
+        if(!out){
+            std::cerr << "ERROR: Could not write scene cache '" << temp_file << "'.\n";
+            return false;
+        }
+
+        // like camera::save_checkpoint, only windows needs the old file gone before the rename
+        if(std::rename(temp_file.c_str(), filename.c_str()) != 0){
+            std::remove(filename.c_str());
+            if(std::rename(temp_file.c_str(), filename.c_str()) != 0){
+                std::cerr << "ERROR: Could not replace scene cache '" << filename << "'.\n";
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// the world of cache_file when it was saved with key, otherwise build() makes it (a hittable_list
+// that is also the lights list) and it is saved there first; either way the render uses the mapped copy,
+// so the first run looks like the ones after it, only a world that can't be cached is used as built
+// the cache keeps the emitters of the world as its lights, the ones light_list would pick anyway
+template<typename Build>
+// key is the version of the scene build() makes, a change to the scene needs a new one
+void cached_world(const std::string& cache_file, uint64_t key, Build build, hittable_list& world, hittable_list& lights){
+    auto start = std::chrono::steady_clock::now();
+    auto sc = scene_cache::load(cache_file, key);
+    if(!sc){
+        hittable_list built = build();
+        if(scene_cache::save(cache_file, key, built, light_list::emitters(built))){
+            sc = scene_cache::load(cache_file, key);
+        }
+        if(!sc){
+            world = built;
+            lights = built;
+            return;
+        }
+    }
+
+    std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+    std::clog << "Scene cache '" << cache_file << "': " << sc->primitive_count() << " primitives, "
+              << sc->file_size() / 1024 << " KiB, ready in " << took.count() << "s\n";
+    world = hittable_list(sc);
+    lights = sc->lights();
+}
+
+#endif
@@ -0,0 +1,332 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "blines.h"
+
+#include "bvh.h"
+#include "constant_medium.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "quad.h"
+#include "scenes.h"
+#include "sphere.h"
+#include "texture.h"
+#include "triangle_mesh.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+// scenes as text, one statement per line, # starts a comment
+//
+//   camera <setting> <values> [<setting> <values>...]
+//       width n, aspect a, spp n, depth n, vfov degrees, lookfrom x y z, lookat x y z, vup x y z,
+//       defocus degrees, focus distance, background r g b, output file, seed n,
+//       denoise 0|1, aovs 0|1                      aovs writes albedo, normal, depth and variance next to the output
+//       unlit_share s                              share of the light choices for lights that don't emit
+//       filtering 0|1                              average image textures over the pixel footprint
+//   texture <name> solid r g b | checker scale <even> <odd> | image file | noise scale
+//   material <name> lambertian (r g b | <texture>) | metal r g b fuzz | dielectric ir
+//                   | light (r g b | <texture>) | isotropic (r g b | <texture>)
+//
+//   shapes, each optionally followed by transforms applied in the order written:
+//   rotate_y degrees, translate x y z
+//       sphere <material> x y z radius [to x y z]    moves to the second center at time 1
+//       quad <material> Qx Qy Qz ux uy uz vx vy vz
+//       box <material> x0 y0 z0 x1 y1 z1
+//       mesh <material> file.obj
+//   medium density r g b <shape>    fog filling a convex shape, the shape itself is not rendered
+//   lights <shape>                  only sampled towards, not rendered, picked by the power of its material,
+//                                   so a shape with material none or one that doesn't emit is left out
+//                                   unless the camera has an unlit_share, none is only allowed here
+//
+// without any lights statement the whole world is the lights list, like in scenes.h, and its emitters are sampled
+// files are opened relative to the working directory
+class scene_file {
+public:
+    // false after printing what is wrong and where
+    static bool load(const std::string& filename, scene& sc){
+        std::ifstream in(filename);
+        if(!in){
+            std::cerr << "ERROR: Could not open scene file '" << filename << "'.\n";
+            return false;
+        }
+
+        scene_file parser(filename);
+        hittable_list objects;
+        hittable_list lights;
+        std::string text;
+        while(std::getline(in, text)){
+            ++parser.line;
+            size_t comment = text.find('#');
+            if(comment != std::string::npos) text.erase(comment);
+
+            parser.words.clear();
+            parser.words.str(text);
+            std::string keyword;
+            if(!(parser.words >> keyword)) continue;
+
+            if(!parser.statement(keyword, sc.cam, objects, lights)){
+                return false;
+            }
+        }
+
+        sc.world = objects.objects.empty() ? objects : hittable_list(make_shared<bvh_node>(objects));
+        sc.lights = lights.objects.empty() ? sc.world : lights;
+        return true;
+    }
+
+private:
+    std::string filename;
+    int line = 0;
+    std::istringstream words;
+    std::unordered_map<std::string, shared_ptr<texture>> textures;
+    std::unordered_map<std::string, shared_ptr<material>> materials;
+
+    scene_file(const std::string& _filename) : filename(_filename) {}
+
+    bool fail(const std::string& message){
+        std::cerr << "ERROR: " << filename << ":" << line << ": " << message << "\n";
+        return false;
+    }
+
+    template<typename T>
+    bool read(T& value, const char* what){
+        if(words >> value) return true;
+        return fail(std::string("expected ") + what);
+    }
+
+    bool read(vec3& v, const char* what){
+        real x, y, z;
+        if(!read(x, what) || !read(y, what) || !read(z, what)) return false;
+        v = vec3(x, y, z);
+        return true;
+    }
+
+    // the next word, or an empty string at the end of the line
+    std::string peek(){
+        std::streampos at = words.tellg();
+        std::string word;
+        if(!(words >> word)){
+            words.clear();
+            return "";
+        }
+        words.seekg(at);
+        return word;
+    }
+
+    bool at_end(){
+        return peek().empty();
+    }
+
+    bool statement(const std::string& keyword, camera& cam, hittable_list& objects, hittable_list& lights){
+        if(keyword == "camera") return camera_settings(cam);
+        if(keyword == "texture") return texture_statement();
+        if(keyword == "material") return material_statement();
+
+        if(keyword == "lights"){
+            std::string shape_keyword;
+            if(!read(shape_keyword, "a shape")) return false;
+            return shape(shape_keyword, lights, true);
+        }
+
+        if(keyword == "medium"){
+            real density;
+            color albedo;
+            std::string shape_keyword;
+            if(!read(density, "a density") || !read(albedo, "an albedo") || !read(shape_keyword, "a shape")) return false;
+
+            hittable_list boundary;
+            if(!shape(shape_keyword, boundary)) return false;
+            objects.add(make_shared<constant_medium>(boundary.objects[0], density, albedo));
+            return true;
+        }
+
+        return shape(keyword, objects);
+    }
+
+    bool camera_settings(camera& cam){
+        std::string setting;
+        while(words >> setting){
+            bool ok = true;
+            if(setting == "width") ok = read(cam.image_width, "a width");
+            else if(setting == "aspect") ok = read(cam.aspect_ratio, "an aspect ratio");
+            else if(setting == "spp") ok = read(cam.samples_per_pixel, "samples per pixel");
+            else if(setting == "depth") ok = read(cam.max_depth, "a depth");
+            else if(setting == "vfov") ok = read(cam.vfov, "a field of view");
+            else if(setting == "lookfrom") ok = read(cam.lookfrom, "a point");
+            else if(setting == "lookat") ok = read(cam.lookat, "a point");
+            else if(setting == "vup") ok = read(cam.vup, "a vector");
+            else if(setting == "defocus") ok = read(cam.defocus_angle, "an angle");
+            else if(setting == "focus") ok = read(cam.focus_dist, "a distance");
+            else if(setting == "background") ok = read(cam.background, "a color");
+            else if(setting == "output") ok = read(cam.filename, "a file name");
+            else if(setting == "seed") ok = read(cam.seed, "a seed");
+            else if(setting == "denoise") ok = read(cam.denoise, "0 or 1");
+            else if(setting == "aovs") ok = read(cam.write_aovs, "0 or 1");
+            else if(setting == "unlit_share") ok = read(cam.unlit_light_share, "a share");
+            else if(setting == "filtering") ok = read(cam.texture_filtering, "0 or 1");
+            else return fail("unknown camera setting '" + setting + "'");
+            if(!ok) return false;
+        }
+        return true;
+    }
+
+    bool texture_statement(){
+        std::string name, kind;
+        if(!read(name, "a texture name") || !read(kind, "a texture kind")) return false;
+
+        shared_ptr<texture> tex;
+        if(kind == "solid"){
+            color c;
+            if(!read(c, "a color")) return false;
+            tex = make_shared<solid_color>(c);
+        }else if(kind == "checker"){
+            real scale;
+            shared_ptr<texture> even, odd;
+            if(!read(scale, "a scale") || !texture_ref(even) || !texture_ref(odd)) return false;
+            tex = make_shared<checker_texture>(scale, even, odd);
+        }else if(kind == "image"){
+            std::string file;
+            if(!read(file, "an image file")) return false;
+            tex = make_shared<image_texture>(file.c_str());
+        }else if(kind == "noise"){
+            real scale;
+            if(!read(scale, "a scale")) return false;
+            tex = make_shared<noise_texture>(scale);
+        }else{
+            return fail("unknown texture kind '" + kind + "'");
+        }
+
+        textures[name] = tex;
+        return at_end() || fail("unexpected '" + peek() + "'");
+    }
+
+    bool texture_ref(shared_ptr<texture>& tex){
+        std::string name;
+        if(!read(name, "a texture name")) return false;
+        auto found = textures.find(name);
+        if(found == textures.end()) return fail("unknown texture '" + name + "'");
+        tex = found->second;
+        return true;
+    }
+
+    // r g b or the name of a texture
+    bool texture_or_color(shared_ptr<texture>& tex){
+        std::string next = peek();
+        if(!next.empty() && textures.count(next)){
+            return texture_ref(tex);
+        }
+        color c;
+        if(!read(c, "a color or a texture")) return false;
+        tex = make_shared<solid_color>(c);
+        return true;
+    }
+
+    bool material_statement(){
+        std::string name, kind;
+        if(!read(name, "a material name") || !read(kind, "a material kind")) return false;
+
+        shared_ptr<material> mat;
+        shared_ptr<texture> tex;
+        if(kind == "lambertian"){
+            if(!texture_or_color(tex)) return false;
+            mat = make_shared<lambertian>(tex);
+        }else if(kind == "metal"){
+            color albedo;
+            real fuzz;
+            if(!read(albedo, "an albedo") || !read(fuzz, "a fuzz")) return false;
+            mat = make_shared<metal>(albedo, fuzz);
+        }else if(kind == "dielectric"){
+            real ir;
+            if(!read(ir, "an index of refraction")) return false;
+            mat = make_shared<dielectric>(ir);
+        }else if(kind == "light"){
+            if(!texture_or_color(tex)) return false;
+            mat = make_shared<diffuse_light>(tex);
+        }else if(kind == "isotropic"){
+            if(!texture_or_color(tex)) return false;
+            mat = make_shared<isotropic>(tex);
+        }else{
+            return fail("unknown material kind '" + kind + "'");
+        }
+
+        materials[name] = mat;
+        return at_end() || fail("unexpected '" + peek() + "'");
+    }
+
+    // none is only for lights, which are never shaded
+    bool material_ref(shared_ptr<material>& mat, bool allow_none){
+        std::string name;
+        if(!read(name, "a material name")) return false;
+        if(name == "none"){
+            if(!allow_none) return fail("material none is only allowed for lights");
+            mat = nullptr;
+            return true;
+        }
+        auto found = materials.find(name);
+        if(found == materials.end()) return fail("unknown material '" + name + "'");
+        mat = found->second;
+        return true;
+    }
+
+    // adds the shape with its transforms to out
+    bool shape(const std::string& keyword, hittable_list& out, bool allow_none = false){
+        shared_ptr<material> mat;
+        shared_ptr<hittable> object;
+
+        if(keyword == "sphere"){
+            point3 center;
+            real radius;
+            if(!material_ref(mat, allow_none) || !read(center, "a center") || !read(radius, "a radius")) return false;
+            if(peek() == "to"){
+                std::string to;
+                words >> to;
+                point3 center2;
+                if(!read(center2, "a second center")) return false;
+                object = make_shared<sphere>(center, center2, radius, mat);
+            }else{
+                object = make_shared<sphere>(center, radius, mat);
+            }
+        }else if(keyword == "quad"){
+            point3 Q;
+            vec3 u, v;
+            if(!material_ref(mat, allow_none) || !read(Q, "a corner") || !read(u, "a side") || !read(v, "a side")) return false;
+            object = make_shared<quad>(Q, u, v, mat);
+        }else if(keyword == "box"){
+            point3 a, b;
+            if(!material_ref(mat, allow_none) || !read(a, "a corner") || !read(b, "a corner")) return false;
+            object = box(a, b, mat);
+        }else if(keyword == "mesh"){
+            std::string file;
+            if(!material_ref(mat, allow_none) || !read(file, "an obj file")) return false;
+            object = load_obj(file, mat);
+            if(static_cast<const triangle_mesh&>(*object).triangle_count() == 0) return fail("no triangles in '" + file + "'");
+        }else{
+            return fail("unknown statement '" + keyword + "'");
+        }
+
+        std::string transform;
+        while(words >> transform){
+            if(transform == "rotate_y"){
+                real angle;
+                if(!read(angle, "an angle")) return false;
+                object = make_shared<rotate_y>(object, angle);
+            }else if(transform == "translate"){
+                vec3 offset;
+                if(!read(offset, "an offset")) return false;
+                object = make_shared<translate>(object, offset);
+            }else{
+                return fail("unexpected '" + transform + "'");
+            }
+        }
+
+        out.add(object);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,541 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "blines.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "color.h"
+#include "constant_medium.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "quad.h"
+#include "scene_cache.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "texture.h"
+
+#include <string>
+
+// everything a render needs, the scene functions only build it
+struct scene {
+    hittable_list world;
+    hittable_list lights;
+    camera cam;
+
+    void render(){
+        cam.render(world, lights);
+    }
+};
+
+scene fun_balls(){
+    hittable_list world;
+
+    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
+
+    // auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    // world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+
+    auto balls = make_shared<sphere_set>();
+    for(int a = -11; a < 11; ++a){
+        for(int b = -11; b < 11; ++b){
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if((center - point3(4, 0.2, 0)).length() > 0.9){
+                shared_ptr<material> sphere_mat;
+
+                if(choose_mat < 0.8){
+                    //difuse 
+                    auto albedo = color::random() * color::random();
+                    sphere_mat = make_shared<lambertian>(albedo);
+                    auto center2 = center + vec3(0, random_double(0, 0.5), 0);
+                    balls->add(center, center2, 0.2, sphere_mat);
+                } else if (choose_mat < 0.95){
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_mat = make_shared<metal>(albedo, fuzz);
+                    balls->add(center, 0.2, sphere_mat);
+                }else{
+                    // glass
+                    sphere_mat = make_shared<dielectric>(1.5);
+                    balls->add(center, 0.2, sphere_mat);
+                }
+            }
+        }
+    }
+    balls->build();
+    world.add(balls);
+
+    auto material1 = make_shared<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    camera cam("images\\image2.ppm");
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 200;
+    cam.max_depth = 50;
+    cam.background = color(0.7, 0.8, 1);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+
+    return scene{world, world, cam};
+}
+
+scene the_trio(){
+    hittable_list world;
+
+    shared_ptr<material> material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
+    shared_ptr<material> material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
+    shared_ptr<material> material_left = make_shared<dielectric>(1.5);
+    shared_ptr<material> material_right = make_shared<metal>(color(0.8, 0.6, 0.2), 1.0);
+
+    world.add(make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));
+    world.add(make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, material_center));
+    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
+    world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), -0.4, material_left));
+    world.add(make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
+    
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    camera cam("images\\image.ppm");
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = color(0.7, 0.8, 1);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(-2, 2, 1);
+    cam.lookat = point3(0, 0, -1);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    cam.focus_dist = 1;
+
+    return scene{world, world, cam};
+}
+
+scene two_balls(){
+    hittable_list world;
+
+    auto checker = make_shared<checker_texture>(1 / pi, color(.2, .3, .1), color(.9, .9, .9));
+
+    world.add(make_shared<sphere>(point3(0, -10, 0), 10, make_shared<lambertian>(checker)));
+    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
+
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    camera cam("images\\image3.ppm");
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 50;
+    cam.max_depth = 10;
+    cam.background = color(0.7, 0.8, 1);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, world, cam};
+}
+
+scene earth(){
+    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
+    auto earth_surface = make_shared<lambertian>(earth_texture);
+    auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
+
+    camera cam("images\\image4.ppm");
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 50;
+    cam.max_depth = 10;
+    cam.background = color(0.7, 0.8, 1);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(0, 0, 12);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene{hittable_list(globe), hittable_list(globe), cam};
+}
+
+scene two_perlin_spheres(){
+    hittable_list world;
+
+    auto pertext = make_shared<noise_texture>(4);
+
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
+    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    camera cam("images\\image5.ppm");
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 50;
+    cam.max_depth = 10;
+    cam.background = color(0.7, 0.8, 1);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, world, cam};
+}
+
+scene quads(){
+    hittable_list world;
+
+    auto left_red = make_shared<lambertian>(color(1, 0.2, 0.2));
+    auto back_green = make_shared<lambertian>(color(0.2, 1, 0.2));
+    auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1));
+    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0));
+    auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+
+    world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
+    world.add(make_shared<quad>(point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    world.add(make_shared<quad>(point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
+    world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
+
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    camera cam("images\\image6.ppm");
+    cam.aspect_ratio = 1;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 50;
+    cam.max_depth = 10;
+    cam.background = color(0.7, 0.8, 1);
+
+    cam.vfov = 80;
+    cam.lookfrom = point3(0, 0, 9);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, world, cam};
+}
+
+scene simple_light(){
+    hittable_list world;
+
+    auto pertext = make_shared<noise_texture>(4);
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
+    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+
+    auto difflight = make_shared<diffuse_light>(color(4, 4, 4));
+    world.add(make_shared<sphere>(point3(0, 7, 0), 2, difflight));
+    world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
+
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    camera cam("images\\image7.ppm");
+    cam.aspect_ratio = 16.0 / 9;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 400;
+    cam.max_depth = 50;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(26, 3, 6);
+    cam.lookat = point3(0, 2, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, world, cam};
+}
+
+scene cornell_box(std::string filename){
+    hittable_list world;
+
+    auto red = make_shared<lambertian>(color(0.65, .05, .05));
+    auto white = make_shared<lambertian>(color(0.73, .73, .73));
+    auto green = make_shared<lambertian>(color(0.12, .45, .15));
+    auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+    // Walls
+    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
+    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+    // Light
+    // . Ceiling Light
+    world.add(make_shared<quad>(point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), light));
+
+    // . Glass sphere
+    auto glass = make_shared<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
+
+    // lights are picked by power, so the quad carries the light material, the glass sphere has none and
+    // only gets sampled through the camera's unlit_light_share, half of the choices like the book's mix
+    hittable_list lights;
+    lights.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+    lights.add(make_shared<sphere>(point3(190, 90, 190), 90, shared_ptr<material>()));
+
+
+    // Box 1
+    // shared_ptr<material> aluminum = make_shared<metal>(color(0.8, 0.85, 0.88), 0.0);
+    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+    world.add(box1);
+
+    /*
+    // Box 2
+    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+    world.add(box2);
+    */
+
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    camera cam("images\\" + filename);
+    cam.aspect_ratio = 1;
+    cam.image_width = 600;
+    cam.samples_per_pixel = 1000;
+    cam.max_depth = 50;
+    cam.background = color(0, 0, 0);
+    cam.unlit_light_share = 0.5;
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, lights, cam};
+}
+
+scene cornell_smoke(){
+    hittable_list world;
+
+    auto red = make_shared<lambertian>(color(0.65, .05, .05));
+    auto white = make_shared<lambertian>(color(0.73, .73, .73));
+    auto green = make_shared<lambertian>(color(0.12, .45, .15));
+    auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
+    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+    world.add(make_shared<constant_medium>(box1, 0.01, color(0, 0, 0)));
+
+    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+    world.add(make_shared<constant_medium>(box2, 0.01, color(1, 1, 1)));
+
+    world.add(box(point3(265, 0, 295), point3(430, 330, 460), white));
+
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    camera cam("images\\image9.ppm");
+    cam.aspect_ratio = 1;
+    cam.image_width = 600;
+    cam.samples_per_pixel = 200;
+    cam.max_depth = 50;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, world, cam};
+}
+
+// global_fog is the thin medium in a sphere of radius 5000 around everything
+hittable_list final_scene_objects(bool global_fog){
+    hittable_list boxes1;
+    auto ground = make_shared<lambertian>(color(.48, .83, .53));
+
+    int boxes_per_side = 20;
+    for(int i = 0; i < boxes_per_side; ++i){
+        for(int j = 0; j < boxes_per_side; ++j){
+            auto w = 100.0;
+            auto x0 = -1000 + i * w;
+            auto z0 = -1000 + j * w;
+            auto y0 = 0.0;
+            auto x1 = x0 + w;
+            auto y1 = random_double(1, 101);
+            auto z1 = z0 + w;
+
+            boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+        }
+    }
+
+    hittable_list world;
+
+    world.add(make_shared<bvh_node>(boxes1));
+
+    auto light = make_shared<diffuse_light>(color(7, 7, 7));
+    world.add(make_shared<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
+
+    auto center1 = point3(400, 400, 200);
+    auto center2 = center1 + vec3(30, 0, 0);
+    auto sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
+    world.add(make_shared<sphere>(center1, center2, 50, sphere_material));
+
+    world.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
+    world.add(make_shared<sphere>(point3(0, 150, 145), 50, make_shared<metal>(color(.8, .8, .8), 1.0)));
+
+    auto boundary = make_shared<sphere>(point3(360, 150, 145), 70, make_shared<dielectric>(1.5));
+    world.add(boundary);
+    world.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
+    
+    if(global_fog){
+        boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
+        world.add(make_shared<constant_medium>(boundary, 0.0001, color(1, 1, 1)));
+    }
+
+    auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
+    world.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
+
+    auto pertext = make_shared<noise_texture>(0.1);
+    world.add(make_shared<sphere>(point3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
+
+    auto boxes2 = make_shared<sphere_set>();
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    int ns = 1000;
+    for(int j = 0; j < ns; ++j){
+        boxes2->add(point3::random(0, 165), 10, white);
+    }
+    boxes2->build();
+
+    world.add(make_shared<translate>(make_shared<rotate_y>(boxes2, 15), vec3(-100, 270, 395)));
+
+    return world;
+}
+
+// the scene cache key of final_scene_world, has to change with the scene so old caches get rebuilt
+const uint64_t final_scene_version = 1;
+
+hittable_list final_scene_world(){
+    return final_scene_objects(true);
+}
+
+// with a cache_file the world is built once and mapped from there on later runs, see scene_cache.h
+scene final_scene(int image_width, int samples_per_pixel, int max_depth, const std::string& cache_file = ""){
+    hittable_list world, lights;
+    if(cache_file.empty()){
+        world = lights = final_scene_world();
+    }else{
+        cached_world(cache_file, final_scene_version, final_scene_world, world, lights);
+    }
+
+    camera cam("images\\image10.ppm");
+    cam.aspect_ratio = 1.0;
+    cam.image_width = image_width;
+    cam.samples_per_pixel = samples_per_pixel;
+    cam.max_depth = max_depth;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(478, 278, -600);
+    cam.lookat = point3(278, 278, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, lights, cam};
+}
+
+// the 1000 spheres of final_scene's boxes2, inside (0, 0, 0) to (165, 165, 165)
+shared_ptr<sphere_set> sphere_cluster(shared_ptr<material> mat){
+    auto cluster = make_shared<sphere_set>();
+    for(int j = 0; j < 1000; ++j){
+        cluster->add(point3::random(0, 165), 10, mat);
+    }
+    cluster->build();
+    return cluster;
+}
+
+// somewhere in a cube of the given side around the origin, turned and scaled around the cluster's center
+affine random_placement(real side){
+    point3 position = point3::random(-side / 2, side / 2);
+    real scale = random_double(0.5, 1.5);
+    return affine::translation(position)
+         * affine::rotation(random_unit_vector(), random_double(0, 360))
+         * affine::scaling(vec3(scale, scale, scale))
+         * affine::translation(vec3(-82.5, -82.5, -82.5));
+}
+
+// count instances of two sphere clusters floating around the camera, only the two clusters are in memory
+scene cluster_field(int count = 100000){
+    shared_ptr<hittable> clusters[2] = {
+        sphere_cluster(make_shared<lambertian>(color(.73, .73, .73))),
+        sphere_cluster(make_shared<metal>(color(.8, .6, .2), 0.1))
+    };
+
+    // sparse enough that most rays get back out to the sky
+    real side = 1000 * std::cbrt(static_cast<real>(count));
+    hittable_list instances;
+    for(int i = 0; i < count; ++i){
+        instances.add(make_shared<instance>(clusters[i % 2], random_placement(side)));
+    }
+    hittable_list world(make_shared<bvh_node>(instances));
+
+    // a sun above the field to sample towards, the world has no pdf of its own
+    auto sun = make_shared<sphere>(point3(side, 3 * side, side), side / 4, make_shared<diffuse_light>(color(15, 14, 12)));
+    world.add(sun);
+
+    camera cam("images\\image12.ppm");
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = color(0.7, 0.8, 1);
+
+    cam.vfov = 60;
+    cam.lookfrom = point3(0, 0, 0);
+    cam.lookat = point3(1, 0.2, 1);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, hittable_list(sun), cam};
+}
+
+#endif
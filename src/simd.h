@@ -0,0 +1,215 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "blines.h"
+
+#include <cstdint>
+
+// bvh width follows the instruction set the compiler targets:
+// avx2 tests 8 boxes at once, sse 4, define BLINES_SCALAR to get the plain loop
+#if defined(__AVX2__) && !defined(BLINES_SCALAR)
+    #include <immintrin.h>
+    #define BLINES_AVX2
+    const int simd_width = 8;
+#elif defined(__SSE2__) && !defined(BLINES_SCALAR)
+    #include <emmintrin.h>
+    #define BLINES_SSE
+    const int simd_width = 4;
+#else
+    const int simd_width = 4;
+#endif
+
+// everything the slab test needs from a ray, computed once per ray
+// err covers rounding the double origin to float, so the float test only ever errs towards a hit
+class ray_slab {
+public:
+    float orig[3];
+    float inv_dir[3];
+    float err[3];
+    int neg[3];
+
+    ray_slab(const point3& origin, const vec3& direction){
+        for(int a = 0; a < 3; ++a){
+            double inv = 1 / direction[a];
+            orig[a] = static_cast<float>(origin[a]);
+            inv_dir[a] = static_cast<float>(inv);
+            // axis parallel rays get no slack, inf - inf would turn the slab test into nan
+            err[a] = std::isfinite(inv) ? static_cast<float>(0x1p-22 * std::fabs(origin[a]) * std::fabs(inv)) : 0;
+            neg[a] = inv < 0;
+        }
+    }
+};
+
+// W boxes in structure of arrays form
+// bounds[0] holds the minimums, bounds[1] the maximums, empty slots are inverted boxes
+template<int W>
+struct alignas(32) wide_box {
+    float bounds[2][3][W];
+
+    void clear(){
+        for(int a = 0; a < 3; ++a){
+            for(int k = 0; k < W; ++k){
+                bounds[0][a][k] = std::numeric_limits<float>::infinity();
+                bounds[1][a][k] = -std::numeric_limits<float>::infinity();
+            }
+        }
+    }
+};
+
+// bit k of the result is set when the ray enters box k within [tmin, tmax]
+// tnear receives the entry distances
+template<int W>
+inline int wide_box_hit(const wide_box<W>& box, const ray_slab& rs, float tmin, float tmax, float* tnear){
+    int mask = 0;
+    for(int k = 0; k < W; ++k){
+        float tn = tmin, tf = tmax;
+        for(int a = 0; a < 3; ++a){
+            float t0 = (box.bounds[rs.neg[a]][a][k] - rs.orig[a]) * rs.inv_dir[a] - rs.err[a];
+            float t1 = ((box.bounds[1 - rs.neg[a]][a][k] - rs.orig[a]) * rs.inv_dir[a] + rs.err[a]) * 1.000001f;
+            // written so a nan from 0 * inf leaves the interval alone
+            tn = t0 > tn ? t0 : tn;
+            tf = t1 < tf ? t1 : tf;
+        }
+        tnear[k] = tn;
+        mask |= (tn <= tf) << k;
+    }
+    return mask;
+}
+
+#if defined(BLINES_SSE)
+template<>
+inline int wide_box_hit<4>(const wide_box<4>& box, const ray_slab& rs, float tmin, float tmax, float* tnear){
+    __m128 tn = _mm_set1_ps(tmin);
+    __m128 tf = _mm_set1_ps(tmax);
+    const __m128 scale = _mm_set1_ps(1.000001f);
+    for(int a = 0; a < 3; ++a){
+        __m128 o = _mm_set1_ps(rs.orig[a]);
+        __m128 inv = _mm_set1_ps(rs.inv_dir[a]);
+        __m128 err = _mm_set1_ps(rs.err[a]);
+        __m128 t0 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(box.bounds[rs.neg[a]][a]), o), inv), err);
+        __m128 t1 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(box.bounds[1 - rs.neg[a]][a]), o), inv), err), scale);
+        // max/min return the second operand on nan
+        tn = _mm_max_ps(t0, tn);
+        tf = _mm_min_ps(t1, tf);
+    }
+    _mm_storeu_ps(tnear, tn);
+    return _mm_movemask_ps(_mm_cmple_ps(tn, tf));
+}
+#endif
+
+#if defined(BLINES_AVX2)
+template<>
+inline int wide_box_hit<8>(const wide_box<8>& box, const ray_slab& rs, float tmin, float tmax, float* tnear){
+    __m256 tn = _mm256_set1_ps(tmin);
+    __m256 tf = _mm256_set1_ps(tmax);
+    const __m256 scale = _mm256_set1_ps(1.000001f);
+    for(int a = 0; a < 3; ++a){
+        __m256 o = _mm256_set1_ps(rs.orig[a]);
+        __m256 inv = _mm256_set1_ps(rs.inv_dir[a]);
+        __m256 err = _mm256_set1_ps(rs.err[a]);
+        __m256 t0 = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(box.bounds[rs.neg[a]][a]), o), inv), err);
+        __m256 t1 = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(box.bounds[1 - rs.neg[a]][a]), o), inv), err), scale);
+        tn = _mm256_max_ps(t0, tn);
+        tf = _mm256_min_ps(t1, tf);
+    }
+    _mm256_storeu_ps(tnear, tn);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ));
+}
+#endif
+
+// lanes of real in one register, for kernels that have to run in the renderer's precision
+// without avx2 a lane is just a real and the same kernel code runs one element at a time
+// vr_andnot(a, b) is b and not a, vr_select(m, a, b) is m ? a : b
+// vint holds one int per lane of a vreal for table lookups: vi_gather(t, i) and vr_gather(t, i) are t[i],
+// vi_from_real truncates
+#if defined(BLINES_AVX2) && defined(BLINES_USE_FLOAT)
+    using vreal = __m256;
+    using vmask = __m256;
+    const int vreal_width = 8;
+    inline vreal vr_set(real x){ return _mm256_set1_ps(x); }
+    inline vreal vr_load(const real* p){ return _mm256_loadu_ps(p); }
+    inline void vr_store(real* p, vreal a){ _mm256_storeu_ps(p, a); }
+    inline vreal vr_add(vreal a, vreal b){ return _mm256_add_ps(a, b); }
+    inline vreal vr_sub(vreal a, vreal b){ return _mm256_sub_ps(a, b); }
+    inline vreal vr_mul(vreal a, vreal b){ return _mm256_mul_ps(a, b); }
+    inline vreal vr_div(vreal a, vreal b){ return _mm256_div_ps(a, b); }
+    inline vreal vr_max(vreal a, vreal b){ return _mm256_max_ps(a, b); }
+    inline vreal vr_sqrt(vreal a){ return _mm256_sqrt_ps(a); }
+    inline vreal vr_floor(vreal a){ return _mm256_floor_ps(a); }
+    inline vmask vr_less(vreal a, vreal b){ return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    inline vmask vr_less_equal(vreal a, vreal b){ return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    inline vmask vr_and(vmask a, vmask b){ return _mm256_and_ps(a, b); }
+    inline vmask vr_or(vmask a, vmask b){ return _mm256_or_ps(a, b); }
+    inline vmask vr_andnot(vmask a, vmask b){ return _mm256_andnot_ps(a, b); }
+    inline vreal vr_select(vmask m, vreal a, vreal b){ return _mm256_blendv_ps(b, a, m); }
+    inline int vr_bits(vmask m){ return _mm256_movemask_ps(m); }
+    using vint = __m256i;
+    inline vint vi_set(int x){ return _mm256_set1_epi32(x); }
+    inline vint vi_from_real(vreal a){ return _mm256_cvttps_epi32(a); }
+    inline vint vi_add(vint a, vint b){ return _mm256_add_epi32(a, b); }
+    inline vint vi_and(vint a, vint b){ return _mm256_and_si256(a, b); }
+    inline vint vi_xor(vint a, vint b){ return _mm256_xor_si256(a, b); }
+    // the masked gathers start from zeros, the plain ones from an undefined register gcc warns about
+    inline vint vi_gather(const int* t, vint i){ return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), t, i, _mm256_set1_epi32(-1), 4); }
+    inline vreal vr_gather(const real* t, vint i){ return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), t, i, _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4); }
+#elif defined(BLINES_AVX2)
+    using vreal = __m256d;
+    using vmask = __m256d;
+    const int vreal_width = 4;
+    inline vreal vr_set(real x){ return _mm256_set1_pd(x); }
+    inline vreal vr_load(const real* p){ return _mm256_loadu_pd(p); }
+    inline void vr_store(real* p, vreal a){ _mm256_storeu_pd(p, a); }
+    inline vreal vr_add(vreal a, vreal b){ return _mm256_add_pd(a, b); }
+    inline vreal vr_sub(vreal a, vreal b){ return _mm256_sub_pd(a, b); }
+    inline vreal vr_mul(vreal a, vreal b){ return _mm256_mul_pd(a, b); }
+    inline vreal vr_div(vreal a, vreal b){ return _mm256_div_pd(a, b); }
+    inline vreal vr_max(vreal a, vreal b){ return _mm256_max_pd(a, b); }
+    inline vreal vr_sqrt(vreal a){ return _mm256_sqrt_pd(a); }
+    inline vreal vr_floor(vreal a){ return _mm256_floor_pd(a); }
+    inline vmask vr_less(vreal a, vreal b){ return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    inline vmask vr_less_equal(vreal a, vreal b){ return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+    inline vmask vr_and(vmask a, vmask b){ return _mm256_and_pd(a, b); }
+    inline vmask vr_or(vmask a, vmask b){ return _mm256_or_pd(a, b); }
+    inline vmask vr_andnot(vmask a, vmask b){ return _mm256_andnot_pd(a, b); }
+    inline vreal vr_select(vmask m, vreal a, vreal b){ return _mm256_blendv_pd(b, a, m); }
+    inline int vr_bits(vmask m){ return _mm256_movemask_pd(m); }
+    using vint = __m128i;
+    inline vint vi_set(int x){ return _mm_set1_epi32(x); }
+    inline vint vi_from_real(vreal a){ return _mm256_cvttpd_epi32(a); }
+    inline vint vi_add(vint a, vint b){ return _mm_add_epi32(a, b); }
+    inline vint vi_and(vint a, vint b){ return _mm_and_si128(a, b); }
+    inline vint vi_xor(vint a, vint b){ return _mm_xor_si128(a, b); }
+    inline vint vi_gather(const int* t, vint i){ return _mm_mask_i32gather_epi32(_mm_setzero_si128(), t, i, _mm_set1_epi32(-1), 4); }
+    inline vreal vr_gather(const real* t, vint i){ return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), t, i, _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8); }
+#else
+    using vreal = real;
+    using vmask = bool;
+    const int vreal_width = 1;
+    inline vreal vr_set(real x){ return x; }
+    inline vreal vr_load(const real* p){ return *p; }
+    inline void vr_store(real* p, vreal a){ *p = a; }
+    inline vreal vr_add(vreal a, vreal b){ return a + b; }
+    inline vreal vr_sub(vreal a, vreal b){ return a - b; }
+    inline vreal vr_mul(vreal a, vreal b){ return a * b; }
+    inline vreal vr_div(vreal a, vreal b){ return a / b; }
+    inline vreal vr_max(vreal a, vreal b){ return a > b ? a : b; }
+    inline vreal vr_sqrt(vreal a){ return sqrt(a); }
+    inline vreal vr_floor(vreal a){ return floor(a); }
+    inline vmask vr_less(vreal a, vreal b){ return a < b; }
+    inline vmask vr_less_equal(vreal a, vreal b){ return a <= b; }
+    inline vmask vr_and(vmask a, vmask b){ return a && b; }
+    inline vmask vr_or(vmask a, vmask b){ return a || b; }
+    inline vmask vr_andnot(vmask a, vmask b){ return !a && b; }
+    inline vreal vr_select(vmask m, vreal a, vreal b){ return m ? a : b; }
+    inline int vr_bits(vmask m){ return m; }
+    using vint = int;
+    inline vint vi_set(int x){ return x; }
+    inline vint vi_from_real(vreal a){ return static_cast<int>(a); }
+    inline vint vi_add(vint a, vint b){ return a + b; }
+    inline vint vi_and(vint a, vint b){ return a & b; }
+    inline vint vi_xor(vint a, vint b){ return a ^ b; }
+    inline vint vi_gather(const int* t, vint i){ return t[i]; }
+    inline vreal vr_gather(const real* t, vint i){ return t[i]; }
+#endif
+
+#endif
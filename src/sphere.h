@@ -2,18 +2,19 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "material.h"
 #include "onb.h"
 
 class sphere : public hittable{
 public:
-    sphere(point3 _center, double _radius, shared_ptr<material> _material)
+    sphere(point3 _center, real _radius, shared_ptr<material> _material)
         : center1(_center), radius(_radius), mat(_material), is_moving(false) 
     {
         vec3 rvec = vec3(radius, radius, radius);
         bbox = aabb(center1 - rvec, center1 + rvec);
     }
 
-    sphere(point3 _center1, point3 _center2, double _radius, shared_ptr<material> _material)
+    sphere(point3 _center1, point3 _center2, real _radius, shared_ptr<material> _material)
         : center1(_center1), radius(_radius), mat(_material), is_moving(true) 
         {
             vec3 rvec = vec3(radius, radius, radius);
@@ -25,40 +26,72 @@ public:
         }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        point3 center = is_moving ? sphere_center(r.time()) : center1; 
-        vec3 oc = r.origin() - center;
-        double a = r.direction().length_squared();
-        double half_b = dot(oc, r.direction());
-        double c = oc.length_squared() - radius * radius;
-        double discriminant = half_b * half_b - a * c;
-
-        if(discriminant < 0){;
+        point3 center = is_moving ? sphere_center(r.time()) : center1;
+        real root;
+        if(!hit_root(r, ray_t, center, radius, root)){
             return false;
         }
 
-        double sqrtd = sqrt(discriminant);
-        double root = (-half_b - sqrtd) / a;
-        if(!ray_t.surrounds(root)){
-            root = (-half_b + sqrtd) / a;
-            if(!ray_t.surrounds(root))
-                return false;
+        set_record(r, root, center, rec);
+        return true;
+    }
+
+    // the same roots without the record, no normal or uv
+    bool occluded(const ray& r, interval ray_t) const override {
+        real near_root, far_root;
+        return roots(r, is_moving ? sphere_center(r.time()) : center1, radius, near_root, far_root)
+            && (ray_t.surrounds(near_root) || ray_t.surrounds(far_root));
+    }
+
+    // both roots at once
+    bool entry_exit(const ray& r, interval& inside) const override {
+        return crossing(r, is_moving ? sphere_center(r.time()) : center1, radius, inside);
+    }
+
+    uint32_t hit_packet(ray_lanes& rays, uint32_t active) const override {
+        real roots[32];
+        bool found[32];
+
+        // no branches in here so the lanes can be computed side by side
+        for(int k = 0; k < rays.n; ++k){
+            real t = is_moving ? rays.time[k] : 0;
+            real ocx = rays.orig[0][k] - (center1[0] + t * center_vec[0]);
+            real ocy = rays.orig[1][k] - (center1[1] + t * center_vec[1]);
+            real ocz = rays.orig[2][k] - (center1[2] + t * center_vec[2]);
+            real dx = rays.dir[0][k], dy = rays.dir[1][k], dz = rays.dir[2][k];
+
+            real a = dx * dx + dy * dy + dz * dz;
+            real half_b = ocx * dx + ocy * dy + ocz * dz;
+            real c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+            real discriminant = half_b * half_b - a * c;
+
+            real sqrtd = sqrt(discriminant > 0 ? discriminant : 0);
+            real near_root = (-half_b - sqrtd) / a;
+            real far_root = (-half_b + sqrtd) / a;
+            bool near_ok = near_root > rays.tmin && near_root < rays.tmax[k];
+            bool far_ok = far_root > rays.tmin && far_root < rays.tmax[k];
+
+            roots[k] = near_ok ? near_root : far_root;
+            found[k] = discriminant >= 0 && (near_ok || far_ok);
         }
 
-        rec.t = root;
-        rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p - center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat = mat;
+        uint32_t hits = 0;
+        for(int k = 0; k < rays.n; ++k){
+            if(!found[k] || !(active & (1u << k))) continue;
 
-        return true;
+            ray r = rays.get(k);
+            set_record(r, roots[k], is_moving ? sphere_center(r.time()) : center1, rays.recs[k]);
+            rays.tmax[k] = roots[k];
+            hits |= 1u << k;
+        }
+        return hits;
     }
 
     aabb bounding_box() const override {
         return bbox;
     }
 
-    double pdf_value(const point3& o, const vec3& v) const override {
+    real pdf_value(const point3& o, const vec3& v) const override {
         // Only for stationary
 
         hit_record rec;
@@ -66,47 +99,145 @@ public:
             return 0;
         }
 
-        double cos_theta_max = sqrt(1 - radius * radius / (center1 - o).length_squared());
-        double solid_angle = 2 * pi * (1 - cos_theta_max);
+        real cos_theta_max = sqrt(1 - radius * radius / (center1 - o).length_squared());
+        real solid_angle = 2 * pi * (1 - cos_theta_max);
 
         return 1 / solid_angle;
     }
 
     vec3 random(const point3& o) const override {
         vec3 direction = center1 - o;
-        double distance_squared = direction.length_squared();
+        real distance_squared = direction.length_squared();
         onb uvw;
         uvw.build_from_w(direction);
         return uvw.local(random_to_sphere(radius, distance_squared));
     }
 
+    real power() const override {
+        return mat ? luminance(mat->emission()) * 4 * pi * radius * radius * pi : 0;
+    }
+
+    // the kernels below are what every sphere is hit with, sphere_set's and the scene cache's too
+
+    // where r meets the sphere, near_root first, false when it misses
+    static bool roots(const ray& r, const point3& center, real radius, real& near_root, real& far_root){
+        vec3 oc = r.origin() - center;
+        real a = r.direction().length_squared();
+        real half_b = dot(oc, r.direction());
+        real c = oc.length_squared() - radius * radius;
+        real discriminant = half_b * half_b - a * c;
+        if(discriminant < 0){
+            return false;
+        }
+
+        real sqrtd = sqrt(discriminant);
+        near_root = (-half_b - sqrtd) / a;
+        far_root = (-half_b + sqrtd) / a;
+        return true;
+    }
+
+    // the nearest root inside ray_t
+    static bool hit_root(const ray& r, interval ray_t, const point3& center, real radius, real& root){
+        real near_root, far_root;
+        if(!roots(r, center, radius, near_root, far_root)){
+            return false;
+        }
+
+        root = near_root;
+        if(!ray_t.surrounds(root)){
+            root = far_root;
+            if(!ray_t.surrounds(root))
+                return false;
+        }
+        return true;
+    }
+
+    // the stretch of r inside the sphere, a ray only touching it doesn't go in
+    static bool crossing(const ray& r, const point3& center, real radius, interval& inside){
+        real near_root, far_root;
+        if(!roots(r, center, radius, near_root, far_root) || !(near_root < far_root)){
+            return false;
+        }
+
+        inside = interval(near_root, far_root);
+        return true;
+    }
+
+    // t, p, normal and material of the hit at root, returns the outward unit normal
+    static vec3 set_hit(const ray& r, real root, const point3& center, real radius, const material* mat, hit_record& rec){
+        rec.t = root;
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - center) / radius;
+        rec.set_face_normal(r, outward_normal);
+        rec.mat = mat;
+        return outward_normal;
+    }
+
+    // uv and partials at the point p of the unit sphere
+    static void set_surface(const point3& p, real radius, hit_record& rec){
+        get_sphere_uv(p, rec.u, rec.v);
+        get_sphere_partials(p, radius, rec.dpdu, rec.dpdv);
+    }
+
+    // p is a point on the unit sphere
+    static void get_sphere_uv(const point3& p, real& u, real& v){
+        real theta = acos(-p.y());
+        real phi = atan2(-p.z(), p.x()) + pi;
+        u = phi / (2 * pi);
+        v = theta / pi;
+    }
+
+    // dp/du and dp/dv of get_sphere_uv's mapping at the point p on the unit sphere, scaled to radius
+    // u goes around the y axis and v from the bottom to the top, both vanish at the poles
+    static void get_sphere_partials(const point3& p, real radius, vec3& dpdu, vec3& dpdv){
+        real ring = sqrt(p.x() * p.x() + p.z() * p.z());
+        dpdu = 2 * pi * radius * vec3(p.z(), 0, -p.x());
+        dpdv = ring > 0 ? pi * radius * vec3(-p.y() * p.x() / ring, ring, -p.y() * p.z() / ring) : vec3(0, 0, 0);
+    }
+
+    // at time 0
+    const point3& get_center() const {
+        return center1;
+    }
+
+    // from time 0 to 1, 0 for a sphere that stays put
+    const vec3& get_motion() const {
+        return center_vec;
+    }
+
+    real get_radius() const {
+        return radius;
+    }
+
+    shared_ptr<material> get_material() const {
+        return mat;
+    }
+
 private:
     point3 center1;
-    double radius;
+    real radius;
     shared_ptr<material> mat;
     bool is_moving;
     vec3 center_vec;
     aabb bbox;
 
-    point3 sphere_center(double time) const {
-        return center1 + time*center_vec;
+    void set_record(const ray& r, real root, const point3& center, hit_record& rec) const {
+        set_surface(set_hit(r, root, center, radius, mat.get(), rec), radius, rec);
     }
 
-    static void get_sphere_uv(const point3& p, double& u, double& v){
-        double theta = acos(-p.y());
-        double phi = atan2(-p.z(), p.x()) + pi;
-        u = phi / (2 * pi);
-        v = theta / pi;
+    point3 sphere_center(real time) const {
+        return center1 + time*center_vec;
     }
 
-    static vec3 random_to_sphere(double radius, double distance_squared){
-        double r1 = random_double();
-        double r2 = random_double();
-        double z = 1 + r2 * (sqrt(1 - radius * radius / distance_squared) - 1);
+    static vec3 random_to_sphere(real radius, real distance_squared){
+        sample2 s = sample_2d();
+        real r1 = s.x;
+        real r2 = s.y;
+        real z = 1 + r2 * (sqrt(1 - radius * radius / distance_squared) - 1);
 
-        double phi = 2 * pi * r1;
-        double x = cos(phi) * sqrt(1 - z * z);
-        double y = sin(phi) * sqrt(1 - z * z);
+        real phi = 2 * pi * r1;
+        real x = cos(phi) * sqrt(1 - z * z);
+        real y = sin(phi) * sqrt(1 - z * z);
 
         return vec3(x, y, z);
     }
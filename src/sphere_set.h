@@ -0,0 +1,266 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "blines.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "simd.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+// many spheres as one hittable, kept in structure of arrays form
+// spheres are grouped by position into groups of up to group_size, every group is tested
+// against a ray in vreal_width lanes at a time and a bvh over the groups finds them,
+// so a leaf costs one virtual call instead of one per sphere
+// add every sphere, then call build()
+class sphere_set : public hittable {
+public:
+    static const int group_size = 8;
+
+    sphere_set() {}
+
+    // the groups point back at the set
+    sphere_set(const sphere_set&) = delete;
+    sphere_set& operator=(const sphere_set&) = delete;
+
+    void add(point3 center, real radius, shared_ptr<material> mat){
+        add(center, center, radius, mat);
+    }
+
+    // moving from center1 at time 0 to center2 at time 1
+    void add(point3 center1, point3 center2, real radius, shared_ptr<material> mat){
+        centers.push_back(center1);
+        motions.push_back(center2 - center1);
+        radii.push_back(radius);
+        mats.push_back(material_index(mat));
+    }
+
+    void build(){
+        std::vector<int> order(centers.size());
+        std::iota(order.begin(), order.end(), 0);
+
+        if(!order.empty()){
+            hittable_list group_list;
+            split(order, 0, static_cast<int>(order.size()), group_list);
+            groups = make_shared<bvh_node>(group_list, bvh_split::sah, true, 1);
+        }
+
+        centers.clear();
+        motions.clear();
+        radii.clear();
+        mats.clear();
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // heap bytes of the arrays, the groups and their bvh
+    size_t memory_bytes() const {
+        size_t lanes = cx.capacity() + cy.capacity() + cz.capacity() + mx.capacity() + my.capacity() + mz.capacity()
+                     + radius.capacity();
+        size_t bytes = lanes * sizeof(real) + mat_index.capacity() * sizeof(int)
+                     + materials.capacity() * sizeof(shared_ptr<material>);
+        // make_shared puts the control block next to the group, two pointers on top of it
+        bytes += cx.size() / group_size * (sizeof(sphere_group) + 2 * sizeof(void*));
+        if(groups){
+            bytes += static_cast<const bvh_node&>(*groups).memory_bytes();
+        }
+        return bytes;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return groups && groups->hit(r, ray_t, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return groups && groups->occluded(r, ray_t);
+    }
+
+    uint32_t hit_packet(ray_lanes& rays, uint32_t active) const override {
+        return groups ? groups->hit_packet(rays, active) : 0;
+    }
+
+    aabb bounding_box() const override {
+        return groups ? groups->bounding_box() : aabb();
+    }
+
+    // sphere i < size() after build(), in the order of the groups
+    // only the last group is padded, so the first size() lanes are the spheres
+    point3 get_center(size_t i) const {
+        return point3(cx[i], cy[i], cz[i]);
+    }
+
+    vec3 get_motion(size_t i) const {
+        return vec3(mx[i], my[i], mz[i]);
+    }
+
+    real get_radius(size_t i) const {
+        return radius[i];
+    }
+
+    shared_ptr<material> get_material(size_t i) const {
+        return materials[mat_index[i]];
+    }
+
+private:
+
+    // one group is a slice of group_size lanes of the arrays below, unused lanes are masked out
+    class sphere_group : public hittable {
+    public:
+        sphere_group(const sphere_set* _set, int _first, int _count, const aabb& _bbox)
+          : set(_set), first(_first), count(_count), bbox(_bbox) {}
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            return set->hit_group(first, count, r, ray_t, rec);
+        }
+
+        aabb bounding_box() const override {
+            return bbox;
+        }
+
+    private:
+        const sphere_set* set;
+        int first;
+        int count;
+        aabb bbox;
+    };
+
+    // input side, only until build()
+    std::vector<point3> centers;
+    std::vector<vec3> motions;
+    std::vector<real> radii;
+    std::vector<int> mats;
+
+    // grouped side, padded to whole groups
+    std::vector<real> cx, cy, cz;
+    std::vector<real> mx, my, mz;
+    std::vector<real> radius;
+    std::vector<int> mat_index;
+    std::vector<shared_ptr<material>> materials;
+    size_t count = 0;
+
+    shared_ptr<hittable> groups;
+
+    int material_index(const shared_ptr<material>& mat){
+        for(size_t m = 0; m < materials.size(); ++m){
+            if(materials[m] == mat) return static_cast<int>(m);
+        }
+        materials.push_back(mat);
+        return static_cast<int>(materials.size() - 1);
+    }
+
+    aabb sphere_box(int s) const {
+        vec3 rvec(radii[s], radii[s], radii[s]);
+        aabb box1(centers[s] - rvec, centers[s] + rvec);
+        aabb box2(centers[s] + motions[s] - rvec, centers[s] + motions[s] + rvec);
+        return aabb(box1, box2);
+    }
+
+    // median splits along the widest axis of the centers until a range fits in a group
+    void split(std::vector<int>& order, int start, int end, hittable_list& group_list){
+        if(end - start <= group_size){
+            add_group(order, start, end, group_list);
+            return;
+        }
+
+        aabb extent;
+        for(int k = start; k < end; ++k){
+            extent = aabb(extent, aabb(centers[order[k]], centers[order[k]]));
+        }
+        int axis = 0;
+        if(extent.y.size() > extent.axis(axis).size()) axis = 1;
+        if(extent.z.size() > extent.axis(axis).size()) axis = 2;
+
+        // whole groups on the left so only the last group of the set is ever partly empty
+        int mid = start + ((end - start) / 2 + group_size - 1) / group_size * group_size;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](int a, int b){
+            return centers[a][axis] < centers[b][axis];
+        });
+        split(order, start, mid, group_list);
+        split(order, mid, end, group_list);
+    }
+
+    void add_group(const std::vector<int>& order, int start, int end, hittable_list& group_list){
+        int first = static_cast<int>(cx.size());
+        aabb bbox;
+        for(int lane = 0; lane < group_size; ++lane){
+            int s = order[start + std::min(lane, end - start - 1)]; // padding repeats the last sphere
+            cx.push_back(centers[s].x());
+            cy.push_back(centers[s].y());
+            cz.push_back(centers[s].z());
+            mx.push_back(motions[s].x());
+            my.push_back(motions[s].y());
+            mz.push_back(motions[s].z());
+            radius.push_back(radii[s]);
+            mat_index.push_back(mats[s]);
+            bbox = aabb(bbox, sphere_box(s));
+        }
+        count += end - start;
+        group_list.add(make_shared<sphere_group>(this, first, end - start, bbox));
+    }
+
+    bool hit_group(int first, int n, const ray& r, interval ray_t, hit_record& rec) const {
+        const point3& o = r.origin();
+        const vec3& d = r.direction();
+        const vreal ox = vr_set(o.x()), oy = vr_set(o.y()), oz = vr_set(o.z());
+        const vreal dx = vr_set(d.x()), dy = vr_set(d.y()), dz = vr_set(d.z());
+        const vreal time = vr_set(r.time());
+        const real a = d.length_squared();
+        const vreal va = vr_set(a);
+        const vreal inv_a = vr_set(1 / a);
+        const vreal tmin = vr_set(ray_t.min);
+        const vreal zero = vr_set(0);
+
+        int best = -1;
+        real best_t = ray_t.max;
+        for(int k = 0; k < n; k += vreal_width){
+            int i = first + k;
+            const vreal tmax = vr_set(best_t);
+
+            vreal ocx = vr_sub(vr_add(vr_load(&cx[i]), vr_mul(time, vr_load(&mx[i]))), ox);
+            vreal ocy = vr_sub(vr_add(vr_load(&cy[i]), vr_mul(time, vr_load(&my[i]))), oy);
+            vreal ocz = vr_sub(vr_add(vr_load(&cz[i]), vr_mul(time, vr_load(&mz[i]))), oz);
+            vreal rad = vr_load(&radius[i]);
+
+            // oc points from the origin to the center here, so the near root is (h - sqrtd) / a
+            vreal h = vr_add(vr_add(vr_mul(dx, ocx), vr_mul(dy, ocy)), vr_mul(dz, ocz));
+            vreal c = vr_sub(vr_add(vr_add(vr_mul(ocx, ocx), vr_mul(ocy, ocy)), vr_mul(ocz, ocz)), vr_mul(rad, rad));
+            vreal discriminant = vr_sub(vr_mul(h, h), vr_mul(va, c));
+
+            vreal sqrtd = vr_sqrt(vr_max(discriminant, zero));
+            vreal near_root = vr_mul(vr_sub(h, sqrtd), inv_a);
+            vreal far_root = vr_mul(vr_add(h, sqrtd), inv_a);
+            vmask near_ok = vr_and(vr_less(tmin, near_root), vr_less(near_root, tmax));
+            vmask far_ok = vr_and(vr_less(tmin, far_root), vr_less(far_root, tmax));
+            vmask found = vr_and(vr_less_equal(zero, discriminant), vr_or(near_ok, far_ok));
+
+            int bits = vr_bits(found) & ((1 << std::min(vreal_width, n - k)) - 1);
+            if(!bits) continue;
+
+            real roots[vreal_width];
+            vr_store(roots, vr_select(near_ok, near_root, far_root));
+            for(int lane = 0; lane < vreal_width; ++lane){
+                if((bits & (1 << lane)) && roots[lane] < best_t){
+                    best_t = roots[lane];
+                    best = i + lane;
+                }
+            }
+        }
+
+        if(best < 0){
+            return false;
+        }
+
+        point3 center = point3(cx[best], cy[best], cz[best]) + r.time() * vec3(mx[best], my[best], mz[best]);
+        vec3 outward_normal = sphere::set_hit(r, best_t, center, radius[best], materials[mat_index[best]].get(), rec);
+        sphere::set_surface(outward_normal, radius[best], rec);
+        return true;
+    }
+};
+
+#endif
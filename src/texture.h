@@ -4,22 +4,35 @@
 #include "blines.h"
 #include "rtw_stb_image.h"
 #include "color.h"
+#include "hittable.h"
 #include "perlin.h"
 
+#include <algorithm>
+#include <vector>
+
 class texture{
 public:
     virtual ~texture() = default;
 
-    virtual color value(double u, double v, const point3& p) const = 0;
+    virtual color value(real u, real v, const point3& p) const = 0;
+
+    // averaged over the footprint of rec's uv derivatives, for textures that can filter
+    virtual color filtered_value(const hit_record& rec) const {
+        return value(rec.u, rec.v, rec.p);
+    }
 };
 
 class solid_color : public texture{
 public:
     solid_color(color c) : color_value(c) {}
 
-    solid_color(double red, double green, double blue) : color_value(color(red, green, blue)) {} 
+    solid_color(real red, real green, real blue) : color_value(color(red, green, blue)) {} 
+
+    color value(real u, real v, const point3& p) const override {
+        return color_value;
+    }
 
-    color value(double u, double v, const point3& p) const override {
+    const color& get_color() const {
         return color_value;
     }
 
@@ -29,63 +42,283 @@ private:
 
 class checker_texture : public texture {
 public:
-    checker_texture(double _scale, shared_ptr<texture> _even, shared_ptr<texture> _odd)
+    checker_texture(real _scale, shared_ptr<texture> _even, shared_ptr<texture> _odd)
         : inv_scale(1.0 / _scale), even(_even), odd(_odd) {}
 
-    checker_texture(double _scale, color c1, color c2)
+    checker_texture(real _scale, color c1, color c2)
         : inv_scale(1.0 / _scale), 
         even(make_shared<solid_color>(c1)), 
         odd(make_shared<solid_color>(c2)) {}
 
-    color value(double u, double v, const point3& p) const override {
+    color value(real u, real v, const point3& p) const override {
+        return is_odd(p) ? odd->value(u, v, p) : even->value(u, v, p);
+    }
+
+    color filtered_value(const hit_record& rec) const override {
+        return is_odd(rec.p) ? odd->filtered_value(rec) : even->filtered_value(rec);
+    }
+
+    // takes the inverse of the scale as it is kept, 1 / (1 / x) can be off by an ulp
+    static shared_ptr<checker_texture> from_inv_scale(real inv_scale, shared_ptr<texture> even, shared_ptr<texture> odd){
+        auto checker = make_shared<checker_texture>(1, even, odd);
+        checker->inv_scale = inv_scale;
+        return checker;
+    }
+
+    real get_inv_scale() const {
+        return inv_scale;
+    }
+
+    shared_ptr<texture> get_even() const {
+        return even;
+    }
+
+    shared_ptr<texture> get_odd() const {
+        return odd;
+    }
+
+private:
+
+    // which of the two textures the cell holding p gets
+    bool is_odd(const point3& p) const {
         auto xint = static_cast<int>(std::floor(inv_scale * p.x()));
         auto yint = static_cast<int>(std::floor(inv_scale * p.y()));
         auto zint = static_cast<int>(std::floor(inv_scale * p.z()));
 
-        bool is_odd = (xint + yint + zint) % 2;
-    
-        return is_odd ? odd->value(u, v, p) : even->value(u, v, p);
+        return (xint + yint + zint) % 2;
     }
-private:
-    double inv_scale;
+
+    real inv_scale;
     shared_ptr<texture> even;
     shared_ptr<texture> odd;
 };
 
+// the image becomes a mip pyramid when it loads: linear float texels (the 8 bit values are decoded
+// with the gamma of the writers, so an image lit by white light comes out as it went in), every level
+// a 2x2 box filter of the one before, in 4x4 tiles so a bilinear lookup mostly stays in one tile
+// value() is bilinear on the full image, filtered_value() is trilinear: the two levels around the
+// texel size of the pixel footprint, blended
 class image_texture : public texture {
 public:
-    image_texture(const char* filename) : image(filename) {}
+    // the decoded bytes are only kept until the pyramid is built
+    image_texture(const char* filename) {
+        build_pyramid(rtw_image(filename));
+    }
+
+    // a view of the texels get_texels() gave for a width x height image, they are not copied
+    // and have to outlive the texture
+    image_texture(const float* texels, int width, int height) : mapped(texels) {
+        if(width > 0 && height > 0) layout_levels(width, height);
+    }
 
-    color value(double u, double v, const point3& p) const override {
-        if(image.height() <= 0) return color(0, 1, 1);
+    color value(real u, real v, const point3& p) const override {
+        if(levels.empty()) return color(0, 1, 1);
+        return bilinear(levels[0], u, v);
+    }
+
+    color filtered_value(const hit_record& rec) const override {
+        if(levels.empty()) return color(0, 1, 1);
+
+        // texels of the full image the footprint spans along its longer side
+        real du = std::max(std::fabs(rec.dudx), std::fabs(rec.dudy)) * levels[0].width;
+        real dv = std::max(std::fabs(rec.dvdx), std::fabs(rec.dvdy)) * levels[0].height;
+        real texels = std::max(du, dv);
+        if(!(texels > 1)){
+            return bilinear(levels[0], rec.u, rec.v);
+        }
+
+        real lod = std::min(std::log2(texels), static_cast<real>(levels.size() - 1));
+        int level = std::min(static_cast<int>(lod), static_cast<int>(levels.size()) - 2);
+        if(level < 0){
+            return bilinear(levels[0], rec.u, rec.v);
+        }
+        real t = lod - level;
+        return (1 - t) * bilinear(levels[level], rec.u, rec.v) + t * bilinear(levels[level + 1], rec.u, rec.v);
+    }
 
+    // of the full image, 0 when it could not be loaded
+    int get_width() const {
+        return levels.empty() ? 0 : levels[0].width;
+    }
+
+    int get_height() const {
+        return levels.empty() ? 0 : levels[0].height;
+    }
+
+    // every mip level one after the other, get_texel_count() floats
+    const float* get_texels() const {
+        return texels();
+    }
+
+    size_t get_texel_count() const {
+        return levels.empty() ? 0 : levels.back().offset + levels.back().size();
+    }
+
+private:
+    static const int tile_size = 4;
+
+    // rgb texels in tile_size x tile_size tiles, from offset on in the pyramid
+    struct mip_level {
+        int width = 0;
+        int height = 0;
+        int tiles_x = 0;
+        size_t offset = 0;
+
+        mip_level(int _width, int _height, size_t _offset)
+          : width(_width), height(_height), tiles_x((_width + tile_size - 1) / tile_size), offset(_offset) {}
+
+        size_t size() const {
+            return static_cast<size_t>(tiles_x) * ((height + tile_size - 1) / tile_size) * tile_size * tile_size * 3;
+        }
+
+        size_t index(int x, int y) const {
+            size_t tile = static_cast<size_t>(y / tile_size) * tiles_x + x / tile_size;
+            return offset + (tile * tile_size * tile_size + (y % tile_size) * tile_size + x % tile_size) * 3;
+        }
+    };
+
+    std::vector<mip_level> levels;
+    std::vector<float> owned;
+    const float* mapped = nullptr; // instead of owned for a view
+
+    const float* texels() const {
+        return mapped ? mapped : owned.data();
+    }
+
+    color texel(const mip_level& level, int x, int y) const {
+        const float* t = texels() + level.index(x, y);
+        return color(t[0], t[1], t[2]);
+    }
+
+    void set(const mip_level& level, int x, int y, const color& c){
+        float* t = &owned[level.index(x, y)];
+        for(int k = 0; k < 3; ++k) t[k] = static_cast<float>(c[k]);
+    }
+
+    // the levels from width x height halving down to 1x1, returns how many floats they take
+    size_t layout_levels(int width, int height){
+        levels.emplace_back(width, height, 0);
+        while(width > 1 || height > 1){
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+            levels.emplace_back(width, height, levels.back().offset + levels.back().size());
+        }
+        return levels.back().offset + levels.back().size();
+    }
+
+    void build_pyramid(const rtw_image& image){
+        int width = image.width(), height = image.height();
+        if(width <= 0 || height <= 0) return;
+
+        owned.assign(layout_levels(width, height), 0);
+        for(int y = 0; y < height; ++y){
+            for(int x = 0; x < width; ++x){
+                const unsigned char* pixel = image.pixel_data(x, y);
+                color c(pixel[0] / 255.0, pixel[1] / 255.0, pixel[2] / 255.0);
+                set(levels[0], x, y, c * c);
+            }
+        }
+
+        for(size_t l = 1; l < levels.size(); ++l){
+            const mip_level& fine = levels[l - 1];
+            const mip_level& coarse = levels[l];
+            for(int y = 0; y < coarse.height; ++y){
+                int y0 = std::min(2 * y, fine.height - 1), y1 = std::min(2 * y + 1, fine.height - 1);
+                for(int x = 0; x < coarse.width; ++x){
+                    int x0 = std::min(2 * x, fine.width - 1), x1 = std::min(2 * x + 1, fine.width - 1);
+                    set(coarse, x, y, 0.25 * (texel(fine, x0, y0) + texel(fine, x1, y0) + texel(fine, x0, y1) + texel(fine, x1, y1)));
+                }
+            }
+        }
+    }
+
+    // texel centers sit at half integers, edges clamp
+    color bilinear(const mip_level& level, real u, real v) const {
         u = interval(0, 1).clamp(u);
         v = 1.0 - interval(0, 1).clamp(v);
 
-        int i = static_cast<int>(u * image.width());
-        int j = static_cast<int>(v * image.height());
-        const unsigned char* pixel = image.pixel_data(i, j);
+        real x = u * level.width - 0.5;
+        real y = v * level.height - 0.5;
+        int x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+        real fx = x - x0, fy = y - y0;
+        int x1 = std::min(x0 + 1, level.width - 1), y1 = std::min(y0 + 1, level.height - 1);
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
 
-        double color_scale = 1.0 / 255.0;
-        return color_scale * color(pixel[0], pixel[1], pixel[2]);
+        return (1 - fy) * ((1 - fx) * texel(level, x0, y0) + fx * texel(level, x1, y0))
+             + fy * ((1 - fx) * texel(level, x0, y1) + fx * texel(level, x1, y1));
     }
-private:
-    rtw_image image;
 };
 
 class noise_texture : public texture {
 public:
     noise_texture() : scale(1) {}
-    noise_texture(double sc) : scale(sc) {}
+    noise_texture(real sc) : scale(sc) {}
+    noise_texture(real sc, perlin _noise) : noise(std::move(_noise)), scale(sc) {}
 
-    color value(double u, double v, const point3& p) const override {
+    color value(real u, real v, const point3& p) const override {
         point3 s = scale * p;
-        // return noise.turb(s) * color(1, 1, 1);
-        return 0.5 * (1 + sin(s.z() + 10 * noise.turb(s))) * color(1, 1, 1);
+        real turb = volume && volume->contains(s) ? volume->value(s) : noise.turb(s);
+        // return turb * color(1, 1, 1);
+        return 0.5 * (1 + sin(s.z() + 10 * turb)) * color(1, 1, 1);
     }
+
+    // turb comes from a volume over bounds (in world space) built now, outside of it it's still evaluated
+    // resolution is in cells along the longest side, a cell takes 4 bytes
+    void bake(const aabb& bounds, int resolution = 128){
+        bake_bounds = bounds;
+        bake_resolution = resolution;
+        point3 low(bounds.x.min, bounds.y.min, bounds.z.min);
+        point3 high(bounds.x.max, bounds.y.max, bounds.z.max);
+        volume = make_shared<turbulence_volume>(noise, aabb(scale * low, scale * high), resolution);
+    }
+
+    // what bake(bounds, resolution) makes, from get_baked_samples() of a texture with the same noise
+    // and scale, the samples are not copied and have to outlive the texture
+    void use_baked(const aabb& bounds, int resolution, const float* samples){
+        bake_bounds = bounds;
+        bake_resolution = resolution;
+        point3 low(bounds.x.min, bounds.y.min, bounds.z.min);
+        point3 high(bounds.x.max, bounds.y.max, bounds.z.max);
+        volume = make_shared<turbulence_volume>(samples, aabb(scale * low, scale * high), resolution);
+    }
+
+    size_t memory() const {
+        return volume ? volume->memory() : 0;
+    }
+
+    const perlin& get_noise() const {
+        return noise;
+    }
+
+    real get_scale() const {
+        return scale;
+    }
+
+    // 0 when it isn't baked
+    int get_bake_resolution() const {
+        return bake_resolution;
+    }
+
+    const aabb& get_bake_bounds() const {
+        return bake_bounds;
+    }
+
+    // null when it isn't baked
+    const float* get_baked_samples() const {
+        return volume ? volume->get_samples() : nullptr;
+    }
+
+    size_t get_baked_sample_count() const {
+        return volume ? volume->sample_count() : 0;
+    }
+
 private:
     perlin noise;
-    double scale = 1;
+    real scale = 1;
+    shared_ptr<const turbulence_volume> volume;
+    aabb bake_bounds;
+    int bake_resolution = 0;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,127 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed set of worker threads for bulk jobs
+// every worker owns a queue of items, works from the back of its own
+// and steals from the front of the others once it runs dry
+class thread_pool {
+public:
+    // threads <= 0 means one per hardware thread
+    thread_pool(int threads = 0) : queues(threads > 0 ? threads : default_size()) {
+        for(int i = 0; i < size(); ++i){
+            workers.emplace_back(&thread_pool::worker_loop, this, i);
+        }
+    }
+
+    ~thread_pool(){
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(std::thread& worker : workers){
+            worker.join();
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const {
+        return static_cast<int>(queues.size());
+    }
+
+    static int default_size(){
+        return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+
+    // calls body(item, worker) for every item in [0, count) and blocks until all are done
+    // body must not call parallel_for on the same pool
+    void parallel_for(int count, const std::function<void(int, int)>& body){
+        for(int i = 0; i < count; ++i){
+            work_queue& q = queues[i % size()];
+            std::lock_guard<std::mutex> lock(q.m);
+            q.items.push_back(i);
+        }
+
+        std::unique_lock<std::mutex> lock(state_mutex);
+        job = &body;
+        busy = size();
+        ++generation;
+        wake.notify_all();
+        done.wait(lock, [this]{ return busy == 0; });
+        job = nullptr;
+    }
+
+private:
+    struct work_queue {
+        std::mutex m;
+        std::deque<int> items;
+    };
+
+    std::vector<work_queue> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex state_mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int, int)>* job = nullptr;
+    unsigned long generation = 0;
+    int busy = 0;
+    bool stopping = false;
+
+    bool pop_own(int id, int& item){
+        work_queue& q = queues[id];
+        std::lock_guard<std::mutex> lock(q.m);
+        if(q.items.empty()) return false;
+        item = q.items.back();
+        q.items.pop_back();
+        return true;
+    }
+
+    bool steal(int id, int& item){
+        for(int k = 1; k < size(); ++k){
+            work_queue& q = queues[(id + k) % size()];
+            std::lock_guard<std::mutex> lock(q.m);
+            if(q.items.empty()) continue;
+            item = q.items.front();
+            q.items.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void worker_loop(int id){
+        unsigned long seen = 0;
+        while(true){
+            const std::function<void(int, int)>* body;
+            {
+                std::unique_lock<std::mutex> lock(state_mutex);
+                wake.wait(lock, [&]{ return stopping || generation != seen; });
+                if(stopping) return;
+                seen = generation;
+                body = job;
+            }
+
+            int item;
+            while(pop_own(id, item) || steal(id, item)){
+                (*body)(item, id);
+            }
+
+            std::lock_guard<std::mutex> lock(state_mutex);
+            if(--busy == 0){
+                done.notify_one();
+            }
+        }
+    }
+};
+
+#endif
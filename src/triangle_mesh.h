@@ -0,0 +1,532 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "blines.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+// indices into the mesh buffers, -1 where the file gave no normal or uv
+struct mesh_face {
+    uint32_t v[3];
+    int32_t n[3];
+    int32_t t[3];
+};
+
+struct mesh_uv {
+    real u, v;
+};
+
+// dp/du and dp/dv of the triangle p0 p1 p2 with those uvs at its corners, 0 for degenerate uvs
+inline void triangle_partials(const point3& p0, const point3& p1, const point3& p2, real u0, real v0,
+                              real u1, real v1, real u2, real v2, vec3& dpdu, vec3& dpdv){
+    real du02 = u0 - u2, dv02 = v0 - v2, du12 = u1 - u2, dv12 = v1 - v2;
+    real det = du02 * dv12 - dv02 * du12;
+    if(std::fabs(det) < 1e-12){
+        dpdu = dpdv = vec3(0, 0, 0);
+        return;
+    }
+    vec3 dp02 = p0 - p2, dp12 = p1 - p2;
+    dpdu = (dv12 * dp02 - dv02 * dp12) / det;
+    dpdv = (du02 * dp12 - du12 * dp02) / det;
+}
+
+// indexed triangles sharing vertex, normal and uv buffers, one material for the whole mesh
+// like sphere_set the triangles are grouped by position, every group is intersected
+// vreal_width lanes at a time (watertight, woop et al. 2013) and a bvh finds the groups,
+// so there is one allocation per group and none per triangle
+// fill the buffers, then call build()
+class triangle_mesh : public hittable {
+public:
+    static const int group_size = 8;
+
+    std::vector<point3> positions;
+    std::vector<vec3> normals;
+    std::vector<mesh_uv> uvs;
+    std::vector<mesh_face> faces;
+
+    triangle_mesh(shared_ptr<material> _mat) : mat(_mat) {}
+
+    // the groups point back at the mesh
+    triangle_mesh(const triangle_mesh&) = delete;
+    triangle_mesh& operator=(const triangle_mesh&) = delete;
+
+    void build(){
+        std::vector<uint32_t> order(faces.size());
+        std::iota(order.begin(), order.end(), 0);
+
+        std::vector<point3> centers(faces.size());
+        for(size_t f = 0; f < faces.size(); ++f){
+            const mesh_face& face = faces[f];
+            centers[f] = (positions[face.v[0]] + positions[face.v[1]] + positions[face.v[2]]) / 3;
+        }
+
+        size_t lanes = (faces.size() / group_size + 1) * group_size;
+        corners.clear();
+        corners.reserve(9 * lanes);
+        face_index.clear();
+        face_index.reserve(lanes);
+
+        if(!faces.empty()){
+            hittable_list group_list;
+            group_list.objects.reserve(faces.size() / group_size + 1);
+            split(order, centers, 0, order.size(), group_list);
+            groups = make_shared<bvh_node>(group_list, bvh_split::sah, true, 1);
+            group_count = group_list.objects.size();
+        }
+    }
+
+    size_t triangle_count() const {
+        return faces.size();
+    }
+
+    // heap bytes of the buffers, the intersection copy of the corners, the groups and their bvh
+    size_t memory_bytes() const {
+        size_t bytes = positions.capacity() * sizeof(point3) + normals.capacity() * sizeof(vec3)
+                     + uvs.capacity() * sizeof(mesh_uv) + faces.capacity() * sizeof(mesh_face)
+                     + face_index.capacity() * sizeof(uint32_t) + corners.capacity() * sizeof(real);
+        // make_shared puts the control block next to the group, two pointers on top of it
+        bytes += group_count * (sizeof(triangle_group) + 2 * sizeof(void*));
+        if(groups){
+            bytes += static_cast<const bvh_node&>(*groups).memory_bytes();
+        }
+        return bytes;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return groups && groups->hit(r, ray_t, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return groups && groups->occluded(r, ray_t);
+    }
+
+    uint32_t hit_packet(ray_lanes& rays, uint32_t active) const override {
+        return groups ? groups->hit_packet(rays, active) : 0;
+    }
+
+    aabb bounding_box() const override {
+        return groups ? groups->bounding_box() : aabb();
+    }
+
+    // the kernels below are what every triangle is hit with, hit_group runs hit_triangle's test on
+    // vreal_width triangles side by side and the scene cache one triangle at a time
+
+    // the ray turned into +z and sheared to unit length there, the edge tests are then 2d
+    // and every triangle sharing an edge computes it exactly the same way
+    struct sheared_ray {
+        int kx, ky, kz;
+        real sx, sy, sz;
+        point3 o;
+
+        sheared_ray(const ray& r) : o(r.origin()) {
+            const vec3& d = r.direction();
+            kz = 0;
+            if(fabs(d.y()) > fabs(d[kz])) kz = 1;
+            if(fabs(d.z()) > fabs(d[kz])) kz = 2;
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+            if(d[kz] < 0) std::swap(kx, ky);
+            sx = d[kx] / d[kz];
+            sy = d[ky] / d[kz];
+            sz = 1 / d[kz];
+        }
+    };
+
+    // the watertight test of woop et al., weight gets the barycentric weights of p0, p1 and p2
+    static bool hit_triangle(const sheared_ray& s, const point3& p0, const point3& p1, const point3& p2,
+                             interval ray_t, real& t, real weight[3]){
+        const point3* p[3] = {&p0, &p1, &p2};
+        real px[3], py[3], pz[3];
+        for(int c = 0; c < 3; ++c){
+            pz[c] = (*p[c])[s.kz] - s.o[s.kz];
+            px[c] = (*p[c])[s.kx] - s.o[s.kx] - s.sx * pz[c];
+            py[c] = (*p[c])[s.ky] - s.o[s.ky] - s.sy * pz[c];
+        }
+
+        real u = px[2] * py[1] - py[2] * px[1];
+        real v = px[0] * py[2] - py[0] * px[2];
+        real w = px[1] * py[0] - py[1] * px[0];
+        if((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+            return false;
+
+        real det = u + v + w;
+        if(det == 0)
+            return false;
+        t = s.sz * (u * pz[0] + v * pz[1] + w * pz[2]) / det;
+        if(!(ray_t.min < t && t < ray_t.max))
+            return false;
+
+        weight[0] = u / det;
+        weight[1] = v / det;
+        weight[2] = 1 - weight[0] - weight[1];
+        return true;
+    }
+
+    // the record of a hit with those weights, corner normals and uvs are null when the face has none
+    static void set_record(const ray& r, real t, const real weight[3], const point3& p0, const point3& p1,
+                           const point3& p2, const vec3* corner_normals, const mesh_uv* corner_uvs,
+                           const material* mat, hit_record& rec){
+        rec.t = t;
+        rec.p = r.at(rec.t);
+        rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+        if(corner_normals){
+            vec3 shading = weight[0] * corner_normals[0] + weight[1] * corner_normals[1] + weight[2] * corner_normals[2];
+            rec.normal = rec.front_face ? unit_vector(shading) : -unit_vector(shading);
+        }
+        if(corner_uvs){
+            rec.u = rec.v = 0;
+            for(int c = 0; c < 3; ++c){
+                rec.u += weight[c] * corner_uvs[c].u;
+                rec.v += weight[c] * corner_uvs[c].v;
+            }
+            const mesh_uv* t = corner_uvs;
+            triangle_partials(p0, p1, p2, t[0].u, t[0].v, t[1].u, t[1].v, t[2].u, t[2].v, rec.dpdu, rec.dpdv);
+        }else{
+            rec.u = weight[1];
+            rec.v = weight[2];
+            rec.dpdu = p1 - p0;
+            rec.dpdv = p2 - p0;
+        }
+        rec.mat = mat;
+    }
+
+    shared_ptr<material> get_material() const {
+        return mat;
+    }
+
+private:
+    class triangle_group : public hittable {
+    public:
+        triangle_group(const triangle_mesh* _mesh, uint32_t _first, int _count, const aabb& _bbox)
+          : mesh(_mesh), first(_first), count(_count), bbox(_bbox) {}
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            return mesh->hit_group(first, count, r, ray_t, rec);
+        }
+
+        aabb bounding_box() const override {
+            return bbox;
+        }
+
+    private:
+        const triangle_mesh* mesh;
+        uint32_t first;
+        int count;
+        aabb bbox;
+    };
+
+    shared_ptr<material> mat;
+
+    // per group, axis a of corner c for all its lanes is the row 3 * c + a of a 9 x group_size block,
+    // so a group is one contiguous piece of memory
+    std::vector<real> corners;
+    std::vector<uint32_t> face_index;
+    shared_ptr<hittable> groups;
+    size_t group_count = 0;
+
+    void split(std::vector<uint32_t>& order, const std::vector<point3>& centers, size_t start, size_t end,
+               hittable_list& group_list){
+        if(end - start <= group_size){
+            add_group(order, start, end, group_list);
+            return;
+        }
+
+        aabb extent;
+        for(size_t k = start; k < end; ++k){
+            extent = aabb(extent, aabb(centers[order[k]], centers[order[k]]));
+        }
+        int axis = 0;
+        if(extent.y.size() > extent.axis(axis).size()) axis = 1;
+        if(extent.z.size() > extent.axis(axis).size()) axis = 2;
+
+        size_t mid = start + ((end - start) / 2 + group_size - 1) / group_size * group_size;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b){
+            return centers[a][axis] < centers[b][axis];
+        });
+        split(order, centers, start, mid, group_list);
+        split(order, centers, mid, end, group_list);
+    }
+
+    void add_group(const std::vector<uint32_t>& order, size_t start, size_t end, hittable_list& group_list){
+        uint32_t first = static_cast<uint32_t>(face_index.size());
+        size_t block = corners.size();
+        corners.resize(block + 9 * group_size);
+        aabb bbox;
+        for(size_t lane = 0; lane < group_size; ++lane){
+            uint32_t f = order[start + std::min(lane, end - start - 1)]; // padding repeats the last triangle
+            face_index.push_back(f);
+            for(int c = 0; c < 3; ++c){
+                const point3& p = positions[faces[f].v[c]];
+                for(int a = 0; a < 3; ++a){
+                    corners[block + (3 * c + a) * group_size + lane] = p[a];
+                }
+                bbox = aabb(bbox, aabb(p, p));
+            }
+        }
+        group_list.add(make_shared<triangle_group>(this, first, static_cast<int>(end - start), bbox.pad()));
+    }
+
+    bool hit_group(uint32_t first, int n, const ray& r, interval ray_t, hit_record& rec) const {
+        // hit_triangle in lanes
+        const sheared_ray s(r);
+        const vreal ox = vr_set(s.o[s.kx]), oy = vr_set(s.o[s.ky]), oz = vr_set(s.o[s.kz]);
+        const vreal sx = vr_set(s.sx), sy = vr_set(s.sy), sz = vr_set(s.sz);
+        const vreal tmin = vr_set(ray_t.min);
+        const vreal zero = vr_set(0);
+
+        int best = -1;
+        real best_t = ray_t.max;
+        real best_weight[3] = {0, 0, 0};
+        const real* block = &corners[9 * static_cast<size_t>(first)];
+        for(int k = 0; k < n; k += vreal_width){
+            size_t i = first + k;
+            const vreal tmax = vr_set(best_t);
+
+            // corners relative to the origin, sheared
+            vreal px[3], py[3], pz[3];
+            for(int c = 0; c < 3; ++c){
+                pz[c] = vr_sub(vr_load(block + (3 * c + s.kz) * group_size + k), oz);
+                px[c] = vr_sub(vr_sub(vr_load(block + (3 * c + s.kx) * group_size + k), ox), vr_mul(sx, pz[c]));
+                py[c] = vr_sub(vr_sub(vr_load(block + (3 * c + s.ky) * group_size + k), oy), vr_mul(sy, pz[c]));
+            }
+
+            // edge functions, u belongs to corner 0, v to 1, w to 2
+            vreal u = vr_sub(vr_mul(px[2], py[1]), vr_mul(py[2], px[1]));
+            vreal v = vr_sub(vr_mul(px[0], py[2]), vr_mul(py[0], px[2]));
+            vreal w = vr_sub(vr_mul(px[1], py[0]), vr_mul(py[1], px[0]));
+            vmask negative = vr_or(vr_or(vr_less(u, zero), vr_less(v, zero)), vr_less(w, zero));
+            vmask positive = vr_or(vr_or(vr_less(zero, u), vr_less(zero, v)), vr_less(zero, w));
+
+            vreal det = vr_add(vr_add(u, v), w);
+            vreal scaled_t = vr_mul(sz, vr_add(vr_add(vr_mul(u, pz[0]), vr_mul(v, pz[1])), vr_mul(w, pz[2])));
+            vreal t = vr_div(scaled_t, det);
+            vmask nonzero = vr_or(vr_less(det, zero), vr_less(zero, det));
+            vmask in_range = vr_and(vr_less(tmin, t), vr_less(t, tmax));
+            vmask found = vr_andnot(vr_and(negative, positive), vr_and(nonzero, in_range));
+
+            int bits = vr_bits(found) & ((1 << std::min(vreal_width, n - k)) - 1);
+            if(!bits) continue;
+
+            real ts[vreal_width], us[vreal_width], vs[vreal_width], dets[vreal_width];
+            vr_store(ts, t);
+            vr_store(us, u);
+            vr_store(vs, v);
+            vr_store(dets, det);
+            for(int lane = 0; lane < vreal_width; ++lane){
+                if((bits & (1 << lane)) && ts[lane] < best_t){
+                    best_t = ts[lane];
+                    best = static_cast<int>(i) + lane;
+                    best_weight[0] = us[lane] / dets[lane];
+                    best_weight[1] = vs[lane] / dets[lane];
+                    best_weight[2] = 1 - best_weight[0] - best_weight[1];
+                }
+            }
+        }
+
+        if(best < 0){
+            return false;
+        }
+
+        const mesh_face& face = faces[face_index[best]];
+        vec3 corner_normals[3];
+        mesh_uv corner_uvs[3];
+        for(int c = 0; c < 3; ++c){
+            if(face.n[0] >= 0) corner_normals[c] = normals[face.n[c]];
+            if(face.t[0] >= 0) corner_uvs[c] = uvs[face.t[c]];
+        }
+        set_record(r, best_t, best_weight, positions[face.v[0]], positions[face.v[1]], positions[face.v[2]],
+                   face.n[0] >= 0 ? corner_normals : nullptr, face.t[0] >= 0 ? corner_uvs : nullptr, mat.get(), rec);
+        return true;
+    }
+};
+
+// reads the lines of an obj file into a mesh, see load_obj
+class obj_reader {
+public:
+    size_t skipped_faces = 0;
+
+    obj_reader(triangle_mesh& _mesh) : mesh(_mesh) {}
+
+    // [p, end) is one line without its newline
+    void line(const char* p, const char* end){
+        skip_spaces(p, end);
+        if(end - p < 2 || p[0] == '#') return;
+
+        if(p[0] == 'v' && is_space(p[1])){
+            p += 2;
+            real x = read_real(p, end), y = read_real(p, end), z = read_real(p, end);
+            mesh.positions.push_back(point3(x, y, z));
+        }else if(p[0] == 'v' && p[1] == 'n'){
+            p += 2;
+            real x = read_real(p, end), y = read_real(p, end), z = read_real(p, end);
+            mesh.normals.push_back(vec3(x, y, z));
+        }else if(p[0] == 'v' && p[1] == 't'){
+            p += 2;
+            real u = read_real(p, end), v = read_real(p, end);
+            mesh.uvs.push_back(mesh_uv{u, v});
+        }else if(p[0] == 'f' && is_space(p[1])){
+            face(p + 2, end);
+        }
+    }
+
+private:
+    struct corner {
+        int64_t v, t, n;
+    };
+
+    triangle_mesh& mesh;
+    std::vector<corner> polygon;
+
+    // v, v/t, v//n or v/t/n per corner, polygons are split into a fan around the first corner
+    void face(const char* p, const char* end){
+        polygon.clear();
+        bool valid = true;
+        while(true){
+            skip_spaces(p, end);
+            if(p == end || !is_number_start(*p)) break;
+
+            corner c{read_int(p, end), 0, 0};
+            if(p < end && *p == '/'){
+                ++p;
+                if(p < end && *p != '/') c.t = read_int(p, end);
+                if(p < end && *p == '/'){
+                    ++p;
+                    c.n = read_int(p, end);
+                }
+            }
+            valid &= resolve(c.v, mesh.positions.size()) && resolve(c.t, mesh.uvs.size()) && resolve(c.n, mesh.normals.size());
+            polygon.push_back(c);
+        }
+
+        if(!valid || polygon.size() < 3){
+            ++skipped_faces;
+            return;
+        }
+
+        for(size_t k = 2; k < polygon.size(); ++k){
+            const corner* fan[3] = {&polygon[0], &polygon[k - 1], &polygon[k]};
+            bool has_t = true, has_n = true;
+            for(const corner* c : fan){
+                has_t &= c->t >= 0;
+                has_n &= c->n >= 0;
+            }
+
+            mesh_face f;
+            for(int i = 0; i < 3; ++i){
+                f.v[i] = static_cast<uint32_t>(fan[i]->v);
+                f.t[i] = has_t ? static_cast<int32_t>(fan[i]->t) : -1;
+                f.n[i] = has_n ? static_cast<int32_t>(fan[i]->n) : -1;
+            }
+            mesh.faces.push_back(f);
+        }
+    }
+
+    // 1 based, negative counts back from the end, 0 means the corner had none and becomes -1
+    static bool resolve(int64_t& index, size_t count){
+        if(index == 0){
+            index = -1;
+            return true;
+        }
+        index = index > 0 ? index - 1 : static_cast<int64_t>(count) + index;
+        return index >= 0 && index < static_cast<int64_t>(count);
+    }
+
+    static bool is_space(char c){
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    static bool is_number_start(char c){
+        return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+    }
+
+    static void skip_spaces(const char*& p, const char* end){
+        while(p < end && is_space(*p)) ++p;
+    }
+
+    // numbers never run past the line: it ends in a newline or, for the last line, a terminating zero
+    static real read_real(const char*& p, const char* end){
+        skip_spaces(p, end);
+        if(p == end || !is_number_start(*p)) return 0;
+        char* after;
+        real x = static_cast<real>(std::strtod(p, &after));
+        p = after;
+        return x;
+    }
+
+    static int64_t read_int(const char*& p, const char* end){
+        if(p == end || !is_number_start(*p)) return 0;
+        char* after;
+        int64_t x = std::strtoll(p, &after, 10);
+        p = after;
+        return x;
+    }
+};
+
+// streams a wavefront obj through a fixed size buffer, so the file is never in memory as a whole
+// v, vt, vn and f lines are read, everything else (groups, materials, smoothing) is skipped
+// prints an error and returns an empty mesh when the file can't be read
+inline shared_ptr<triangle_mesh> load_obj(const std::string& filename, shared_ptr<material> mat){
+    auto mesh = make_shared<triangle_mesh>(mat);
+
+    auto start = std::chrono::steady_clock::now();
+    std::FILE* file = std::fopen(filename.c_str(), "rb");
+    if(!file){
+        std::cerr << "ERROR: Could not load obj file '" << filename << "'.\n";
+        return mesh;
+    }
+
+    obj_reader reader(*mesh);
+    std::vector<char> buffer(1 << 20);
+    std::string carry; // a line cut in two by the end of the buffer
+    size_t got;
+    while((got = std::fread(buffer.data(), 1, buffer.size(), file)) > 0){
+        const char* line_start = buffer.data();
+        const char* chunk_end = buffer.data() + got;
+        for(const char* p = line_start; p < chunk_end; ++p){
+            if(*p != '\n') continue;
+            if(carry.empty()){
+                reader.line(line_start, p);
+            }else{
+                carry.append(line_start, p);
+                carry += '\n';
+                reader.line(carry.data(), carry.data() + carry.size() - 1);
+                carry.clear();
+            }
+            line_start = p + 1;
+        }
+        carry.append(line_start, chunk_end);
+    }
+    if(!carry.empty()){
+        reader.line(carry.data(), carry.data() + carry.size());
+    }
+    std::fclose(file);
+    std::chrono::duration<double> parse_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    mesh->build();
+    std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - start;
+
+    size_t triangles = mesh->triangle_count();
+    std::clog << "Loaded '" << filename << "': " << triangles << " triangles, " << mesh->positions.size()
+              << " vertices in " << parse_time.count() << "s, bvh in " << build_time.count() << "s, "
+              << (triangles ? mesh->memory_bytes() / triangles : 0) << " bytes per triangle";
+    if(reader.skipped_faces){
+        std::clog << ", skipped " << reader.skipped_faces << " broken faces";
+    }
+    std::clog << "\n";
+    return mesh;
+}
+
+#endif
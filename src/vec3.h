@@ -1,124 +1,147 @@
 #ifndef VEC3_H
 #define VEC3_H
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
 using std::sqrt;
 
-class vec3{
+// T is the scalar, the renderer uses vec3 (of real) everywhere
+// and only reaches for another T where precision or size matters
+template<typename T>
+class vec3_t{
 public:
-    double e[3];
+    using scalar = T;
+
+    T e[3];
     
-    vec3() : e{0, 0, 0} {}
-    vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+    vec3_t() : e{0, 0, 0} {}
+    vec3_t(T e0, T e1, T e2) : e{e0, e1, e2} {}
+
+    template<typename U>
+    explicit vec3_t(const vec3_t<U>& v) : e{static_cast<T>(v.e[0]), static_cast<T>(v.e[1]), static_cast<T>(v.e[2])} {}
 
-    double x() const {
+    T x() const {
         return e[0];
     }
-    double y() const {
+    T y() const {
         return e[1];
     }
-    double z() const {
+    T z() const {
         return e[2];
     }
 
-    vec3 operator-() const {
-        return vec3(-e[0], -e[1], -e[2]);
+    vec3_t operator-() const {
+        return vec3_t(-e[0], -e[1], -e[2]);
     }
-    double operator[](int i) const {
+    T operator[](int i) const {
         return e[i];
     }
-    double& operator[](int i) {
+    T& operator[](int i) {
         return e[i];
     }
 
-    vec3& operator+=(const vec3& other){
+    vec3_t& operator+=(const vec3_t& other){
         e[0] += other.e[0];
         e[1] += other.e[1];
         e[2] += other.e[2];
         return *this;
     }
-    vec3& operator-=(const vec3& other){
+    vec3_t& operator-=(const vec3_t& other){
         e[0] -= other.e[0];
         e[1] -= other.e[1];
         e[2] -= other.e[2];
         return *this;
     }
-    vec3& operator*=(double t){
+    vec3_t& operator*=(T t){
         e[0] *= t;
         e[1] *= t;
         e[2] *= t;
         return *this;
     }
-    vec3& operator/=(double t) {
+    vec3_t& operator/=(T t) {
         return (*this) *= 1/t;
     }
-    double length() const {
+    T length() const {
         return sqrt(length_squared());
     }
-    double length_squared() const {
+    T length_squared() const {
         return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
     }
 
     bool near_zero() const {
-        double eps = 1e-8;
+        T eps = 1e-8;
         return (fabs(e[0]) < eps) && (fabs(e[1]) < eps) && (fabs(e[2]) < eps);
     }
 
-    static vec3 random(){
-        return vec3(random_double(), random_double(), random_double());
+    static vec3_t random(){
+        return vec3_t(random_double(), random_double(), random_double());
     }
 
-    static vec3 random(double min, double max){
-        return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+    static vec3_t random(T min, T max){
+        return vec3_t(random_double(min, max), random_double(min, max), random_double(min, max));
     }
 };
 
+using vec3 = vec3_t<real>;
 using point3 = vec3;
 
-inline std::ostream& operator<<(std::ostream &out, const vec3& v){
+// scalars are taken as vec3_t<T>::scalar so T is only deduced from the vectors
+// and 2 * v or 0.5 * v work for every T
+
+template<typename T>
+inline std::ostream& operator<<(std::ostream &out, const vec3_t<T>& v){
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline vec3 operator+(const vec3& v, const vec3& u){
-    return vec3(v.e[0] + u.e[0], v.e[1] + u.e[1], v.e[2] + u.e[2]);
+template<typename T>
+inline vec3_t<T> operator+(const vec3_t<T>& v, const vec3_t<T>& u){
+    return vec3_t<T>(v.e[0] + u.e[0], v.e[1] + u.e[1], v.e[2] + u.e[2]);
 }
 
-inline vec3 operator-(const vec3& v, const vec3& u){
-    return vec3(v.e[0] - u.e[0], v.e[1] - u.e[1], v.e[2] - u.e[2]);
+template<typename T>
+inline vec3_t<T> operator-(const vec3_t<T>& v, const vec3_t<T>& u){
+    return vec3_t<T>(v.e[0] - u.e[0], v.e[1] - u.e[1], v.e[2] - u.e[2]);
 }
 
 // not really mathematical
-inline vec3 operator*(const vec3& v, const vec3& u){
-    return vec3(v.e[0] * u.e[0], v.e[1] * u.e[1], v.e[2] * u.e[2]);
+template<typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& v, const vec3_t<T>& u){
+    return vec3_t<T>(v.e[0] * u.e[0], v.e[1] * u.e[1], v.e[2] * u.e[2]);
 }
 
-inline vec3 operator*(const vec3& v, const double t){
-    return vec3(v.e[0] * t, v.e[1] * t, v.e[2] * t);
+template<typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& v, const typename vec3_t<T>::scalar t){
+    return vec3_t<T>(v.e[0] * t, v.e[1] * t, v.e[2] * t);
 }
 
-inline vec3 operator*(const double t, const vec3& v){
+template<typename T>
+inline vec3_t<T> operator*(const typename vec3_t<T>::scalar t, const vec3_t<T>& v){
     return v * t;
 }
 
-inline vec3 operator/(const vec3& v, double t){
+template<typename T>
+inline vec3_t<T> operator/(const vec3_t<T>& v, typename vec3_t<T>::scalar t){
     return (1/t) * v;
 }
 
-inline double dot(const vec3& v, const vec3& u){
+template<typename T>
+inline T dot(const vec3_t<T>& v, const vec3_t<T>& u){
     return v.e[0] * u.e[0] + v.e[1] * u.e[1] + v.e[2] * u.e[2]; 
 }
 
-inline vec3 cross(const vec3& v, const vec3& u){
-    return vec3(
+template<typename T>
+inline vec3_t<T> cross(const vec3_t<T>& v, const vec3_t<T>& u){
+    return vec3_t<T>(
         v.e[1] * u.e[2] - v.e[2] * u.e[1],
         v.e[2] * u.e[0] - v.e[0] * u.e[2],
         v.e[0] * u.e[1] - v.e[1] * u.e[0]
     );
 }
 
-inline vec3 unit_vector(const vec3& v){
+template<typename T>
+inline vec3_t<T> unit_vector(const vec3_t<T>& v){
     return v / v.length();
 }
 
@@ -154,21 +177,51 @@ inline vec3 reflect(const vec3& v, const vec3& n) {
 }
 
 // v and n must be unit vectors
-inline vec3 refract(const vec3& v, const vec3 n, double etai_over_etat){
-    double cos_theta = fmin(dot(-v, n), 1.0);
+inline vec3 refract(const vec3& v, const vec3 n, real etai_over_etat){
+    real cos_theta = fmin(dot(-v, n), 1.0);
     vec3 r_out_perp = etai_over_etat * (v + cos_theta * n);
     vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
     return r_out_parallel + r_out_perp;
 }
 
-inline vec3 random_cosine_direction(){
-    double r1 = random_double();
-    double r2 = random_double();
+// sample_unit_disk, sample_unit_vector and random_cosine_direction take one 2d sample each and map
+// it without rejection, so the sampler's stratification carries over to the directions
+inline vec3 sample_unit_disk(){
+    sample2 s = sample_2d();
+    // Shirley's concentric mapping, square rings go to circles
+    real a = 2 * s.x - 1;
+    real b = 2 * s.y - 1;
+    if(a == 0 && b == 0){
+        return vec3(0, 0, 0);
+    }
+    real r, phi;
+    if(std::fabs(a) > std::fabs(b)){
+        r = a;
+        phi = (pi / 4) * (b / a);
+    }else{
+        r = b;
+        phi = pi / 2 - (pi / 4) * (a / b);
+    }
+    return vec3(r * cos(phi), r * sin(phi), 0);
+}
 
-    double phi = 2 * pi * r1;
-    double x = cos(phi) * sqrt(r2);
-    double y = sin(phi) * sqrt(r2);
-    double z = sqrt(1 - r2);
+inline vec3 sample_unit_vector(){
+    sample2 s = sample_2d();
+    real z = 1 - 2 * s.x;
+    real r = sqrt(std::max<real>(0, 1 - z * z));
+    real phi = 2 * pi * s.y;
+    return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+inline vec3 random_cosine_direction(){
+    sample2 s = sample_2d();
+    real r1 = s.x;
+    real r2 = s.y;
+
+    real phi = 2 * pi * r1;
+    real x = cos(phi) * sqrt(r2);
+    real y = sin(phi) * sqrt(r2);
+    real z = sqrt(1 - r2);
     
     return vec3(x, y, z);
 }